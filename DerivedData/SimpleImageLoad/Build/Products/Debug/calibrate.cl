@@ -0,0 +1,17 @@
+// A short run of the kind of work the filters do, a 3x3 box over an RGBA
+// image through a sampler, timed by devices.cpp to rank the devices
+// against each other.
+
+__kernel void calibrate(__read_only image2d_t srcImg,
+                        __write_only image2d_t dstImg)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP_TO_EDGE |
+                              CLK_FILTER_NEAREST;
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    float4 sum = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int j = -1; j <= 1; j++)
+        for (int i = -1; i <= 1; i++)
+            sum += read_imagef(srcImg, sampler, coord + (int2)(i, j));
+    write_imagef(dstImg, coord, sum / 9.0f);
+}
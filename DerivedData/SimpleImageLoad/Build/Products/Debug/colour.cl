@@ -0,0 +1,182 @@
+// Colour space conversions, usable on their own (colour_convert) or fused
+// into the load and store side of the Gaussian filter
+// (gaussian_filter_colour) so a linear light blur needs no extra pass.
+//
+// Keep these in step with enum ColourTransform in colour.h
+#define COLOUR_NONE             0
+#define COLOUR_SRGB_TO_LINEAR   1
+#define COLOUR_LINEAR_TO_SRGB   2
+#define COLOUR_RGB_TO_YCBCR     3
+#define COLOUR_YCBCR_TO_RGB     4
+#define COLOUR_RGB_TO_GRAY      5
+
+float4 srgbToLinear(float4 c, __constant float *srgbLUT)
+{
+    // 8-bit input, so the 256 entry table is exact
+    int4 index = convert_int4_sat_rte(c * 255.0f);
+    return (float4)(srgbLUT[clamp(index.x, 0, 255)],
+                    srgbLUT[clamp(index.y, 0, 255)],
+                    srgbLUT[clamp(index.z, 0, 255)],
+                    c.w);
+}
+
+float4 linearToSrgb(float4 c)
+{
+    float3 v = clamp(c.xyz, 0.0f, 1.0f);
+    float3 low = v * 12.92f;
+    float3 high = 1.055f * powr(v, 1.0f / 2.4f) - 0.055f;
+    float3 srgb = select(high, low, isless(v, (float3)(0.0031308f)));
+    return (float4)(srgb, c.w);
+}
+
+// full range BT.601 (JFIF), result is (Y, Cb, Cr, A)
+float4 rgbToYCbCr(float4 c)
+{
+    float y  =  0.299f    * c.x + 0.587f    * c.y + 0.114f    * c.z;
+    float cb = -0.168736f * c.x - 0.331264f * c.y + 0.5f      * c.z + 0.5f;
+    float cr =  0.5f      * c.x - 0.418688f * c.y - 0.081312f * c.z + 0.5f;
+    return (float4)(y, cb, cr, c.w);
+}
+
+float4 yCbCrToRgb(float4 c)
+{
+    float cb = c.y - 0.5f;
+    float cr = c.z - 0.5f;
+    return (float4)(c.x + 1.402f * cr,
+                    c.x - 0.344136f * cb - 0.714136f * cr,
+                    c.x + 1.772f * cb,
+                    c.w);
+}
+
+float4 rgbToGray(float4 c)
+{
+    float y = 0.299f * c.x + 0.587f * c.y + 0.114f * c.z;
+    return (float4)(y, y, y, c.w);
+}
+
+float4 applyColourTransform(float4 c, int transform, __constant float *srgbLUT)
+{
+    switch (transform)
+    {
+        case COLOUR_SRGB_TO_LINEAR: return srgbToLinear(c, srgbLUT);
+        case COLOUR_LINEAR_TO_SRGB: return linearToSrgb(c);
+        case COLOUR_RGB_TO_YCBCR:   return rgbToYCbCr(c);
+        case COLOUR_YCBCR_TO_RGB:   return yCbCrToRgb(c);
+        case COLOUR_RGB_TO_GRAY:    return rgbToGray(c);
+    }
+    return c;
+}
+
+// Images loaded through FreeImage on little endian hosts hold BGRA in the
+// CL_RGBA channels, swapRB puts red back in .x while the transforms run
+__kernel void colour_convert(__read_only image2d_t srcImg,
+                             __write_only image2d_t dstImg,
+                             sampler_t sampler,
+                             int width, int height,
+                             __constant float *srgbLUT,
+                             int loadTransform, int storeTransform,
+                             int swapRB)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if (coord.x >= width || coord.y >= height)
+        return;
+    float4 c = read_imagef(srcImg, sampler, coord);
+    if (swapRB)
+        c = c.zyxw;
+    c = applyColourTransform(c, loadTransform, srgbLUT);
+    c = applyColourTransform(c, storeTransform, srgbLUT);
+    write_imagef(dstImg, coord, swapRB ? c.zyxw : c);
+}
+
+__kernel void gaussian_filter_colour(__read_only image2d_t srcImg,
+                                     __write_only image2d_t dstImg,
+                                     sampler_t sampler,
+                                     int width, int height,
+                                     __constant float *srgbLUT,
+                                     int loadTransform, int storeTransform,
+                                     int swapRB)
+{
+    // Gaussian Kernel is:
+    // 1  2  1
+    // 2  4  2
+    // 1  2  1
+    float kernelWeights[9] = { 1.0f, 2.0f, 1.0f,
+        2.0f, 4.0f, 2.0f,
+        1.0f, 2.0f, 1.0f };
+    int2 outImageCoord = (int2)(get_global_id(0), get_global_id(1));
+    if (outImageCoord.x >= width || outImageCoord.y >= height)
+        return;
+
+    int weight = 0;
+    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int y = outImageCoord.y - 1; y <= outImageCoord.y + 1; y++)
+    {
+        for (int x = outImageCoord.x - 1; x <= outImageCoord.x + 1; x++)
+        {
+            float4 c = read_imagef(srcImg, sampler, (int2)(x, y));
+            if (swapRB)
+                c = c.zyxw;
+            c = applyColourTransform(c, loadTransform, srgbLUT);
+            outColor += c * (kernelWeights[weight] / 16.0f);
+            weight += 1;
+        }
+    }
+    outColor = applyColourTransform(outColor, storeTransform, srgbLUT);
+    write_imagef(dstImg, outImageCoord, swapRB ? outColor.zyxw : outColor);
+}
+
+// gaussian_filter_colour and colour_convert over a batch of small images
+// packed into one atlas, each with a filter of its own. tiles holds
+// (x, y, width, height) of every image and filters its (blur,
+// loadTransform, storeTransform, unused); the launch is (widest, tallest,
+// images). Blurred reads are clamped to the image's own tile so its
+// neighbours in the atlas never bleed into it.
+__kernel void colour_filter_atlas(__read_only image2d_t srcImg,
+                                  __write_only image2d_t dstImg,
+                                  sampler_t sampler,
+                                  __global const int4 *tiles,
+                                  __global const int4 *filters,
+                                  __constant float *srgbLUT,
+                                  int swapRB)
+{
+    float kernelWeights[9] = { 1.0f, 2.0f, 1.0f,
+        2.0f, 4.0f, 2.0f,
+        1.0f, 2.0f, 1.0f };
+    int4 tile = tiles[get_global_id(2)];
+    int4 filter = filters[get_global_id(2)];
+    int2 pixel = (int2)(get_global_id(0), get_global_id(1));
+    if (pixel.x >= tile.z || pixel.y >= tile.w)
+        return;
+
+    int2 outImageCoord = tile.xy + pixel;
+    float4 outColor;
+    if (filter.x)
+    {
+        int2 firstCoord = tile.xy;
+        int2 lastCoord = tile.xy + tile.zw - 1;
+        int weight = 0;
+        outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+        for (int y = -1; y <= 1; y++)
+        {
+            for (int x = -1; x <= 1; x++)
+            {
+                int2 coord = clamp(outImageCoord + (int2)(x, y), firstCoord, lastCoord);
+                float4 c = read_imagef(srcImg, sampler, coord);
+                if (swapRB)
+                    c = c.zyxw;
+                c = applyColourTransform(c, filter.y, srgbLUT);
+                outColor += c * (kernelWeights[weight] / 16.0f);
+                weight += 1;
+            }
+        }
+    }
+    else
+    {
+        outColor = read_imagef(srcImg, sampler, outImageCoord);
+        if (swapRB)
+            outColor = outColor.zyxw;
+        outColor = applyColourTransform(outColor, filter.y, srgbLUT);
+    }
+    outColor = applyColourTransform(outColor, filter.z, srgbLUT);
+    write_imagef(dstImg, outImageCoord, swapRB ? outColor.zyxw : outColor);
+}
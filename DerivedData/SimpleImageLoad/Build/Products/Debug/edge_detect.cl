@@ -0,0 +1,114 @@
+// Canny style edge detection, chained after gaussian_filter.
+//
+// sobel -> non_max_suppression -> hysteresis_threshold, then
+// hysteresis_propagate is launched repeatedly until no weak edge changes,
+// and hysteresis_finalize drops the weak edges that were never reached.
+// Everything but the final 8-bit edge map stays on the device.
+
+#define EDGE_NONE   0
+#define EDGE_WEAK   128
+#define EDGE_STRONG 255
+
+// lumaWeights is set up by the host to match the channel order of the image
+__kernel void sobel(__read_only image2d_t srcImg,
+                    sampler_t sampler,
+                    int width, int height,
+                    float4 lumaWeights,
+                    __global float *magnitude,
+                    __global uchar *direction)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    float l[3][3];
+    for (int j = -1; j <= 1; j++)
+        for (int i = -1; i <= 1; i++)
+            l[j + 1][i + 1] = dot(read_imagef(srcImg, sampler, (int2)(x + i, y + j)), lumaWeights);
+
+    float gx = (l[0][2] + 2.0f * l[1][2] + l[2][2]) - (l[0][0] + 2.0f * l[1][0] + l[2][0]);
+    float gy = (l[2][0] + 2.0f * l[2][1] + l[2][2]) - (l[0][0] + 2.0f * l[0][1] + l[0][2]);
+
+    // quantise the gradient direction to 0, 45, 90 or 135 degrees
+    float angle = atan2(gy, gx);
+    if (angle < 0.0f)
+        angle += M_PI_F;
+    int sector = (int)floor(angle / (M_PI_F / 4.0f) + 0.5f) & 3;
+
+    magnitude[y * width + x] = hypot(gx, gy);
+    direction[y * width + x] = (uchar)sector;
+}
+
+__kernel void non_max_suppression(__global const float *magnitude,
+                                  __global const uchar *direction,
+                                  int width, int height,
+                                  __global float *thin)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    // neighbour offsets along the gradient for each sector
+    const int2 offsets[4] = { (int2)(1, 0), (int2)(1, 1), (int2)(0, 1), (int2)(-1, 1) };
+    int2 d = offsets[direction[y * width + x]];
+    int ax = clamp(x + d.x, 0, width - 1), ay = clamp(y + d.y, 0, height - 1);
+    int bx = clamp(x - d.x, 0, width - 1), by = clamp(y - d.y, 0, height - 1);
+
+    float m = magnitude[y * width + x];
+    bool isMax = m >= magnitude[ay * width + ax] && m >= magnitude[by * width + bx];
+    thin[y * width + x] = isMax ? m : 0.0f;
+}
+
+__kernel void hysteresis_threshold(__global const float *thin,
+                                   int width, int height,
+                                   float lowThreshold, float highThreshold,
+                                   __global uchar *edges)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    float m = thin[y * width + x];
+    edges[y * width + x] = m >= highThreshold ? EDGE_STRONG :
+                           (m >= lowThreshold ? EDGE_WEAK : EDGE_NONE);
+}
+
+// Promote weak edges touching a strong one. Updates are made in place and
+// only ever go from weak to strong, so racing with a neighbour can only make
+// a pass converge sooner.
+__kernel void hysteresis_propagate(__global uchar *edges,
+                                   int width, int height,
+                                   __global int *changed)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height || edges[y * width + x] != EDGE_WEAK)
+        return;
+
+    for (int j = max(y - 1, 0); j <= min(y + 1, height - 1); j++)
+    {
+        for (int i = max(x - 1, 0); i <= min(x + 1, width - 1); i++)
+        {
+            if (edges[j * width + i] == EDGE_STRONG)
+            {
+                edges[y * width + x] = EDGE_STRONG;
+                *changed = 1;
+                return;
+            }
+        }
+    }
+}
+
+__kernel void hysteresis_finalize(__global uchar *edges, int width, int height)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    if (edges[y * width + x] != EDGE_STRONG)
+        edges[y * width + x] = EDGE_NONE;
+}
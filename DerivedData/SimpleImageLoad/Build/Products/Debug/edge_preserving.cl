@@ -0,0 +1,198 @@
+// Edge preserving filters. Every kernel takes the same leading arguments as
+// gaussian_filter (srcImg, dstImg, sampler, width, height) so they drop into
+// the same launch and sampler setup.
+
+// compare-exchange, lane by lane, leaving the minimum in a
+#define SORT2(a, b) { float4 t_ = fmin(a, b); b = fmax(a, b); a = t_; }
+
+// 3x3 median with the 19 exchange network (Paeth / Devillard)
+__kernel void median_3x3(__read_only image2d_t srcImg,
+                         __write_only image2d_t dstImg,
+                         sampler_t sampler,
+                         int width, int height)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if (coord.x >= width || coord.y >= height)
+        return;
+
+    float4 p[9];
+    for (int k = 0; k < 9; k++)
+        p[k] = read_imagef(srcImg, sampler, coord + (int2)(k % 3 - 1, k / 3 - 1));
+
+    SORT2(p[1], p[2]); SORT2(p[4], p[5]); SORT2(p[7], p[8]);
+    SORT2(p[0], p[1]); SORT2(p[3], p[4]); SORT2(p[6], p[7]);
+    SORT2(p[1], p[2]); SORT2(p[4], p[5]); SORT2(p[7], p[8]);
+    SORT2(p[0], p[3]); SORT2(p[5], p[8]); SORT2(p[4], p[7]);
+    SORT2(p[3], p[6]); SORT2(p[1], p[4]); SORT2(p[2], p[5]);
+    SORT2(p[4], p[7]); SORT2(p[4], p[2]); SORT2(p[6], p[4]);
+    SORT2(p[4], p[2]);
+
+    write_imagef(dstImg, coord, p[4]);
+}
+
+// 5x5 median by forgetful selection: only 14 of the 25 samples are ever
+// live. Each step pushes the minimum and maximum of the set to its ends,
+// drops both and pulls in the next sample; neither can be the median.
+__kernel void median_5x5(__read_only image2d_t srcImg,
+                         __write_only image2d_t dstImg,
+                         sampler_t sampler,
+                         int width, int height)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if (coord.x >= width || coord.y >= height)
+        return;
+
+    float4 w[14];
+    for (int k = 0; k < 14; k++)
+        w[k] = read_imagef(srcImg, sampler, coord + (int2)(k % 5 - 2, k / 5 - 2));
+
+    int size = 14;
+    for (int k = 14; k < 25; k++)
+    {
+        for (int i = 1; i < size; i++)
+            SORT2(w[0], w[i]);
+        for (int i = 1; i < size - 1; i++)
+            SORT2(w[i], w[size - 1]);
+        w[0] = read_imagef(srcImg, sampler, coord + (int2)(k % 5 - 2, k / 5 - 2));
+        size--;
+    }
+    SORT2(w[0], w[1]); SORT2(w[1], w[2]); SORT2(w[0], w[1]);
+
+    write_imagef(dstImg, coord, w[1]);
+}
+
+// Constant time median filter (Perreault & Hebert) for any radius.
+//
+// Each work item owns a vertical strip of stripWidth output columns over
+// bandHeight rows, and keeps one 4 x 256 histogram per input column the
+// strip touches, in its slice of scratch. Moving down a row adds one pixel
+// to and removes one from every column histogram; moving right along the
+// row adds one column histogram to the window histogram and removes
+// another. Neither depends on the radius.
+#define CTMF_BINS 256
+#define CTMF_HISTOGRAM (4 * CTMF_BINS)
+
+void ctmfColumnUpdate(__global ushort *columns, int column, uint4 bin, int delta)
+{
+    __global ushort *h = columns + column * CTMF_HISTOGRAM;
+    h[bin.x] += delta;
+    h[CTMF_BINS + bin.y] += delta;
+    h[2 * CTMF_BINS + bin.z] += delta;
+    h[3 * CTMF_BINS + bin.w] += delta;
+}
+
+uint4 ctmfBin(__read_only image2d_t srcImg, sampler_t sampler, int x, int y)
+{
+    // the clamp to edge sampler does the border handling
+    return convert_uint4_sat_rte(read_imagef(srcImg, sampler, (int2)(x, y)) * 255.0f);
+}
+
+float4 ctmfMedian(__global const ushort *window, int half)
+{
+    float m[4];
+    for (int c = 0; c < 4; c++)
+    {
+        __global const ushort *h = window + c * CTMF_BINS;
+        int count = 0;
+        int bin = 0;
+        while (bin < CTMF_BINS - 1 && (count += h[bin]) <= half)
+            bin++;
+        m[c] = bin / 255.0f;
+    }
+    return (float4)(m[0], m[1], m[2], m[3]);
+}
+
+__kernel void median_ctmf(__read_only image2d_t srcImg,
+                          __write_only image2d_t dstImg,
+                          sampler_t sampler,
+                          int width, int height,
+                          int radius,
+                          int stripWidth, int bandHeight,
+                          __global ushort *scratch)
+{
+    int x0 = get_global_id(0) * stripWidth;
+    int y0 = get_global_id(1) * bandHeight;
+    if (x0 >= width || y0 >= height)
+        return;
+    int x1 = min(x0 + stripWidth, width);
+    int y1 = min(y0 + bandHeight, height);
+    int diameter = 2 * radius + 1;
+    int half = (diameter * diameter) / 2;
+    int columnCount = (x1 - x0) + 2 * radius;
+
+    size_t item = get_global_id(1) * get_global_size(0) + get_global_id(0);
+    __global ushort *columns = scratch +
+        item * (size_t)(stripWidth + 2 * radius + 1) * CTMF_HISTOGRAM;
+    __global ushort *window = columns + columnCount * CTMF_HISTOGRAM;
+
+    for (int i = 0; i < columnCount * CTMF_HISTOGRAM; i++)
+        columns[i] = 0;
+    // prime the columns with the 2 * radius rows above the first output row
+    for (int y = y0 - radius; y < y0 + radius; y++)
+        for (int j = 0; j < columnCount; j++)
+            ctmfColumnUpdate(columns, j, ctmfBin(srcImg, sampler, x0 - radius + j, y), 1);
+
+    for (int y = y0; y < y1; y++)
+    {
+        for (int j = 0; j < columnCount; j++)
+        {
+            int x = x0 - radius + j;
+            ctmfColumnUpdate(columns, j, ctmfBin(srcImg, sampler, x, y + radius), 1);
+            if (y > y0)
+                ctmfColumnUpdate(columns, j, ctmfBin(srcImg, sampler, x, y - radius - 1), -1);
+        }
+
+        for (int i = 0; i < CTMF_HISTOGRAM; i++)
+        {
+            ushort sum = 0;
+            for (int j = 0; j < diameter; j++)
+                sum += columns[j * CTMF_HISTOGRAM + i];
+            window[i] = sum;
+        }
+        write_imagef(dstImg, (int2)(x0, y), ctmfMedian(window, half));
+
+        for (int x = x0 + 1; x < x1; x++)
+        {
+            __global const ushort *in = columns + (x - x0 + 2 * radius) * CTMF_HISTOGRAM;
+            __global const ushort *out = columns + (x - x0 - 1) * CTMF_HISTOGRAM;
+            for (int i = 0; i < CTMF_HISTOGRAM; i++)
+                window[i] += in[i] - out[i];
+            write_imagef(dstImg, (int2)(x, y), ctmfMedian(window, half));
+        }
+    }
+}
+
+// Bilateral filter. spatialLUT holds the (2 radius + 1)^2 spatial weights,
+// rangeLUT the weight for each 8-bit difference between a sample and the
+// centre pixel (mean absolute difference over the colour channels).
+__kernel void bilateral_filter(__read_only image2d_t srcImg,
+                               __write_only image2d_t dstImg,
+                               sampler_t sampler,
+                               int width, int height,
+                               int radius,
+                               __constant float *spatialLUT,
+                               __constant float *rangeLUT)
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if (coord.x >= width || coord.y >= height)
+        return;
+
+    float4 centre = read_imagef(srcImg, sampler, coord);
+    float4 sum = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    float weightSum = 0.0f;
+    int weight = 0;
+    for (int j = -radius; j <= radius; j++)
+    {
+        for (int i = -radius; i <= radius; i++)
+        {
+            float4 c = read_imagef(srcImg, sampler, coord + (int2)(i, j));
+            float3 diff = fabs(c.xyz - centre.xyz);
+            int index = convert_int_sat_rte((diff.x + diff.y + diff.z) * (255.0f / 3.0f));
+            float w = spatialLUT[weight++] * rangeLUT[min(index, 255)];
+            sum += c * w;
+            weightSum += w;
+        }
+    }
+
+    write_imagef(dstImg, coord, sum / weightSum);
+}
@@ -34,3 +34,39 @@ __kernel void gaussian_filter(__read_only image2d_t srcImg,
         write_imagef(dstImg, outImageCoord, outColor);
     }
 }
+
+// gaussian_filter over a batch of small images packed into one atlas.
+// tiles holds (x, y, width, height) of every image and the launch is
+// (widest, tallest, images); reads are clamped to the image's own tile so
+// its neighbours in the atlas never bleed into it.
+__kernel void gaussian_filter_atlas(__read_only image2d_t srcImg,
+                                    __write_only image2d_t dstImg,
+                                    sampler_t sampler,
+                                    __global const int4 *tiles)
+{
+    float kernelWeights[9] = { 1.0f, 2.0f, 1.0f,
+        2.0f, 4.0f, 2.0f,
+        1.0f, 2.0f, 1.0f };
+    int4 tile = tiles[get_global_id(2)];
+    int2 pixel = (int2)(get_global_id(0), get_global_id(1));
+    if (pixel.x < tile.z && pixel.y < tile.w)
+    {
+        int2 firstCoord = tile.xy;
+        int2 lastCoord = tile.xy + tile.zw - 1;
+        int2 outImageCoord = tile.xy + pixel;
+        int weight = 0;
+        float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+        for(int y = -1; y <= 1; y++)
+        {
+            for(int x = -1; x <= 1; x++)
+            {
+                int2 coord = clamp(outImageCoord + (int2)(x, y), firstCoord, lastCoord);
+                outColor +=
+                (read_imagef(srcImg, sampler, coord) *
+                 (kernelWeights[weight] / 16.0f));
+                weight += 1;
+            }
+        }
+        write_imagef(dstImg, outImageCoord, outColor);
+    }
+}
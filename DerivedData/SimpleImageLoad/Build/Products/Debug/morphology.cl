@@ -0,0 +1,89 @@
+// Separable grey scale morphology with the van Herk / Gil-Werman algorithm.
+//
+// Each pass runs along lines (rows or columns) of a single channel buffer.
+// A line is padded by radius identity samples on both sides and cut into
+// blocks of k = 2 radius + 1. vhgw_scan stores the running max (or min)
+// from the start of each block in g and from the end of each block in h;
+// any k wide window then spans at most two blocks, so vhgw_merge needs
+// just h at its first sample and g at its last. The cost per pixel does not
+// depend on k.
+//
+// Positions and lines are mapped to memory through strides so the same
+// kernels do the horizontal and the vertical pass.
+
+uchar morphOp(uchar a, uchar b, int dilate)
+{
+    return dilate ? max(a, b) : min(a, b);
+}
+
+__kernel void vhgw_scan(__global const uchar *src,
+                        __global uchar *g,
+                        __global uchar *h,
+                        int length, int lines,
+                        int srcPosStride, int srcLineStride,
+                        int padPosStride, int padLineStride,
+                        int radius, int dilate)
+{
+    int line = get_global_id(0);
+    int block = get_global_id(1);
+    int k = 2 * radius + 1;
+    int padded = length + 2 * radius;
+    int p0 = block * k;
+    if (line >= lines || p0 >= padded)
+        return;
+    int p1 = min(p0 + k, padded);
+    uchar identity = dilate ? 0 : 255;
+
+    __global const uchar *in = src + line * srcLineStride;
+    __global uchar *gLine = g + line * padLineStride;
+    __global uchar *hLine = h + line * padLineStride;
+
+    uchar acc = identity;
+    for (int p = p0; p < p1; p++)
+    {
+        int x = p - radius;
+        uchar v = (x >= 0 && x < length) ? in[x * srcPosStride] : identity;
+        acc = morphOp(acc, v, dilate);
+        gLine[p * padPosStride] = acc;
+    }
+    acc = identity;
+    for (int p = p1 - 1; p >= p0; p--)
+    {
+        int x = p - radius;
+        uchar v = (x >= 0 && x < length) ? in[x * srcPosStride] : identity;
+        acc = morphOp(acc, v, dilate);
+        hLine[p * padPosStride] = acc;
+    }
+}
+
+// posDim picks which global dimension walks along the line, so that
+// neighbouring work items always touch neighbouring bytes of dst
+__kernel void vhgw_merge(__global const uchar *g,
+                         __global const uchar *h,
+                         __global uchar *dst,
+                         int length, int lines,
+                         int dstPosStride, int dstLineStride,
+                         int padPosStride, int padLineStride,
+                         int radius, int dilate, int posDim)
+{
+    int x = get_global_id(posDim);
+    int line = get_global_id(1 - posDim);
+    if (x >= length || line >= lines)
+        return;
+
+    // output x covers padded samples x .. x + 2 radius
+    int first = line * padLineStride + x * padPosStride;
+    int last = line * padLineStride + (x + 2 * radius) * padPosStride;
+    dst[line * dstLineStride + x * dstPosStride] = morphOp(h[first], g[last], dilate);
+}
+
+// dst = saturate(a - b), for the top-hat transforms
+__kernel void morph_subtract(__global const uchar *a,
+                             __global const uchar *b,
+                             __global uchar *dst,
+                             int count)
+{
+    int i = get_global_id(0);
+    if (i < count)
+        dst[i] = sub_sat(a[i], b[i]);
+}
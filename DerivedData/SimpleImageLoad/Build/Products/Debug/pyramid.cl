@@ -0,0 +1,53 @@
+// Gaussian pyramid REDUCE step.
+//
+// Every level of the pyramid lives in the same buffer, packed one after the
+// other (level 0 first), so a whole chain is a sequence of launches of this
+// kernel over a single allocation. Each launch reads the level starting at
+// srcOffset and writes the half sized level starting at dstOffset.
+
+// 5-tap binomial (Burt & Adelson) weights, 1 4 6 4 1 / 16
+__constant float pyramidWeights[5] = { 0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f };
+
+__kernel void pyramid_reduce(__global uchar4 *pyramid,
+                             int srcOffset, int srcWidth, int srcHeight,
+                             int dstOffset, int dstWidth, int dstHeight)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= dstWidth || y >= dstHeight)
+        return;
+
+    __global uchar4 *src = pyramid + srcOffset;
+    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+
+    // blur and decimate in one go: only the even source samples are filtered
+    for (int j = -2; j <= 2; j++)
+    {
+        int sy = clamp(2 * y + j, 0, srcHeight - 1);
+        float4 rowColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+        for (int i = -2; i <= 2; i++)
+        {
+            int sx = clamp(2 * x + i, 0, srcWidth - 1);
+            rowColor += convert_float4(src[sy * srcWidth + sx]) * pyramidWeights[i + 2];
+        }
+        outColor += rowColor * pyramidWeights[j + 2];
+    }
+
+    pyramid[dstOffset + y * dstWidth + x] = convert_uchar4_sat_rte(outColor);
+}
+
+// Copies one level into an image for reading back. The image's channel
+// order need not be the buffer's: a CL_BGRA one swaps red and blue on the
+// way in, so the level comes back in the order its encoder takes.
+__kernel void pyramid_level_to_image(__global const uchar4 *pyramid,
+                                     int offset, int width, int height,
+                                     __write_only image2d_t dstImg)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    float4 color = convert_float4(pyramid[offset + y * width + x]) / 255.0f;
+    write_imagef(dstImg, (int2)(x, y), color);
+}
@@ -0,0 +1,52 @@
+// Separable resampling.
+//
+// The host precomputes, for every output column (and every output row), the
+// first source sample it touches and a fixed number of weights, zero padded
+// up to taps. The Gaussian blur and, when shrinking, the antialias prefilter
+// are already folded into those weights, so a resize is exactly two passes:
+// horizontal into a float4 scratch buffer, then vertical into the output.
+
+__kernel void resample_horizontal(__read_only image2d_t srcImg,
+                                  __global float4 *dst,
+                                  sampler_t sampler,
+                                  __global const int *starts,
+                                  __global const float *weights,
+                                  int taps, int dstWidth, int height)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= dstWidth || y >= height)
+        return;
+
+    int start = starts[x];
+    __global const float *w = weights + x * taps;
+    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    // the clamp to edge sampler takes care of taps hanging off either side
+    for (int t = 0; t < taps; t++)
+        outColor += read_imagef(srcImg, sampler, (int2)(start + t, y)) * w[t];
+
+    dst[y * dstWidth + x] = outColor;
+}
+
+__kernel void resample_vertical(__global const float4 *src,
+                                __write_only image2d_t dstImg,
+                                __global const int *starts,
+                                __global const float *weights,
+                                int taps, int width, int srcHeight, int dstHeight)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= dstHeight)
+        return;
+
+    int start = starts[y];
+    __global const float *w = weights + y * taps;
+    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int t = 0; t < taps; t++)
+    {
+        int sy = clamp(start + t, 0, srcHeight - 1);
+        outColor += src[sy * width + x] * w[t];
+    }
+
+    write_imagef(dstImg, (int2)(x, y), outColor);
+}
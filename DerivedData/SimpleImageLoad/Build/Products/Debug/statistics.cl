@@ -0,0 +1,43 @@
+#pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
+#pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable
+
+#define HISTOGRAM_BINS 256
+
+// Per channel 8-bit histogram of an RGBA image.
+//
+// Each work-group builds a private histogram in __local memory, striding
+// over the image so only a few groups are launched, and then merges it into
+// the global result with one atomic per non-empty bin. histogram holds four
+// consecutive 256 bin tables (one per channel) and must start zeroed.
+__kernel void histogram_rgba(__read_only image2d_t srcImg,
+                             sampler_t sampler,
+                             int width, int height,
+                             __global uint *histogram)
+{
+    __local uint localHistogram[4 * HISTOGRAM_BINS];
+    int lid = get_local_id(0);
+    int localSize = get_local_size(0);
+
+    for (int i = lid; i < 4 * HISTOGRAM_BINS; i += localSize)
+        localHistogram[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int pixels = width * height;
+    for (int p = get_global_id(0); p < pixels; p += get_global_size(0))
+    {
+        int2 coord = (int2)(p % width, p / width);
+        uint4 bin = convert_uint4_sat_rte(read_imagef(srcImg, sampler, coord) * 255.0f);
+        atomic_inc(&localHistogram[bin.x]);
+        atomic_inc(&localHistogram[HISTOGRAM_BINS + bin.y]);
+        atomic_inc(&localHistogram[2 * HISTOGRAM_BINS + bin.z]);
+        atomic_inc(&localHistogram[3 * HISTOGRAM_BINS + bin.w]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int i = lid; i < 4 * HISTOGRAM_BINS; i += localSize)
+    {
+        uint count = localHistogram[i];
+        if (count)
+            atomic_add(&histogram[i], count);
+    }
+}
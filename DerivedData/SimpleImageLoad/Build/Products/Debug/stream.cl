@@ -0,0 +1,84 @@
+// Planar Y'CbCr <-> RGBA conversions for the Y4M streaming mode.
+//
+// A frame arrives as one buffer holding the Y plane followed by the Cb and
+// Cr planes (subsampled by 2 in both directions for 4:2:0, full size for
+// 4:4:4). yuv_to_rgba expands it into the RGBA image the filters read and
+// rgba_to_yuv packs the filtered image back into the same layout.
+//
+// Y4M writers use studio swing BT.601 (Y' 16-235, CbCr 16-240), unlike the
+// full range JFIF matrices in colour.cl.
+
+__kernel void yuv_to_rgba(__global const uchar *planes,
+                          __write_only image2d_t dstImg,
+                          int width, int height,
+                          int chromaShift, int swapRB)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    int chromaWidth = (width + chromaShift) >> chromaShift;
+    int chromaHeight = (height + chromaShift) >> chromaShift;
+    __global const uchar *cbPlane = planes + width * height;
+    __global const uchar *crPlane = cbPlane + chromaWidth * chromaHeight;
+    int chroma = (y >> chromaShift) * chromaWidth + (x >> chromaShift);
+
+    float luma = 1.164383f * ((float)planes[y * width + x] - 16.0f);
+    float cb = (float)cbPlane[chroma] - 128.0f;
+    float cr = (float)crPlane[chroma] - 128.0f;
+
+    float4 c = (float4)(luma + 1.596027f * cr,
+                        luma - 0.391762f * cb - 0.812968f * cr,
+                        luma + 2.017232f * cb,
+                        255.0f) / 255.0f;
+    // keep the same channel order FreeImage gives the other kernels
+    if (swapRB)
+        c = c.zyxw;
+    write_imagef(dstImg, (int2)(x, y), clamp(c, 0.0f, 1.0f));
+}
+
+// One work item per chroma sample, covering the 2x2 (or 1x1) block of luma
+// samples it is shared by
+__kernel void rgba_to_yuv(__read_only image2d_t srcImg,
+                          __global uchar *planes,
+                          int width, int height,
+                          int chromaShift, int swapRB)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |
+                              CLK_ADDRESS_CLAMP_TO_EDGE |
+                              CLK_FILTER_NEAREST;
+    int cx = get_global_id(0);
+    int cy = get_global_id(1);
+    int chromaWidth = (width + chromaShift) >> chromaShift;
+    int chromaHeight = (height + chromaShift) >> chromaShift;
+    if (cx >= chromaWidth || cy >= chromaHeight)
+        return;
+
+    int block = 1 << chromaShift;
+    float3 sum = (float3)(0.0f, 0.0f, 0.0f);
+    for (int j = 0; j < block; j++)
+    {
+        for (int i = 0; i < block; i++)
+        {
+            int x = cx * block + i;
+            int y = cy * block + j;
+            // clamped reads repeat the last row/column of odd sized frames
+            float4 c = read_imagef(srcImg, sampler, (int2)(x, y));
+            float3 rgb = swapRB ? c.zyx : c.xyz;
+            sum += rgb;
+            if (x < width && y < height)
+            {
+                float luma = 16.0f + 65.481f * rgb.x + 128.553f * rgb.y + 24.966f * rgb.z;
+                planes[y * width + x] = convert_uchar_sat_rte(luma);
+            }
+        }
+    }
+
+    float3 rgb = sum / (float)(block * block);
+    float cb = 128.0f - 37.797f * rgb.x - 74.203f * rgb.y + 112.0f * rgb.z;
+    float cr = 128.0f + 112.0f * rgb.x - 93.786f * rgb.y - 18.214f * rgb.z;
+    int chroma = cy * chromaWidth + cx;
+    planes[width * height + chroma] = convert_uchar_sat_rte(cb);
+    planes[width * height + chromaWidth * chromaHeight + chroma] = convert_uchar_sat_rte(cr);
+}
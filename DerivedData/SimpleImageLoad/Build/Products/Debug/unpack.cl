@@ -0,0 +1,28 @@
+// Expands packed 8-bit pixels into the 32-bit image the filters read.
+//
+// The loaders upload 24-bit RGB and 8-bit grey scanlines as they are, a
+// quarter (or three quarters) fewer bytes than the RGBA they become, and
+// this fills in the alpha on the device instead of on the host. Rows are
+// pitch bytes apart, so FreeImage's padded scanlines go up untouched.
+
+__kernel void unpack_pixels(__global const uchar *packed,
+                            int pitch, int channels, int swapRB,
+                            __write_only image2d_t dstImg,
+                            int width, int height)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    __global const uchar *p = packed + y * pitch + x * channels;
+    float4 c;
+    if (channels == 1)
+        c = (float4)(p[0], p[0], p[0], 255.0f);
+    else
+        c = (float4)(p[0], p[1], p[2], 255.0f);
+    // keep the same channel order FreeImage gives the other kernels
+    if (swapRB)
+        c = c.zyxw;
+    write_imagef(dstImg, (int2)(x, y), c / 255.0f);
+}
@@ -0,0 +1,41 @@
+// Separable 3D Gaussian over a float volume (or a z slab of one).
+//
+// One launch per axis. Dimension 0 of the launch is always x, so even the
+// y and z passes have neighbouring work items reading neighbouring
+// addresses: a work group walks whole rows of the planes above and below
+// rather than striding through memory a plane at a time.
+
+__kernel void gaussian_volume_pass(__global const float *src,
+                                   __global float *dst,
+                                   int width, int height, int depth,
+                                   int axis,
+                                   __constant float *weights,
+                                   int radius)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int z = get_global_id(2);
+    if (x >= width || y >= height || z >= depth)
+        return;
+
+    long centre = ((long)z * height + y) * width + x;
+    int coord, length;
+    long stride;
+    if (axis == 0) {
+        coord = x; length = width; stride = 1;
+    } else if (axis == 1) {
+        coord = y; length = height; stride = width;
+    } else {
+        coord = z; length = depth; stride = (long)width * height;
+    }
+
+    // clamp to edge; inside a slab the z halo makes the clamp unreachable
+    // for every plane that is kept
+    float sum = 0.0f;
+    for (int i = -radius; i <= radius; i++)
+    {
+        int c = clamp(coord + i, 0, length - 1);
+        sum += weights[i + radius] * src[centre + (c - coord) * stride];
+    }
+    dst[centre] = sum;
+}
@@ -0,0 +1,318 @@
+//
+//  atlas.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "atlas.h"
+#include "memorypool.h"
+#include "staging.h"
+
+struct TallerFirst {
+    const int *heights;
+    bool operator()(int a, int b) const { return heights[a] > heights[b]; }
+};
+
+int PackAtlas(ImageAtlas &atlas,
+              char **images,
+              const int *widths,
+              const int *heights,
+              const int *candidates,
+              int count,
+              int maxWidth,
+              int maxHeight)
+{
+    std::vector<int> order(candidates, candidates + count);
+    double area = 0;
+    int widest = 0;
+    for (int i = 0; i < count; i++) {
+        area += (double)widths[order[i]] * heights[order[i]];
+        widest = std::max(widest, widths[order[i]]);
+    }
+    TallerFirst tallerFirst = { heights };
+    std::stable_sort(order.begin(), order.end(), tallerFirst);
+
+    // roughly square, which keeps the shelves from wasting much
+    int atlasWidth = (int)ceil(sqrt(area));
+    atlasWidth = std::min(std::max(atlasWidth, widest), maxWidth);
+
+    atlas.index = new int[count];
+    atlas.tiles = new AtlasTile[count];
+    atlas.filters = NULL;
+    atlas.count = 0;
+    atlas.widest = atlas.tallest = 0;
+    atlas.images[0] = atlas.images[1] = atlas.tileBuffer = atlas.filterBuffer = 0;
+    atlas.rgba = false;
+    int x = 0, shelfY = 0, shelfHeight = 0;
+    for (int i = 0; i < count; i++) {
+        int image = order[i];
+        if (widths[image] > atlasWidth)
+            continue;
+        if (x + widths[image] > atlasWidth) {
+            shelfY += shelfHeight;
+            x = shelfHeight = 0;
+        }
+        // tallest first, so nothing after this fits either
+        if (shelfY + heights[image] > maxHeight)
+            break;
+        AtlasTile &tile = atlas.tiles[atlas.count];
+        tile.x = x;
+        tile.y = shelfY;
+        tile.width = widths[image];
+        tile.height = heights[image];
+        atlas.index[atlas.count++] = image;
+        atlas.widest = std::max(atlas.widest, tile.width);
+        atlas.tallest = std::max(atlas.tallest, tile.height);
+        x += tile.width;
+        shelfHeight = std::max(shelfHeight, tile.height);
+    }
+    atlas.width = atlasWidth;
+    atlas.height = shelfY + shelfHeight;
+
+    atlas.pixels = NULL;
+    if (atlas.count == 0)
+        return 0;
+    atlas.pixels = AcquireStaging((size_t)atlas.width * atlas.height * 4);
+    if (!atlas.pixels)
+        return 0;
+    for (int t = 0; t < atlas.count; t++) {
+        const AtlasTile &tile = atlas.tiles[t];
+        const char *src = images[atlas.index[t]];
+        for (int row = 0; row < tile.height; row++)
+            memcpy(atlas.pixels + ((size_t)(tile.y + row) * atlas.width + tile.x) * 4,
+                   src + (size_t)row * tile.width * 4,
+                   tile.width * 4);
+    }
+    return atlas.count;
+}
+
+bool EnqueueAtlasFilter(cl_context context,
+                        cl_command_queue commands,
+                        cl_kernel kernel,
+                        cl_sampler sampler,
+                        ImageAtlas &atlas)
+{
+    cl_int errNum;
+    cl_image_format format;
+    format.image_channel_order = CL_RGBA;
+    format.image_channel_data_type = CL_UNORM_INT8;
+
+    atlas.images[0] = PoolCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      &format, atlas.width, atlas.height, 0,
+                                      atlas.pixels, &errNum);
+    if (there_was_an_error(errNum))
+        return false;
+    // the result in whatever order its encoder takes
+    cl_image_format resultFormat = format;
+    resultFormat.image_channel_order = ChannelOrderFor(atlas.rgba);
+    atlas.images[1] = PoolCreateImage2D(context, CL_MEM_WRITE_ONLY, &resultFormat,
+                                      atlas.width, atlas.height, 0, NULL, &errNum);
+    if (there_was_an_error(errNum))
+        return false;
+    atlas.tileBuffer = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      sizeof(AtlasTile) * atlas.count, atlas.tiles, &errNum);
+    if (there_was_an_error(errNum))
+        return false;
+
+    if (atlas.filters) {
+        atlas.filterBuffer = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                              sizeof(AtlasTileFilter) * atlas.count,
+                                              atlas.filters, &errNum);
+        if (there_was_an_error(errNum))
+            return false;
+    }
+
+    errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &atlas.images[0]);
+    errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &atlas.images[1]);
+    errNum |= clSetKernelArg(kernel, 2, sizeof(cl_sampler), &sampler);
+    errNum |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &atlas.tileBuffer);
+    if (atlas.filters)
+        errNum |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &atlas.filterBuffer);
+    if (there_was_an_error(errNum))
+        return false;
+
+    size_t globalWorkSize[3] = { (size_t)atlas.widest, (size_t)atlas.tallest, (size_t)atlas.count };
+    errNum = clEnqueueNDRangeKernel(commands, kernel, 3, NULL, globalWorkSize,
+                                    NULL, 0, NULL, NULL);
+    if (there_was_an_error(errNum))
+        return false;
+
+    // the gaps between tiles come back as garbage, UnpackAtlas skips them
+    size_t origin[3] = { 0, 0, 0 };
+    size_t region[3] = { (size_t)atlas.width, (size_t)atlas.height, 1 };
+    errNum = clEnqueueReadImage(commands, atlas.images[1], CL_FALSE, origin, region,
+                                0, 0, atlas.pixels, 0, NULL, NULL);
+    return !there_was_an_error(errNum);
+}
+
+void UnpackAtlas(const ImageAtlas &atlas, char **images){
+    for (int t = 0; t < atlas.count; t++) {
+        const AtlasTile &tile = atlas.tiles[t];
+        char *dst = images[atlas.index[t]];
+        for (int row = 0; row < tile.height; row++)
+            memcpy(dst + (size_t)row * tile.width * 4,
+                   atlas.pixels + ((size_t)(tile.y + row) * atlas.width + tile.x) * 4,
+                   tile.width * 4);
+    }
+}
+
+bool EnqueueAtlasBatch(cl_context context,
+                       cl_device_id device,
+                       cl_command_queue commands,
+                       cl_kernel kernel,
+                       cl_sampler sampler,
+                       char **images,
+                       const int *widths,
+                       const int *heights,
+                       int count,
+                       const std::vector<bool> &rgba,
+                       const AtlasTileFilter *filters,
+                       std::vector<ImageAtlas> &atlases)
+{
+    size_t maxWidth, maxHeight;
+    clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(size_t), &maxWidth, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(size_t), &maxHeight, NULL);
+
+    // an atlas comes back in one channel order, so images for RGBA encoders
+    // are packed apart from the rest
+    for (int order = 0; order < 2; order++) {
+        std::vector<int> remaining;
+        for (int i = 0; i < count; i++)
+            if (rgba[i] == (order == 1))
+                remaining.push_back(i);
+        // images that did not fit in one atlas go round again
+        while (!remaining.empty()) {
+            ImageAtlas atlas;
+            int packed = PackAtlas(atlas, images, widths, heights, &remaining[0],
+                                   (int)remaining.size(), (int)maxWidth, (int)maxHeight);
+            atlas.rgba = order == 1;
+            if (filters && packed > 0) {
+                atlas.filters = new AtlasTileFilter[packed];
+                for (int t = 0; t < packed; t++)
+                    atlas.filters[t] = filters[atlas.index[t]];
+            }
+            atlases.push_back(atlas);
+            if (packed == 0) {
+                // tiles were placed but could not be staged, already reported
+                if (atlas.count > 0)
+                    return false;
+                std::cerr << "An image is larger than the device's image limits" << std::endl;
+                return false;
+            }
+            if (!EnqueueAtlasFilter(context, commands, kernel, sampler, atlases.back()))
+                return false;
+
+            std::vector<bool> done(count, false);
+            for (int t = 0; t < packed; t++)
+                done[atlas.index[t]] = true;
+            std::vector<int> next;
+            for (size_t i = 0; i < remaining.size(); i++)
+                if (!done[remaining[i]])
+                    next.push_back(remaining[i]);
+            remaining.swap(next);
+        }
+    }
+    return true;
+}
+
+void UnpackAtlases(std::vector<ImageAtlas> &atlases, char **images){
+    for (size_t a = 0; a < atlases.size(); a++) {
+        if (images)
+            UnpackAtlas(atlases[a], images);
+        ReleaseAtlas(atlases[a]);
+    }
+    atlases.clear();
+}
+
+void ReleaseAtlas(ImageAtlas &atlas){
+    if (atlas.images[0])
+        PoolReleaseMemObject(atlas.images[0]);
+    if (atlas.images[1])
+        PoolReleaseMemObject(atlas.images[1]);
+    if (atlas.tileBuffer)
+        PoolReleaseMemObject(atlas.tileBuffer);
+    if (atlas.filterBuffer)
+        PoolReleaseMemObject(atlas.filterBuffer);
+    ReleaseStaging(atlas.pixels);
+    delete [] atlas.tiles;
+    delete [] atlas.filters;
+    delete [] atlas.index;
+    atlas.pixels = NULL;
+    atlas.tiles = NULL;
+    atlas.filters = NULL;
+    atlas.index = NULL;
+}
+
+bool RunAtlasBatch(cl_context context,
+                   cl_device_id device,
+                   cl_command_queue commands,
+                   cl_program program,
+                   const char *listFile)
+{
+    std::ifstream list(listFile);
+    std::vector<std::string> inputs, outputs;
+    std::string line;
+    while (std::getline(list, line)) {
+        std::istringstream fields(line);
+        std::string input, output;
+        if (fields >> input >> output && input[0] != '#') {
+            inputs.push_back(input);
+            outputs.push_back(output);
+        }
+    }
+    int count = (int)inputs.size();
+    if (count == 0) {
+        std::cerr << "No \"input output\" pairs in " << listFile << std::endl;
+        return false;
+    }
+
+    std::vector<char *> pixels(count);
+    std::vector<int> widths(count), heights(count);
+    std::vector<bool> rgba(count);
+    for (int i = 0; i < count; i++) {
+        rgba[i] = SavesRGBA(outputs[i].c_str());
+        pixels[i] = LoadImageData(&inputs[i][0], widths[i], heights[i]);
+        if (!pixels[i]) {
+            for (int j = 0; j < i; j++)
+                ReleaseStaging(pixels[j]);
+            return false;
+        }
+    }
+
+    cl_int errNum;
+    cl_kernel kernel = clCreateKernel(program, "gaussian_filter_atlas", &errNum);
+    checkErr(errNum, "gaussian_filter_atlas");
+    cl_sampler sampler = clCreateSampler(context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE,
+                                         CL_FILTER_NEAREST, &errNum);
+    checkErr(errNum, "clCreateSampler");
+
+    std::vector<ImageAtlas> atlases;
+    bool ok = EnqueueAtlasBatch(context, device, commands, kernel, sampler,
+                                &pixels[0], &widths[0], &heights[0], count, rgba, NULL, atlases);
+    // even after a failure, atlases enqueued before it are still being read
+    // back into their staging memory, which UnpackAtlases gives away
+    ok = clFinish(commands) == CL_SUCCESS && ok;
+    if (ok) {
+        for (size_t a = 0; a < atlases.size(); a++)
+            std::cout << "Filtered " << atlases[a].count << " images in one "
+            << atlases[a].width << "x" << atlases[a].height << " atlas" << std::endl;
+    }
+    UnpackAtlases(atlases, ok ? &pixels[0] : NULL);
+
+    for (int i = 0; i < count; i++) {
+        if (ok && !(rgba[i] ? SaveRGBAImage : SaveImage)(&outputs[i][0], pixels[i],
+                                                         widths[i], heights[i])) {
+            std::cerr << "Failed to save " << outputs[i] << std::endl;
+            ok = false;
+        }
+        ReleaseStaging(pixels[i]);
+    }
+    clReleaseSampler(sampler);
+    clReleaseKernel(kernel);
+    return ok;
+}
@@ -0,0 +1,101 @@
+//
+//  atlas.h
+//  Simple
+//
+
+#ifndef Simple_atlas_h
+#define Simple_atlas_h
+
+#include <vector>
+#include "openCLUtilities.h"
+
+// Images up to this size are worth packing; bigger ones keep the launch
+// overhead to themselves anyway
+#define ATLAS_MAX_TILE 256
+
+// Matches the int4 the atlas kernels read
+struct AtlasTile {
+    cl_int x;
+    cl_int y;
+    cl_int width;
+    cl_int height;
+};
+
+// What colour_filter_atlas does to one tile, also an int4: a blur or not,
+// and the ColourTransforms on the way in and out
+struct AtlasTileFilter {
+    cl_int blur;
+    cl_int loadTransform;
+    cl_int storeTransform;
+    cl_int unused;
+};
+
+struct ImageAtlas {
+    int count;
+    int *index;             // image behind each tile
+    AtlasTile *tiles;
+    AtlasTileFilter *filters;   // NULL for gaussian_filter_atlas
+    int width;
+    int height;
+    int widest;
+    int tallest;
+    char *pixels;           // width * height, staging memory
+    bool rgba;              // read back in R,G,B,A order, see ChannelOrderFor
+    cl_mem images[2];
+    cl_mem tileBuffer;
+    cl_mem filterBuffer;
+};
+
+// Shelf packs as many of the candidate images as fit in maxWidth x
+// maxHeight, tallest first, and copies their pixels into the atlas. Returns
+// the number packed; atlas.index says which ones. 0 with atlas.count set
+// when there was no staging memory for the atlas.
+int PackAtlas(ImageAtlas &atlas,
+              char **images,
+              const int *widths,
+              const int *heights,
+              const int *candidates,
+              int count,
+              int maxWidth,
+              int maxHeight);
+// One upload, one launch of kernel (gaussian_filter_atlas, or with
+// atlas.filters colour_filter_atlas, whose other arguments the caller has
+// set) and a non-blocking read back into atlas.pixels; UnpackAtlas once
+// the queue has finished
+bool EnqueueAtlasFilter(cl_context context,
+                        cl_command_queue commands,
+                        cl_kernel kernel,
+                        cl_sampler sampler,
+                        ImageAtlas &atlas);
+void UnpackAtlas(const ImageAtlas &atlas, char **images);
+void ReleaseAtlas(ImageAtlas &atlas);
+
+// Packs and enqueues as many atlases as the device's image limits make it
+// take to filter all count images. Once the queue has finished,
+// UnpackAtlases copies the results over the inputs (unless images is NULL)
+// and releases the atlases. Results for images with rgba set come back in
+// R,G,B,A order, the rest in FreeImage's. filters, one per image, are for
+// colour_filter_atlas and NULL for gaussian_filter_atlas.
+bool EnqueueAtlasBatch(cl_context context,
+                       cl_device_id device,
+                       cl_command_queue commands,
+                       cl_kernel kernel,
+                       cl_sampler sampler,
+                       char **images,
+                       const int *widths,
+                       const int *heights,
+                       int count,
+                       const std::vector<bool> &rgba,
+                       const AtlasTileFilter *filters,
+                       std::vector<ImageAtlas> &atlases);
+void UnpackAtlases(std::vector<ImageAtlas> &atlases, char **images);
+
+// Blurs every "input output" pair listed in listFile, in as few atlases
+// as the device's image size limits allow
+bool RunAtlasBatch(cl_context context,
+                   cl_device_id device,
+                   cl_command_queue commands,
+                   cl_program program,
+                   const char *listFile);
+
+#endif
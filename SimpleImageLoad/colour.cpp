@@ -0,0 +1,68 @@
+//
+//  colour.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <cmath>
+#include "colour.h"
+#include "memorypool.h"
+
+bool ParseColourTransform(const char *name, ColourTransform &transform){
+    if (!strcmp(name, "none"))
+        transform = COLOUR_NONE;
+    else if (!strcmp(name, "srgb-to-linear"))
+        transform = COLOUR_SRGB_TO_LINEAR;
+    else if (!strcmp(name, "linear-to-srgb"))
+        transform = COLOUR_LINEAR_TO_SRGB;
+    else if (!strcmp(name, "rgb-to-ycbcr"))
+        transform = COLOUR_RGB_TO_YCBCR;
+    else if (!strcmp(name, "ycbcr-to-rgb"))
+        transform = COLOUR_YCBCR_TO_RGB;
+    else if (!strcmp(name, "rgb-to-gray"))
+        transform = COLOUR_RGB_TO_GRAY;
+    else
+        return false;
+    return true;
+}
+
+// lut must hold 256 entries, one per 8-bit sRGB code value
+void ComputeSrgbToLinearLUT(float *lut){
+    for (int i = 0; i < 256; i++) {
+        double v = i / 255.0;
+        lut[i] = (float)(v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4));
+    }
+}
+
+cl_mem CreateSrgbLUT(cl_context context){
+    cl_int errNum;
+    float lut[256];
+    ComputeSrgbToLinearLUT(lut);
+    cl_mem srgbLUT = PoolCreateBuffer(context,
+                                    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    sizeof(lut),
+                                    lut,
+                                    &errNum);
+    if (there_was_an_error(errNum)) {
+        printf("Error creating sRGB lookup table\n");
+        return 0;
+    }
+    return srgbLUT;
+}
+
+// colour_convert and gaussian_filter_colour share their trailing arguments:
+// the LUT, the load and store transforms and the red/blue swap flag
+cl_int SetColourKernelArgs(cl_kernel kernel, cl_uint firstArg, cl_mem srgbLUT,
+                           ColourTransform loadTransform,
+                           ColourTransform storeTransform){
+    cl_int load = loadTransform;
+    cl_int store = storeTransform;
+    // FreeImage hands us BGRA on little endian machines
+    cl_int swapRB = (FI_RGBA_RED == 2);
+    cl_int errNum;
+    errNum = clSetKernelArg(kernel, firstArg, sizeof(cl_mem), &srgbLUT);
+    errNum |= clSetKernelArg(kernel, firstArg + 1, sizeof(cl_int), &load);
+    errNum |= clSetKernelArg(kernel, firstArg + 2, sizeof(cl_int), &store);
+    errNum |= clSetKernelArg(kernel, firstArg + 3, sizeof(cl_int), &swapRB);
+    return errNum;
+}
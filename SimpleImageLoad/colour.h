@@ -0,0 +1,28 @@
+//
+//  colour.h
+//  Simple
+//
+
+#ifndef Simple_colour_h
+#define Simple_colour_h
+
+#include "openCLUtilities.h"
+
+// Keep these in step with the COLOUR_* defines in colour.cl
+enum ColourTransform {
+    COLOUR_NONE = 0,
+    COLOUR_SRGB_TO_LINEAR = 1,
+    COLOUR_LINEAR_TO_SRGB = 2,
+    COLOUR_RGB_TO_YCBCR = 3,
+    COLOUR_YCBCR_TO_RGB = 4,
+    COLOUR_RGB_TO_GRAY = 5
+};
+
+bool ParseColourTransform(const char *name, ColourTransform &transform);
+void ComputeSrgbToLinearLUT(float *lut);
+cl_mem CreateSrgbLUT(cl_context context);
+cl_int SetColourKernelArgs(cl_kernel kernel, cl_uint firstArg, cl_mem srgbLUT,
+                           ColourTransform loadTransform,
+                           ColourTransform storeTransform);
+
+#endif
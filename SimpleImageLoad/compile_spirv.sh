@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+#  compile_spirv.sh
+#  Simple
+#
+#  Compiles every .cl file in the kernel directory to SPIR-V ahead of time
+#  (name.cl -> name.spv beside it), which embed_kernels.sh then builds into
+#  the binary so devices that take IL skip the OpenCL C front end. Run by
+#  the "Compile Kernels To SPIR-V" build phase, or by hand:
+#
+#      sh compile_spirv.sh [kernel directory]
+#
+#  Needs clang with the spir64 target and llvm-spirv; without them the
+#  kernels are left as source only, which still works everywhere.
+
+here=`dirname "$0"`
+kernels=${1:-"$here/../DerivedData/SimpleImageLoad/Build/Products/Debug"}
+CLANG=${CLANG:-clang}
+LLVM_SPIRV=${LLVM_SPIRV:-llvm-spirv}
+
+if ! command -v "$CLANG" > /dev/null || ! command -v "$LLVM_SPIRV" > /dev/null; then
+    echo "compile_spirv.sh: no $CLANG / $LLVM_SPIRV, kernels stay source only" >&2
+    rm -f "$kernels"/*.spv
+    exit 0
+fi
+
+for file in "$kernels"/*.cl; do
+    name=`basename "$file" .cl`
+    bitcode="${TMPDIR:-/tmp}/$name.$$.bc"
+    # OpenCL C 1.2, which the 1.1 kernels compile as unchanged
+    if "$CLANG" -cl-std=CL1.2 -target spir64 -O2 -emit-llvm -c -I "$kernels" \
+           -o "$bitcode" "$file" &&
+       "$LLVM_SPIRV" "$bitcode" -o "$kernels/$name.spv"; then
+        :
+    else
+        echo "compile_spirv.sh: $name.cl stays source only" >&2
+        rm -f "$kernels/$name.spv"
+    fi
+    rm -f "$bitcode"
+done
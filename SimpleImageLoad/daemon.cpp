@@ -0,0 +1,576 @@
+//
+//  daemon.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "memorypool.h"
+#include "staging.h"
+#include "colour.h"
+#include "denoise.h"
+#include "atlas.h"
+#include "resultcache.h"
+
+struct FilterSpec {
+    std::string key;            // jobs with equal keys share a kernel
+    const char *kernelFile;
+    const char *kernelName;
+    bool colour;
+    bool atlas;                 // small images may share a colour_filter_atlas launch
+    ColourTransform loadTransform;
+    ColourTransform storeTransform;
+    int medianRadius;
+    int bilateralRadius;
+    float sigmaSpatial;
+    float sigmaRange;
+};
+
+struct FilterKernel {
+    cl_kernel kernel;
+    cl_mem luts[2];             // bilateral weights
+};
+
+struct FilterJob {
+    int client;                 // -1 once the client has hung up
+    std::string input;
+    std::string output;
+    FilterSpec spec;
+    double received;
+    // filled in while the batch runs
+    int width;
+    int height;
+    char *pixels;
+    cl_mem images[2];
+    cl_mem scratch;
+    bool atlased;               // filtered as part of an atlas
+    bool rgba;                  // result read back in R,G,B,A order
+    bool keyed;                 // resultKey made, the result can be cached
+    bool cached;                // copied out of the result cache
+    ResultKey resultKey;
+    std::string error;
+};
+
+struct DaemonState {
+    cl_context context;
+    cl_uint numDevices;
+    const cl_device_id *deviceIDs;
+    cl_command_queue commands;
+    cl_sampler sampler;
+    cl_mem srgbLUT;
+    cl_kernel atlasKernel;
+    std::map<std::string, cl_program> programs;
+    std::map<std::string, FilterKernel> kernels;
+};
+
+static volatile sig_atomic_t stopDaemon = 0;
+
+static void requestStop(int){
+    stopDaemon = 1;
+}
+
+static double milliseconds(){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+static bool parseFilterSpec(std::istringstream &args, FilterSpec &spec, std::string &error){
+    std::string name;
+    args >> name;
+    spec.kernelFile = "gaussian_filter.cl";
+    spec.kernelName = "gaussian_filter";
+    spec.colour = false;
+    spec.atlas = false;
+    spec.loadTransform = spec.storeTransform = COLOUR_NONE;
+    spec.medianRadius = spec.bilateralRadius = 0;
+    spec.sigmaSpatial = 2.0f;
+    spec.sigmaRange = 25.0f;
+
+    std::ostringstream key;
+    key << name;
+    if (name == "gaussian") {
+        spec.atlas = true;
+    } else if (name == "linear") {
+        spec.kernelFile = "colour.cl";
+        spec.kernelName = "gaussian_filter_colour";
+        spec.colour = true;
+        spec.atlas = true;
+        spec.loadTransform = COLOUR_SRGB_TO_LINEAR;
+        spec.storeTransform = COLOUR_LINEAR_TO_SRGB;
+    } else if (name == "convert") {
+        std::string transform;
+        args >> transform;
+        if (!ParseColourTransform(transform.c_str(), spec.loadTransform)) {
+            error = "unknown colour transform";
+            return false;
+        }
+        spec.kernelFile = "colour.cl";
+        spec.kernelName = "colour_convert";
+        spec.colour = true;
+        spec.atlas = true;
+        key << " " << transform;
+    } else if (name == "median") {
+        args >> spec.medianRadius;
+        if (spec.medianRadius < 1 || spec.medianRadius > MAX_MEDIAN_RADIUS) {
+            error = "bad median radius";
+            return false;
+        }
+        spec.kernelFile = "edge_preserving.cl";
+        spec.kernelName = MedianKernelName(spec.medianRadius);
+        key << " " << spec.medianRadius;
+    } else if (name == "bilateral") {
+        args >> spec.bilateralRadius;
+        if (spec.bilateralRadius < 1 || spec.bilateralRadius > MAX_BILATERAL_RADIUS) {
+            error = "bad bilateral radius";
+            return false;
+        }
+        std::string sigmas;
+        if (args >> sigmas &&
+            sscanf(sigmas.c_str(), "%f,%f", &spec.sigmaSpatial, &spec.sigmaRange) != 2) {
+            error = "bad bilateral sigmas";
+            return false;
+        }
+        spec.kernelFile = "edge_preserving.cl";
+        spec.kernelName = "bilateral_filter";
+        key << " " << spec.bilateralRadius << " " << spec.sigmaSpatial << "," << spec.sigmaRange;
+    } else {
+        error = "unknown filter";
+        return false;
+    }
+    spec.key = key.str();
+    return true;
+}
+
+static bool parseJob(const std::string &line, FilterJob &job, std::string &error){
+    std::istringstream args(line);
+    if (!(args >> job.input >> job.output)) {
+        error = "expected: input output filter [parameters]";
+        return false;
+    }
+    return parseFilterSpec(args, job.spec, error);
+}
+
+// Programs and kernels are built the first time a filter is asked for and
+// kept for the life of the daemon; that is the compile cost it exists to save
+static FilterKernel *getFilterKernel(DaemonState &state, const FilterSpec &spec){
+    std::map<std::string, FilterKernel>::iterator found = state.kernels.find(spec.key);
+    if (found != state.kernels.end())
+        return &found->second;
+
+    // a kernel that does not build fails its jobs, not the daemon; it is
+    // tried again for the next job that asks for it
+    cl_program &program = state.programs[spec.kernelFile];
+    if (!program)
+        program = TryBuildProgramFromFile(state.context, state.numDevices,
+                                          state.deviceIDs, spec.kernelFile);
+    if (!program)
+        return NULL;
+
+    cl_int errNum;
+    FilterKernel filter;
+    filter.luts[0] = filter.luts[1] = 0;
+    filter.kernel = clCreateKernel(program, spec.kernelName, &errNum);
+    if (there_was_an_error(errNum))
+        return NULL;
+    errNum = clSetKernelArg(filter.kernel, 2, sizeof(cl_sampler), &state.sampler);
+    if (spec.colour) {
+        if (!state.srgbLUT)
+            state.srgbLUT = CreateSrgbLUT(state.context);
+        errNum |= SetColourKernelArgs(filter.kernel, 5, state.srgbLUT,
+                                      spec.loadTransform, spec.storeTransform);
+    }
+    if (there_was_an_error(errNum) ||
+        (spec.bilateralRadius > 0 &&
+         !PrepareBilateralFilter(state.context, filter.kernel, spec.bilateralRadius,
+                                 spec.sigmaSpatial, spec.sigmaRange,
+                                 filter.luts[0], filter.luts[1]))) {
+        clReleaseKernel(filter.kernel);
+        return NULL;
+    }
+    return &(state.kernels[spec.key] = filter);
+}
+
+static bool sendReply(int client, const std::string &reply){
+    if (client < 0)
+        return false;
+    return write(client, reply.c_str(), reply.size()) == (ssize_t)reply.size();
+}
+
+static bool byFilter(const FilterJob &a, const FilterJob &b){
+    return a.spec.key < b.spec.key;
+}
+
+// Creates colour_filter_atlas, with the arguments that are the same for
+// every atlas set
+static bool getAtlasKernel(DaemonState &state){
+    if (state.atlasKernel)
+        return true;
+    cl_program &program = state.programs["colour.cl"];
+    if (!program)
+        program = TryBuildProgramFromFile(state.context, state.numDevices,
+                                          state.deviceIDs, "colour.cl");
+    if (!program)
+        return false;
+    if (!state.srgbLUT)
+        state.srgbLUT = CreateSrgbLUT(state.context);
+    cl_int errNum;
+    cl_kernel kernel = clCreateKernel(program, "colour_filter_atlas", &errNum);
+    if (there_was_an_error(errNum))
+        return false;
+    // FreeImage hands us BGRA on little endian machines, see SetColourKernelArgs
+    cl_int swapRB = (FI_RGBA_RED == 2);
+    errNum = clSetKernelArg(kernel, 2, sizeof(cl_sampler), &state.sampler);
+    errNum |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &state.srgbLUT);
+    errNum |= clSetKernelArg(kernel, 6, sizeof(cl_int), &swapRB);
+    if (there_was_an_error(errNum)) {
+        clReleaseKernel(kernel);
+        return false;
+    }
+    state.atlasKernel = kernel;
+    return true;
+}
+
+// Small gaussian, linear and convert jobs are packed into atlases, whatever
+// their filter, and filtered a whole atlas per launch; returns how many
+// jobs went that way
+static int enqueueAtlasJobs(DaemonState &state, std::vector<FilterJob> &batch,
+                            std::vector<ImageAtlas> &atlases,
+                            std::vector<char *> &atlasPixels){
+    std::vector<int> jobs, widths, heights;
+    std::vector<bool> rgba;
+    std::vector<AtlasTileFilter> filters;
+    for (size_t i = 0; i < batch.size(); i++) {
+        FilterJob &job = batch[i];
+        if (job.error.empty() && !job.cached && job.spec.atlas &&
+            job.width <= ATLAS_MAX_TILE && job.height <= ATLAS_MAX_TILE) {
+            const FilterSpec &spec = job.spec;
+            AtlasTileFilter filter = { strcmp(spec.kernelName, "colour_convert") != 0,
+                                       spec.loadTransform, spec.storeTransform, 0 };
+            filters.push_back(filter);
+            jobs.push_back((int)i);
+            rgba.push_back(SavesRGBA(job.output.c_str()));
+            atlasPixels.push_back(job.pixels);
+            widths.push_back(job.width);
+            heights.push_back(job.height);
+        }
+    }
+    // a lone image gains nothing from an atlas
+    if (jobs.size() < 2) {
+        atlasPixels.clear();
+        return 0;
+    }
+
+    if (!getAtlasKernel(state)) {
+        atlasPixels.clear();
+        return 0;
+    }
+    bool ok = EnqueueAtlasBatch(state.context, state.deviceIDs[0], state.commands,
+                                state.atlasKernel, state.sampler, &atlasPixels[0],
+                                &widths[0], &heights[0], (int)jobs.size(), rgba,
+                                &filters[0], atlases);
+    for (size_t j = 0; j < jobs.size(); j++) {
+        batch[jobs[j]].atlased = true;
+        batch[jobs[j]].rgba = rgba[j];
+        if (!ok)
+            batch[jobs[j]].error = "atlas enqueue failed";
+    }
+    return (int)jobs.size();
+}
+
+// Jobs whose result is in the result cache are answered from it. Every
+// other job in the batch is decoded and uploaded first. Small gaussian,
+// linear and convert jobs share atlas launches, whatever the mix; median and
+// bilateral jobs and bigger images are launched one by one, with launches of
+// the same kernel back to back. A single clFinish covers the lot.
+static void runBatch(DaemonState &state, std::vector<FilterJob> &batch){
+    cl_int errNum;
+    double start = milliseconds();
+    std::stable_sort(batch.begin(), batch.end(), byFilter);
+
+    cl_image_format format;
+    format.image_channel_order = CL_RGBA;
+    format.image_channel_data_type = CL_UNORM_INT8;
+    size_t origin[3] = { 0, 0, 0 };
+    int filters = 0;
+    int cachedJobs = 0;
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        FilterJob &job = batch[i];
+        job.pixels = NULL;
+        job.images[0] = job.images[1] = job.scratch = 0;
+        job.atlased = false;
+        job.rgba = false;
+        job.keyed = job.cached = false;
+        if (ResultCacheOpen()) {
+            const FilterSpec &spec = job.spec;
+            std::string filter = ResultFilterName(spec.kernelName, spec.loadTransform,
+                                                  spec.storeTransform, spec.medianRadius,
+                                                  spec.bilateralRadius, spec.sigmaSpatial,
+                                                  spec.sigmaRange);
+            job.keyed = MakeResultKey(job.input.c_str(), filter, spec.kernelFile,
+                                      job.output.c_str(), job.resultKey);
+            job.cached = job.keyed && FetchResult(job.resultKey, job.output.c_str());
+        }
+        if (job.cached) {
+            cachedJobs++;
+            continue;
+        }
+        if (i == 0 || batch[i - 1].spec.key != job.spec.key)
+            filters++;
+        if (!getFilterKernel(state, job.spec))
+            job.error = "kernel setup failed";
+        else if (!(job.pixels = LoadImageData(&job.input[0], job.width, job.height)))
+            job.error = "cannot load input";
+    }
+
+    std::vector<ImageAtlas> atlases;
+    std::vector<char *> atlasPixels;
+    int atlasedJobs = enqueueAtlasJobs(state, batch, atlases, atlasPixels);
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        FilterJob &job = batch[i];
+        if (!job.error.empty() || job.atlased || job.cached)
+            continue;
+        FilterKernel *filter = getFilterKernel(state, job.spec);
+        job.images[0] = PoolCreateImage2D(state.context,
+                                        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        &format, job.width, job.height, 0,
+                                        job.pixels, &errNum);
+        // the result goes out in whatever order its encoder takes
+        job.rgba = SavesRGBA(job.output.c_str());
+        cl_image_format resultFormat = format;
+        resultFormat.image_channel_order = ChannelOrderFor(job.rgba);
+        if (!there_was_an_error(errNum))
+            job.images[1] = PoolCreateImage2D(state.context, CL_MEM_WRITE_ONLY,
+                                            &resultFormat, job.width, job.height, 0,
+                                            NULL, &errNum);
+        if (there_was_an_error(errNum)) {
+            job.error = "image allocation failed";
+            continue;
+        }
+
+        size_t globalWorkSize[2];
+        errNum = clSetKernelArg(filter->kernel, 0, sizeof(cl_mem), &job.images[0]);
+        errNum |= clSetKernelArg(filter->kernel, 1, sizeof(cl_mem), &job.images[1]);
+        errNum |= clSetKernelArg(filter->kernel, 3, sizeof(cl_int), &job.width);
+        errNum |= clSetKernelArg(filter->kernel, 4, sizeof(cl_int), &job.height);
+        globalWorkSize[0] = job.width;
+        globalWorkSize[1] = job.height;
+        if (there_was_an_error(errNum) ||
+            (job.spec.medianRadius > 0 &&
+             !PrepareMedianFilter(state.context, state.deviceIDs[0], filter->kernel,
+                                  job.spec.medianRadius, job.width, job.height,
+                                  job.scratch, globalWorkSize))) {
+            job.error = "kernel arguments rejected";
+            continue;
+        }
+
+        // the pixels were copied at image creation, so the same host buffer
+        // takes the result
+        size_t region[3] = { (size_t)job.width, (size_t)job.height, 1 };
+        errNum = clEnqueueNDRangeKernel(state.commands, filter->kernel, 2, NULL,
+                                        globalWorkSize, NULL, 0, NULL, NULL);
+        errNum |= clEnqueueReadImage(state.commands, job.images[1], CL_FALSE,
+                                     origin, region, 0, 0, job.pixels, 0, NULL, NULL);
+        if (there_was_an_error(errNum))
+            job.error = "enqueue failed";
+    }
+    clFlush(state.commands);
+    errNum = clFinish(state.commands);
+    double deviceDone = milliseconds();
+    UnpackAtlases(atlases, errNum == CL_SUCCESS && atlasedJobs > 0 ? &atlasPixels[0] : NULL);
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        FilterJob &job = batch[i];
+        if (job.error.empty() && there_was_an_error(errNum))
+            job.error = "device error";
+        if (job.error.empty() && !job.cached) {
+            if (!(job.rgba ? SaveRGBAImage : SaveImage)(&job.output[0], job.pixels,
+                                                        job.width, job.height))
+                job.error = "cannot save output";
+            else if (job.keyed)
+                StoreResult(job.resultKey, job.output.c_str());
+        }
+
+        std::ostringstream reply;
+        if (job.error.empty())
+            reply << "OK " << job.output << " " << milliseconds() - job.received
+            << " " << batch.size() << "\n";
+        else
+            reply << "ERROR " << job.output << " " << job.error << "\n";
+        sendReply(job.client, reply.str());
+
+        ReleaseStaging(job.pixels);
+        if (job.images[0])
+            PoolReleaseMemObject(job.images[0]);
+        if (job.images[1])
+            PoolReleaseMemObject(job.images[1]);
+        if (job.scratch)
+            PoolReleaseMemObject(job.scratch);
+    }
+    std::cout << "Batch of " << batch.size() << " jobs over " << filters
+    << " filters (" << atlasedJobs << " in atlases, " << cachedJobs << " from the result cache): " << deviceDone - start << " ms on the device, "
+    << milliseconds() - start << " ms in total" << std::endl;
+}
+
+static int listenOn(const char *socketPath){
+    struct sockaddr_un address;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << std::endl;
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return -1;
+    unlink(socketPath);
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        perror(socketPath);
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+bool RunDaemon(cl_context context,
+               cl_uint numDevices,
+               const cl_device_id *deviceIDs,
+               cl_command_queue commands,
+               const char *socketPath)
+{
+    cl_int errNum;
+    DaemonState state;
+    state.context = context;
+    state.numDevices = numDevices;
+    state.deviceIDs = deviceIDs;
+    state.commands = commands;
+    state.srgbLUT = 0;
+    state.atlasKernel = 0;
+    state.sampler = clCreateSampler(context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE,
+                                    CL_FILTER_NEAREST, &errNum);
+    if (there_was_an_error(errNum))
+        return false;
+
+    int listener = listenOn(socketPath);
+    if (listener < 0)
+        return false;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    std::cout << "Listening on " << socketPath << std::endl;
+
+    std::vector<struct pollfd> fds;
+    std::map<int, std::string> partialLines;
+    std::vector<FilterJob> queued;
+    struct pollfd listenFd = { listener, POLLIN, 0 };
+    fds.push_back(listenFd);
+
+    while (!stopDaemon) {
+        // sleep until the oldest queued job's batch window closes
+        int timeout = -1;
+        if (!queued.empty()) {
+            double wait = DAEMON_BATCH_WINDOW_MS - (milliseconds() - queued[0].received);
+            timeout = wait > 0 ? (int)wait + 1 : 0;
+        }
+        if (poll(&fds[0], fds.size(), timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client = accept(listener, NULL, NULL);
+            if (client >= 0) {
+                struct pollfd clientFd = { client, POLLIN, 0 };
+                fds.push_back(clientFd);
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            int client = fds[i].fd;
+            char chunk[4096];
+            ssize_t got = read(client, chunk, sizeof(chunk));
+            if (got <= 0) {
+                // its queued jobs still run, their replies are dropped
+                for (size_t j = 0; j < queued.size(); j++)
+                    if (queued[j].client == client)
+                        queued[j].client = -1;
+                partialLines.erase(client);
+                close(client);
+                fds.erase(fds.begin() + i--);
+                continue;
+            }
+            std::string &pending = partialLines[client];
+            pending.append(chunk, got);
+            size_t newline;
+            while ((newline = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, newline);
+                pending.erase(0, newline + 1);
+                if (line.empty())
+                    continue;
+                if (line == "shutdown") {
+                    stopDaemon = 1;
+                    continue;
+                }
+                FilterJob job;
+                std::string error;
+                job.client = client;
+                job.received = milliseconds();
+                if (parseJob(line, job, error))
+                    queued.push_back(job);
+                else
+                    sendReply(client, "ERROR " + (job.output.empty() ? "-" : job.output)
+                              + " " + error + "\n");
+            }
+        }
+
+        if (!queued.empty() &&
+            (queued.size() >= DAEMON_MAX_BATCH ||
+             milliseconds() - queued[0].received >= DAEMON_BATCH_WINDOW_MS)) {
+            runBatch(state, queued);
+            queued.clear();
+        }
+    }
+
+    if (!queued.empty())
+        runBatch(state, queued);
+    for (size_t i = 0; i < fds.size(); i++)
+        close(fds[i].fd);
+    unlink(socketPath);
+
+    for (std::map<std::string, FilterKernel>::iterator k = state.kernels.begin();
+         k != state.kernels.end(); ++k) {
+        clReleaseKernel(k->second.kernel);
+        if (k->second.luts[0])
+            PoolReleaseMemObject(k->second.luts[0]);
+        if (k->second.luts[1])
+            PoolReleaseMemObject(k->second.luts[1]);
+    }
+    for (std::map<std::string, cl_program>::iterator p = state.programs.begin();
+         p != state.programs.end(); ++p)
+        if (p->second)
+            clReleaseProgram(p->second);
+    if (state.atlasKernel)
+        clReleaseKernel(state.atlasKernel);
+    if (state.srgbLUT)
+        PoolReleaseMemObject(state.srgbLUT);
+    clReleaseSampler(state.sampler);
+    std::cout << "Daemon stopped" << std::endl;
+    return true;
+}
@@ -0,0 +1,48 @@
+//
+//  daemon.h
+//  Simple
+//
+
+#ifndef Simple_daemon_h
+#define Simple_daemon_h
+
+#include "openCLUtilities.h"
+
+// Jobs arriving within this long of the oldest queued one share a batch
+#define DAEMON_BATCH_WINDOW_MS 2
+#define DAEMON_MAX_BATCH 64
+
+// Serves filter jobs on a Unix domain socket until sent "shutdown" (or
+// SIGINT/SIGTERM). One job per line:
+//
+//   <input> <output> gaussian
+//   <input> <output> linear
+//   <input> <output> convert <colour transform>
+//   <input> <output> median <radius>
+//   <input> <output> bilateral <radius> [<sigma spatial>,<sigma range>]
+//
+// and one reply line per job, in completion order:
+//
+//   OK <output> <latency ms> <batch size>
+//   ERROR <output> <reason>
+//
+// Jobs of up to ATLAS_MAX_TILE pixels a side that use gaussian, linear or
+// convert are packed into atlases, one launch per atlas for the lot;
+// median and bilateral jobs take a launch each.
+//
+// With a result cache open (OpenResultCache) jobs whose result it holds are
+// answered from it, and every other result is added to it.
+bool RunDaemon(cl_context context,
+               cl_uint numDevices,
+               const cl_device_id *deviceIDs,
+               cl_command_queue commands,
+               const char *socketPath);
+
+// Replays the job lines in jobFile against a running daemon from the given
+// number of concurrent connections and reports throughput and latency
+bool RunLoadTest(const char *socketPath,
+                 const char *jobFile,
+                 int clients,
+                 int jobsPerClient);
+
+#endif
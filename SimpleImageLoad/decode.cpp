@@ -0,0 +1,381 @@
+//
+//  decode.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <map>
+#include <vector>
+#include "decode.h"
+#include "memorypool.h"
+#include "staging.h"
+// FreeImage.h's save flag of the same name, libpng brings its own
+#undef PNG_Z_DEFAULT_COMPRESSION
+#include <png.h>
+#include <jpeglib.h>
+
+enum DecodeResult {DECODE_OK, DECODE_UNSUPPORTED, DECODE_ERROR};
+
+// Decoded rows land in one block bottom-up like FreeImage's bits, so a
+// stripe of file rows is one contiguous write at the bottom of what is
+// left. 32-bit rows are written to the image itself; 24-bit and grey rows
+// go up packed into a buffer that unpack.cl expands once they are all in.
+struct StripeUpload {
+    cl_context context;
+    cl_command_queue commands;
+    cl_mem image;
+    cl_mem packed;          // the 1 or 3 byte rows, NULL for 4
+    char *pixels;
+    bool staged;            // pixels is staging memory rather than the caller's
+    bool rgbOrder;          // rows are R,G,B(,A) as the codecs give, not FreeImage's order
+    int width;
+    int height;
+    int channels;
+    int pitch;
+    int stripeRows;
+    int flushed;            // file rows already queued
+    cl_event lastWrite;     // in order queue, so waiting on it waits on all
+    int minWidth;           // JPEGs are decoded no smaller than this
+    int minHeight;
+};
+
+static std::map<cl_context, cl_kernel> unpackKernels;
+static std::map<cl_context, ProgramBuild *> unpackBuilds;
+
+// Starts building unpack.cl when a packed upload begins, so it builds
+// while the image decodes
+static void beginUnpackBuild(cl_context context){
+    if (unpackKernels[context] || unpackBuilds[context])
+        return;
+    size_t size;
+    clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &size);
+    std::vector<cl_device_id> devices(size / sizeof(cl_device_id));
+    clGetContextInfo(context, CL_CONTEXT_DEVICES, size, &devices[0], NULL);
+    unpackBuilds[context] = BeginProgramBuild(context, devices.size(), &devices[0],
+                                              "unpack.cl");
+}
+
+static cl_kernel unpackKernel(cl_context context){
+    cl_kernel &kernel = unpackKernels[context];
+    if (!kernel) {
+        beginUnpackBuild(context);
+        cl_program program = FinishProgramBuild(unpackBuilds[context]);
+        unpackBuilds.erase(context);
+        cl_int errNum;
+        kernel = clCreateKernel(program, "unpack_pixels", &errNum);
+        checkErr(errNum, "unpack_pixels");
+        // the kernel keeps it alive
+        clReleaseProgram(program);
+    }
+    return kernel;
+}
+
+void ReleaseDecodeKernels(){
+    for (std::map<cl_context, cl_kernel>::iterator kernel = unpackKernels.begin();
+         kernel != unpackKernels.end(); ++kernel)
+        clReleaseKernel(kernel->second);
+    unpackKernels.clear();
+    for (std::map<cl_context, ProgramBuild *>::iterator build = unpackBuilds.begin();
+         build != unpackBuilds.end(); ++build)
+        clReleaseProgram(FinishProgramBuild(build->second));
+    unpackBuilds.clear();
+}
+
+// pixels is the caller's rows pitch bytes apart, or NULL for a staging
+// block of tightly packed ones
+static bool beginUpload(StripeUpload &upload, int width, int height, int channels,
+                        char *pixels, int pitch){
+    upload.width = width;
+    upload.height = height;
+    upload.channels = channels;
+    upload.staged = pixels == NULL;
+    upload.pitch = pixels ? pitch : width * channels;
+    upload.stripeRows = std::max(1, DECODE_STRIPE_BYTES / upload.pitch);
+    upload.pixels = pixels ? pixels : AcquireStaging((size_t)upload.pitch * height);
+    if (!upload.pixels)
+        return false;
+
+    cl_image_format format;
+    format.image_channel_order = channels == 4 ? ChannelOrderFor(upload.rgbOrder) : CL_RGBA;
+    format.image_channel_data_type = CL_UNORM_INT8;
+    cl_int errNum;
+    upload.image = PoolCreateImage2D(upload.context,
+                                     channels == 4 ? CL_MEM_READ_ONLY : CL_MEM_READ_WRITE,
+                                     &format, width, height, 0, NULL, &errNum);
+    if (errNum == CL_SUCCESS && channels != 4) {
+        upload.packed = PoolCreateBuffer(upload.context, CL_MEM_READ_ONLY,
+                                         (size_t)upload.pitch * height, NULL, &errNum);
+        beginUnpackBuild(upload.context);
+    }
+    if (errNum != CL_SUCCESS) {
+        printf("Error creating CL image object\n");
+        return false;
+    }
+    return true;
+}
+
+static unsigned char *fileRow(StripeUpload &upload, int row){
+    return (unsigned char *)upload.pixels + (size_t)(upload.height - 1 - row) * upload.pitch;
+}
+
+// Queues every whole stripe among the first rows file rows, and the last
+// partial one once the image is complete
+static bool rowsDecoded(StripeUpload &upload, int rows){
+    while (upload.flushed < rows &&
+           (rows - upload.flushed >= upload.stripeRows || rows == upload.height)) {
+        int first = upload.flushed;
+        int last = std::min(rows, first + upload.stripeRows);
+        cl_event write;
+        cl_int errNum;
+        if (upload.packed) {
+            errNum = clEnqueueWriteBuffer(upload.commands, upload.packed, CL_FALSE,
+                                          (size_t)(upload.height - last) * upload.pitch,
+                                          (size_t)(last - first) * upload.pitch,
+                                          fileRow(upload, last - 1), 0, NULL, &write);
+        } else {
+            size_t origin[3] = { 0, (size_t)(upload.height - last), 0 };
+            size_t region[3] = { (size_t)upload.width, (size_t)(last - first), 1 };
+            errNum = clEnqueueWriteImage(upload.commands, upload.image, CL_FALSE,
+                                         origin, region, (size_t)upload.pitch, 0,
+                                         fileRow(upload, last - 1), 0, NULL, &write);
+        }
+        if (there_was_an_error(errNum))
+            return false;
+        if (upload.lastWrite)
+            clReleaseEvent(upload.lastWrite);
+        upload.lastWrite = write;
+        upload.flushed = last;
+    }
+    return true;
+}
+
+static bool unpack(StripeUpload &upload){
+    cl_kernel kernel = unpackKernel(upload.context);
+    cl_int swapRB = upload.rgbOrder && FI_RGBA_RED == 2;
+    cl_int errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &upload.packed);
+    errNum |= clSetKernelArg(kernel, 1, sizeof(cl_int), &upload.pitch);
+    errNum |= clSetKernelArg(kernel, 2, sizeof(cl_int), &upload.channels);
+    errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &swapRB);
+    errNum |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &upload.image);
+    errNum |= clSetKernelArg(kernel, 5, sizeof(cl_int), &upload.width);
+    errNum |= clSetKernelArg(kernel, 6, sizeof(cl_int), &upload.height);
+    if (there_was_an_error(errNum))
+        return false;
+    size_t workSize[2] = { (size_t)upload.width, (size_t)upload.height };
+    cl_event expanded;
+    errNum = clEnqueueNDRangeKernel(upload.commands, kernel, 2, NULL, workSize, NULL,
+                                    0, NULL, &expanded);
+    if (there_was_an_error(errNum))
+        return false;
+    clReleaseEvent(upload.lastWrite);
+    upload.lastWrite = expanded;
+    return true;
+}
+
+// The rows and the packed buffer have to outlive everything reading them
+static bool endUpload(StripeUpload &upload, bool ok){
+    if (ok && upload.packed)
+        ok = unpack(upload);
+    if (upload.lastWrite) {
+        clWaitForEvents(1, &upload.lastWrite);
+        clReleaseEvent(upload.lastWrite);
+        upload.lastWrite = NULL;
+    }
+    if (upload.staged)
+        ReleaseStaging(upload.pixels);
+    upload.pixels = NULL;
+    if (upload.packed) {
+        PoolReleaseMemObject(upload.packed);
+        upload.packed = NULL;
+    }
+    if (!ok && upload.image) {
+        PoolReleaseMemObject(upload.image);
+        upload.image = NULL;
+    }
+    return ok;
+}
+
+static void pngError(png_structp png, png_const_charp message){
+    std::cout << "PNG decode error: " << message << std::endl;
+    longjmp(png_jmpbuf(png), 1);
+}
+
+static DecodeResult decodePng(FILE *file, StripeUpload &upload){
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, pngError, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    if (!info) {
+        png_destroy_read_struct(&png, NULL, NULL);
+        return DECODE_ERROR;
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, NULL);
+        return DECODE_ERROR;
+    }
+    png_init_io(png, file);
+    png_read_info(png, info);
+    // all seven passes are needed before any row is final
+    if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+        png_destroy_read_struct(&png, &info, NULL);
+        return DECODE_UNSUPPORTED;
+    }
+
+    // the same 8-bit samples FreeImage_ConvertTo32Bits would give, in RGB
+    // order; without alpha they go up as 24 bits
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_gray_to_rgb(png);
+    png_read_update_info(png, info);
+
+    int width = png_get_image_width(png, info);
+    int height = png_get_image_height(png, info);
+    if (!beginUpload(upload, width, height, png_get_channels(png, info), NULL, 0)) {
+        png_destroy_read_struct(&png, &info, NULL);
+        return DECODE_ERROR;
+    }
+    for (int y = 0; y < height; y++) {
+        png_read_row(png, fileRow(upload, y), NULL);
+        if (!rowsDecoded(upload, y + 1))
+            png_error(png, "stripe upload failed");
+    }
+    png_destroy_read_struct(&png, &info, NULL);
+    return DECODE_OK;
+}
+
+struct JpegError {
+    jpeg_error_mgr manager;
+    jmp_buf jump;
+};
+
+static void jpegError(j_common_ptr cinfo){
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    std::cout << "JPEG decode error: " << message << std::endl;
+    longjmp(((JpegError *)cinfo->err)->jump, 1);
+}
+
+// Skipping the high frequency coefficients is the cheapest downscale there
+// is; the device resamples the rest of the way
+static void chooseJpegScale(jpeg_decompress_struct &cinfo, int minWidth, int minHeight){
+    int fullWidth = cinfo.image_width;
+    int fullHeight = cinfo.image_height;
+    cinfo.scale_num = 1;
+    for (int denom = 8; denom > 1; denom /= 2) {
+        cinfo.scale_denom = denom;
+        jpeg_calc_output_dimensions(&cinfo);
+        if ((int)cinfo.output_width >= minWidth && (int)cinfo.output_height >= minHeight) {
+            std::cout << "Decoding " << fullWidth << "x" << fullHeight << " JPEG at 1/"
+            << denom << " scale (" << cinfo.output_width << "x" << cinfo.output_height
+            << ")" << std::endl;
+            return;
+        }
+    }
+    cinfo.scale_denom = 1;
+}
+
+static DecodeResult decodeJpeg(FILE *file, StripeUpload &upload){
+    jpeg_decompress_struct cinfo;
+    JpegError error;
+    cinfo.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = jpegError;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return DECODE_ERROR;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&cinfo);
+        return DECODE_UNSUPPORTED;
+    }
+    cinfo.out_color_space = cinfo.jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+    if (upload.minWidth > 0 && upload.minHeight > 0)
+        chooseJpegScale(cinfo, upload.minWidth, upload.minHeight);
+    jpeg_start_decompress(&cinfo);
+
+    // grey or RGB samples go up as they are, unpack.cl adds the rest
+    if (!beginUpload(upload, cinfo.output_width, cinfo.output_height,
+                     cinfo.output_components, NULL, 0)) {
+        jpeg_destroy_decompress(&cinfo);
+        return DECODE_ERROR;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        int y = cinfo.output_scanline;
+        JSAMPROW row = fileRow(upload, y);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+        if (!rowsDecoded(upload, y + 1)) {
+            jpeg_destroy_decompress(&cinfo);
+            return DECODE_ERROR;
+        }
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return DECODE_OK;
+}
+
+// Everything the row decoders do not take. 24-bit and grey bitmaps are
+// uploaded straight from FreeImage's scanlines, padding and all, and only
+// other depths pay for FreeImage_ConvertTo32Bits.
+static bool decodeFreeImage(FREE_IMAGE_FORMAT format, char *fileName, StripeUpload &upload){
+    FIBITMAP *image = FreeImage_Load(format, fileName);
+    if (!image)
+        return false;
+    int channels = 4;
+    if (FreeImage_GetImageType(image) == FIT_BITMAP && FreeImage_GetBPP(image) == 24)
+        channels = 3;
+    else if (FreeImage_GetBPP(image) == 8 && FreeImage_GetColorType(image) == FIC_MINISBLACK)
+        channels = 1;
+    else {
+        FIBITMAP *temp = image;
+        image = FreeImage_ConvertTo32Bits(image);
+        FreeImage_Unload(temp);
+        if (!image)
+            return false;
+    }
+    int height = FreeImage_GetHeight(image);
+    upload.rgbOrder = false;
+    bool ok = beginUpload(upload, FreeImage_GetWidth(image), height, channels,
+                          (char *)FreeImage_GetBits(image), FreeImage_GetPitch(image)) &&
+              rowsDecoded(upload, height);
+    ok = endUpload(upload, ok);
+    FreeImage_Unload(image);
+    return ok;
+}
+
+cl_mem LoadImageStreamed(cl_context context,
+                         cl_command_queue commands,
+                         char *fileName,
+                         int minWidth,
+                         int minHeight,
+                         int &width,
+                         int &height)
+{
+    StripeUpload upload = { context, commands, NULL, NULL, NULL, false, true, 0, 0, 0, 0,
+                            0, 0, NULL, minWidth, minHeight };
+    FREE_IMAGE_FORMAT format = FreeImage_GetFileType(fileName, 0);
+    DecodeResult result = DECODE_UNSUPPORTED;
+    if (format == FIF_PNG || format == FIF_JPEG) {
+        FILE *file = fopen(fileName, "rb");
+        if (!file) {
+            printf("Error loading image %s\n", fileName);
+            return 0;
+        }
+        result = format == FIF_PNG ? decodePng(file, upload) : decodeJpeg(file, upload);
+        fclose(file);
+        if (!endUpload(upload, result == DECODE_OK) && result == DECODE_OK)
+            result = DECODE_ERROR;
+    }
+    if (result == DECODE_UNSUPPORTED) {
+        result = decodeFreeImage(format, fileName, upload) ? DECODE_OK : DECODE_ERROR;
+    }
+    if (result == DECODE_ERROR) {
+        printf("Error loading image %s\n", fileName);
+        return 0;
+    }
+    width = upload.width;
+    height = upload.height;
+    return upload.image;
+}
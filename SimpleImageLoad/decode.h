@@ -0,0 +1,39 @@
+//
+//  decode.h
+//  Simple
+//
+
+#ifndef Simple_decode_h
+#define Simple_decode_h
+
+#include "openCLUtilities.h"
+
+// Rows handed to the device at a time, roughly
+#define DECODE_STRIPE_BYTES (1024 * 1024)
+
+// LoadImage for a caller with a queue. PNG and JPEG files are decoded a
+// row at a time with libpng / libjpeg, laid out bottom-up as FreeImage's
+// rows are, and each finished stripe of rows is queued for upload while
+// the rest of the file is still being decoded. Everything else,
+// interlaced PNGs and CMYK JPEGs included, is loaded by FreeImage.
+//
+// 24-bit and grey pixels are uploaded packed, FreeImage's row padding and
+// all, and expanded to 32 bits on the device (unpack.cl) rather than by a
+// host conversion pass; only 32-bit sources are written to the image as is.
+//
+// A caller that only needs minWidth x minHeight (0 x 0 for full size) can
+// get a JPEG decoded at 1/2, 1/4 or 1/8 scale in the DCT domain, the
+// smallest that still covers that size; width and height are what was
+// actually decoded.
+cl_mem LoadImageStreamed(cl_context context,
+                         cl_command_queue commands,
+                         char *fileName,
+                         int minWidth,
+                         int minHeight,
+                         int &width,
+                         int &height);
+
+// The unpack kernels LoadImageStreamed builds for each context it sees
+void ReleaseDecodeKernels();
+
+#endif
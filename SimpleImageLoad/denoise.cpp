@@ -0,0 +1,115 @@
+//
+//  denoise.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <cmath>
+#include "denoise.h"
+#include "memorypool.h"
+
+#define CTMF_HISTOGRAM_BYTES (4 * 256 * sizeof(cl_ushort))
+
+// Small windows use sorting networks, anything bigger the histogram method
+const char *MedianKernelName(int radius){
+    if (radius == 1)
+        return "median_3x3";
+    if (radius == 2)
+        return "median_5x5";
+    return "median_ctmf";
+}
+
+// Sets the median specific kernel arguments (if any) and the launch size.
+// For median_ctmf each work item covers a strip by band tile; strips are
+// kept wide relative to the radius so the shared column histograms are
+// amortised, and bands are only as tall as the scratch budget forces.
+bool PrepareMedianFilter(cl_context context,
+                         cl_device_id device,
+                         cl_kernel kernel,
+                         int radius,
+                         int width, int height,
+                         cl_mem &scratch,
+                         size_t *globalWorkSize)
+{
+    scratch = 0;
+    globalWorkSize[0] = width;
+    globalWorkSize[1] = height;
+    if (radius <= 2)
+        return true;
+    
+    cl_int stripWidth = 4 * radius < 32 ? 32 : 4 * radius;
+    size_t strips = (width + stripWidth - 1) / stripWidth;
+    size_t itemBytes = (stripWidth + 2 * radius + 1) * CTMF_HISTOGRAM_BYTES;
+    
+    cl_ulong maxAlloc;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                    sizeof(cl_ulong), &maxAlloc, NULL);
+    size_t budget = maxAlloc < CTMF_SCRATCH_LIMIT ? (size_t)maxAlloc : CTMF_SCRATCH_LIMIT;
+    size_t bands = budget / (strips * itemBytes);
+    if (bands < 1) {
+        std::cout << "Median radius " << radius << " needs more scratch than the device allows" << std::endl;
+        return false;
+    }
+    if (bands > (size_t)height)
+        bands = height;
+    cl_int bandHeight = (cl_int)((height + bands - 1) / bands);
+    bands = (height + bandHeight - 1) / bandHeight;
+    
+    cl_int errNum;
+    scratch = PoolCreateBuffer(context, CL_MEM_READ_WRITE,
+                             strips * bands * itemBytes, NULL, &errNum);
+    if (there_was_an_error(errNum)) {
+        std::cout << "Median scratch creation error!" << std::endl;
+        return false;
+    }
+    
+    errNum = clSetKernelArg(kernel, 5, sizeof(cl_int), &radius);
+    errNum |= clSetKernelArg(kernel, 6, sizeof(cl_int), &stripWidth);
+    errNum |= clSetKernelArg(kernel, 7, sizeof(cl_int), &bandHeight);
+    errNum |= clSetKernelArg(kernel, 8, sizeof(cl_mem), &scratch);
+    if (there_was_an_error(errNum))
+        return false;
+    
+    globalWorkSize[0] = strips;
+    globalWorkSize[1] = bands;
+    std::cout << "Constant time median: " << strips << " strips of " << stripWidth
+    << " by " << bands << " bands of " << bandHeight << std::endl;
+    return true;
+}
+
+bool PrepareBilateralFilter(cl_context context,
+                            cl_kernel kernel,
+                            int radius,
+                            float sigmaSpatial,
+                            float sigmaRange,
+                            cl_mem &spatialLUT,
+                            cl_mem &rangeLUT)
+{
+    cl_int errNum;
+    int diameter = 2 * radius + 1;
+    float *spatial = new float[diameter * diameter];
+    for (int j = -radius; j <= radius; j++)
+        for (int i = -radius; i <= radius; i++)
+            spatial[(j + radius) * diameter + (i + radius)] =
+                (float)exp(-(i * i + j * j) / (2.0 * sigmaSpatial * sigmaSpatial));
+    
+    // sigmaRange is in 8-bit code values
+    float range[256];
+    for (int d = 0; d < 256; d++)
+        range[d] = (float)exp(-(d * d) / (2.0 * sigmaRange * sigmaRange));
+    
+    spatialLUT = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                sizeof(float) * diameter * diameter, spatial, &errNum);
+    delete [] spatial;
+    if (there_was_an_error(errNum))
+        return false;
+    rangeLUT = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                              sizeof(range), range, &errNum);
+    if (there_was_an_error(errNum))
+        return false;
+    
+    errNum = clSetKernelArg(kernel, 5, sizeof(cl_int), &radius);
+    errNum |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &spatialLUT);
+    errNum |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &rangeLUT);
+    return !there_was_an_error(errNum);
+}
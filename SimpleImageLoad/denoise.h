@@ -0,0 +1,34 @@
+//
+//  denoise.h
+//  Simple
+//
+
+#ifndef Simple_denoise_h
+#define Simple_denoise_h
+
+#include "openCLUtilities.h"
+
+// Histogram counts in the constant time median are 16 bit
+#define MAX_MEDIAN_RADIUS 127
+// The spatial weights have to fit in __constant memory
+#define MAX_BILATERAL_RADIUS 63
+// Upper bound on the constant time median's per strip histograms
+#define CTMF_SCRATCH_LIMIT (256 * 1024 * 1024)
+
+const char *MedianKernelName(int radius);
+bool PrepareMedianFilter(cl_context context,
+                         cl_device_id device,
+                         cl_kernel kernel,
+                         int radius,
+                         int width, int height,
+                         cl_mem &scratch,
+                         size_t *globalWorkSize);
+bool PrepareBilateralFilter(cl_context context,
+                            cl_kernel kernel,
+                            int radius,
+                            float sigmaSpatial,
+                            float sigmaRange,
+                            cl_mem &spatialLUT,
+                            cl_mem &rangeLUT);
+
+#endif
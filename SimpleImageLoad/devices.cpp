@@ -0,0 +1,281 @@
+//
+//  devices.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include "devices.h"
+
+static std::vector<DeviceCapabilities> capabilities;
+static bool queried = false;
+
+static double milliseconds(){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+static std::string platformString(cl_platform_id platform, cl_platform_info name){
+    size_t size = 0;
+    if (clGetPlatformInfo(platform, name, 0, NULL, &size) != CL_SUCCESS || size == 0)
+        return "";
+    std::vector<char> value(size);
+    clGetPlatformInfo(platform, name, size, &value[0], NULL);
+    return std::string(&value[0]);
+}
+
+static std::string deviceString(cl_device_id device, cl_device_info name){
+    size_t size = 0;
+    if (clGetDeviceInfo(device, name, 0, NULL, &size) != CL_SUCCESS || size == 0)
+        return "";
+    std::vector<char> value(size);
+    clGetDeviceInfo(device, name, size, &value[0], NULL);
+    return std::string(&value[0]);
+}
+
+template <typename T>
+static T deviceValue(cl_device_id device, cl_device_info name){
+    T value = 0;
+    clGetDeviceInfo(device, name, sizeof(value), &value, NULL);
+    return value;
+}
+
+static cl_context deviceContext(const DeviceCapabilities &caps){
+    cl_context_properties properties[] = {
+        CL_CONTEXT_PLATFORM, (cl_context_properties)caps.platform, 0
+    };
+    return clCreateContext(properties, 1, &caps.device, NULL, NULL, NULL);
+}
+
+// Supported formats belong to a context, so each device gets a throwaway one
+static void queryImageFormats(DeviceCapabilities &caps){
+    caps.rgbaImages = caps.bgraImages = false;
+    if (!caps.imageSupport)
+        return;
+    cl_context context = deviceContext(caps);
+    if (!context)
+        return;
+    cl_uint count = 0;
+    clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D,
+                               0, NULL, &count);
+    std::vector<cl_image_format> formats(count);
+    if (count)
+        clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D,
+                                   count, &formats[0], NULL);
+    for (cl_uint i = 0; i < count; i++) {
+        if (formats[i].image_channel_data_type != CL_UNORM_INT8)
+            continue;
+        if (formats[i].image_channel_order == CL_RGBA)
+            caps.rgbaImages = true;
+        if (formats[i].image_channel_order == CL_BGRA)
+            caps.bgraImages = true;
+    }
+    clReleaseContext(context);
+}
+
+const std::vector<DeviceCapabilities> &GetDeviceCapabilities(){
+    if (queried)
+        return capabilities;
+    queried = true;
+    cl_uint numPlatforms = 0;
+    if (clGetPlatformIDs(0, NULL, &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
+        return capabilities;
+    std::vector<cl_platform_id> platforms(numPlatforms);
+    clGetPlatformIDs(numPlatforms, &platforms[0], NULL);
+    for (cl_uint p = 0; p < numPlatforms; p++) {
+        cl_uint numDevices = 0;
+        if (clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices) != CL_SUCCESS ||
+            numDevices == 0)
+            continue;
+        std::vector<cl_device_id> devices(numDevices);
+        clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, numDevices, &devices[0], NULL);
+        for (cl_uint d = 0; d < numDevices; d++) {
+            DeviceCapabilities caps;
+            caps.platform = platforms[p];
+            caps.device = devices[d];
+            caps.platformIndex = p;
+            caps.deviceIndex = d;
+            caps.platformName = platformString(platforms[p], CL_PLATFORM_NAME);
+            caps.name = deviceString(devices[d], CL_DEVICE_NAME);
+            caps.type = deviceValue<cl_device_type>(devices[d], CL_DEVICE_TYPE);
+            caps.computeUnits = deviceValue<cl_uint>(devices[d], CL_DEVICE_MAX_COMPUTE_UNITS);
+            caps.clockMHz = deviceValue<cl_uint>(devices[d], CL_DEVICE_MAX_CLOCK_FREQUENCY);
+            caps.globalMemory = deviceValue<cl_ulong>(devices[d], CL_DEVICE_GLOBAL_MEM_SIZE);
+            caps.localMemory = deviceValue<cl_ulong>(devices[d], CL_DEVICE_LOCAL_MEM_SIZE);
+            caps.maxAllocation = deviceValue<cl_ulong>(devices[d], CL_DEVICE_MAX_MEM_ALLOC_SIZE);
+            caps.imageSupport = deviceValue<cl_bool>(devices[d], CL_DEVICE_IMAGE_SUPPORT);
+            caps.maxImageWidth = deviceValue<size_t>(devices[d], CL_DEVICE_IMAGE2D_MAX_WIDTH);
+            caps.maxImageHeight = deviceValue<size_t>(devices[d], CL_DEVICE_IMAGE2D_MAX_HEIGHT);
+            caps.megapixelsPerSecond = 0;
+            queryImageFormats(caps);
+            capabilities.push_back(caps);
+        }
+    }
+    return capabilities;
+}
+
+// Times CALIBRATION_RUNS passes of calibrate.cl after one to warm up. The
+// objects are made directly rather than through the memory pool, whose
+// idle objects would outlive this context.
+static void calibrate(DeviceCapabilities &caps){
+    if (caps.megapixelsPerSecond > 0)
+        return;
+    cl_context context = deviceContext(caps);
+    if (!context)
+        return;
+    cl_int created[4];
+    cl_command_queue queue = clCreateCommandQueue(context, caps.device, 0, &created[0]);
+    // a device that cannot build the kernel is still ranked, by its figures
+    cl_program program = TryBuildProgramFromFile(context, 1, &caps.device, "calibrate.cl");
+    if (!program) {
+        std::cerr << "Calibrating " << caps.name << " skipped: calibrate.cl did not build"
+        << std::endl;
+        if (queue)
+            clReleaseCommandQueue(queue);
+        clReleaseContext(context);
+        return;
+    }
+    cl_kernel kernel = clCreateKernel(program, "calibrate", &created[1]);
+    cl_image_format format;
+    format.image_channel_order = CL_RGBA;
+    format.image_channel_data_type = CL_UNORM_INT8;
+    cl_mem images[2];
+    for (int i = 0; i < 2; i++)
+        images[i] = clCreateImage2D(context, CL_MEM_READ_WRITE, &format, CALIBRATION_SIZE,
+                                    CALIBRATION_SIZE, 0, NULL, &created[2 + i]);
+    cl_int errNum = CL_SUCCESS;
+    for (int i = 0; i < 4 && errNum == CL_SUCCESS; i++)
+        errNum = created[i];
+    if (errNum == CL_SUCCESS) {
+        errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &images[0]);
+        errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &images[1]);
+    }
+
+    size_t workSize[2] = { CALIBRATION_SIZE, CALIBRATION_SIZE };
+    double started = 0;
+    for (int run = 0; run <= CALIBRATION_RUNS && errNum == CL_SUCCESS; run++) {
+        if (run == 1) {
+            errNum = clFinish(queue);
+            started = milliseconds();
+        }
+        if (errNum == CL_SUCCESS)
+            errNum = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, workSize, NULL,
+                                            0, NULL, NULL);
+    }
+    if (errNum == CL_SUCCESS)
+        errNum = clFinish(queue);
+    double elapsed = milliseconds() - started;
+    if (errNum == CL_SUCCESS)
+        caps.megapixelsPerSecond = (double)CALIBRATION_SIZE * CALIBRATION_SIZE *
+                                   CALIBRATION_RUNS / (std::max(elapsed, 0.001) * 1000.0);
+    else
+        std::cerr << "Calibrating " << caps.name << " failed: "
+        << print_cl_errstring(errNum) << std::endl;
+
+    for (int i = 0; i < 2; i++)
+        if (images[i])
+            clReleaseMemObject(images[i]);
+    if (kernel)
+        clReleaseKernel(kernel);
+    clReleaseProgram(program);
+    if (queue)
+        clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+}
+
+static bool usable(const DeviceCapabilities &caps){
+    return caps.imageSupport && caps.rgbaImages;
+}
+
+// Measured throughput first; devices that could not be timed rank after
+// those that could, by compute units times clock
+static bool ranksAbove(const DeviceCapabilities &a, const DeviceCapabilities &b){
+    if (a.megapixelsPerSecond != b.megapixelsPerSecond)
+        return a.megapixelsPerSecond > b.megapixelsPerSecond;
+    return (double)a.computeUnits * a.clockMHz > (double)b.computeUnits * b.clockMHz;
+}
+
+static bool matches(const DeviceCapabilities &caps, const char *selector){
+    int platform, device;
+    char end;
+    if (sscanf(selector, "%d:%d%c", &platform, &device, &end) == 2)
+        return caps.platformIndex == platform && caps.deviceIndex == device;
+    if (!strcmp(selector, "gpu"))
+        return (caps.type & CL_DEVICE_TYPE_GPU) != 0;
+    if (!strcmp(selector, "cpu"))
+        return (caps.type & CL_DEVICE_TYPE_CPU) != 0;
+    if (!strcmp(selector, "accelerator"))
+        return (caps.type & CL_DEVICE_TYPE_ACCELERATOR) != 0;
+    return caps.name.find(selector) != std::string::npos;
+}
+
+bool SelectDevice(const char *selector, DeviceCapabilities &chosen){
+    if (!selector || !strcmp(selector, "auto"))
+        selector = getenv("SIMPLE_DEVICE");
+    if (selector && !strcmp(selector, "auto"))
+        selector = NULL;
+    GetDeviceCapabilities();
+
+    std::vector<DeviceCapabilities *> matching, candidates;
+    for (size_t i = 0; i < capabilities.size(); i++)
+        if (!selector || matches(capabilities[i], selector))
+            matching.push_back(&capabilities[i]);
+    for (size_t i = 0; i < matching.size(); i++)
+        if (usable(*matching[i]))
+            candidates.push_back(matching[i]);
+    // a device that cannot run the filters is still taken if asked for
+    if (candidates.empty() && selector)
+        candidates = matching;
+    if (candidates.empty()) {
+        if (selector)
+            std::cerr << "No OpenCL device matches " << selector << std::endl;
+        else
+            std::cerr << "No OpenCL device supports RGBA images" << std::endl;
+        return false;
+    }
+
+    DeviceCapabilities *best = candidates[0];
+    if (candidates.size() > 1) {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            calibrate(*candidates[i]);
+            if (ranksAbove(*candidates[i], *best))
+                best = candidates[i];
+        }
+    }
+    chosen = *best;
+    std::cout << "Using device " << chosen.platformIndex << ":" << chosen.deviceIndex
+    << " (" << chosen.name << ", " << chosen.platformName << ")";
+    if (chosen.megapixelsPerSecond > 0)
+        std::cout << ", calibrated at " << chosen.megapixelsPerSecond << " Mpixel/s";
+    std::cout << std::endl;
+    return true;
+}
+
+void PrintDeviceCapabilities(){
+    GetDeviceCapabilities();
+    for (size_t i = 0; i < capabilities.size(); i++) {
+        DeviceCapabilities &caps = capabilities[i];
+        if (usable(caps))
+            calibrate(caps);
+        std::string type = (caps.type & CL_DEVICE_TYPE_GPU) ? "GPU" :
+                           (caps.type & CL_DEVICE_TYPE_CPU) ? "CPU" :
+                           (caps.type & CL_DEVICE_TYPE_ACCELERATOR) ? "accelerator" : "other";
+        std::cout << caps.platformIndex << ":" << caps.deviceIndex << "\t" << caps.name
+        << " (" << caps.platformName << "), " << type << ", " << caps.computeUnits
+        << " CUs at " << caps.clockMHz << " MHz, " << (caps.globalMemory >> 20) << " MB global, "
+        << (caps.localMemory >> 10) << " KB local, " << (caps.maxAllocation >> 20)
+        << " MB max allocation, ";
+        if (caps.imageSupport)
+            std::cout << "images to " << caps.maxImageWidth << "x" << caps.maxImageHeight
+            << (caps.rgbaImages ? " RGBA" : "") << (caps.bgraImages ? " BGRA" : "");
+        else
+            std::cout << "no images";
+        if (caps.megapixelsPerSecond > 0)
+            std::cout << ", " << caps.megapixelsPerSecond << " Mpixel/s";
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,50 @@
+//
+//  devices.h
+//  Simple
+//
+
+#ifndef Simple_devices_h
+#define Simple_devices_h
+
+#include "openCLUtilities.h"
+#include <vector>
+
+// Calibration image, and how many timed runs of calibrate.cl over it
+#define CALIBRATION_SIZE 1024
+#define CALIBRATION_RUNS 4
+
+struct DeviceCapabilities {
+    cl_platform_id platform;
+    cl_device_id device;
+    int platformIndex;
+    int deviceIndex;
+    std::string platformName;
+    std::string name;
+    cl_device_type type;
+    cl_uint computeUnits;
+    cl_uint clockMHz;
+    cl_ulong globalMemory;
+    cl_ulong localMemory;
+    cl_ulong maxAllocation;
+    cl_bool imageSupport;
+    size_t maxImageWidth;
+    size_t maxImageHeight;
+    bool rgbaImages;            // CL_RGBA / CL_UNORM_INT8 2D images, what the filters use
+    bool bgraImages;            // CL_BGRA, for ChannelOrderFor
+    double megapixelsPerSecond; // calibrate.cl throughput, 0 until measured or if it failed
+};
+
+// Every device of every platform, queried the first time and kept
+const std::vector<DeviceCapabilities> &GetDeviceCapabilities();
+
+// Picks the device to run on. selector is "platform:device" indices, "gpu",
+// "cpu", "accelerator" or part of a device name; NULL or "auto" defers to
+// $SIMPLE_DEVICE, and then to every device. Of those matching, the ones
+// with RGBA images are preferred, and calibrate.cl is timed on each when
+// more than one is left to pick the fastest. False if nothing matches.
+bool SelectDevice(const char *selector, DeviceCapabilities &chosen);
+
+// One line per device, calibrating them all first
+void PrintDeviceCapabilities();
+
+#endif
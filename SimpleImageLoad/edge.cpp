@@ -0,0 +1,140 @@
+//
+//  edge.cpp
+//  Simple
+//
+
+#include <iostream>
+#include "edge.h"
+#include "memorypool.h"
+
+static void enqueue2D(cl_command_queue commands, cl_kernel kernel,
+                      int width, int height, const char *name){
+    size_t globalWorkSize[2] = { (size_t)width, (size_t)height };
+    cl_int errNum = clEnqueueNDRangeKernel(commands, kernel, 2, NULL,
+                                           globalWorkSize, NULL,
+                                           0, NULL, NULL);
+    checkErr(errNum, name);
+}
+
+bool DetectEdges(cl_context context,
+                 cl_command_queue commands,
+                 cl_program program,
+                 cl_mem image,
+                 cl_sampler sampler,
+                 int width, int height,
+                 float lowThreshold, float highThreshold,
+                 unsigned char *edgeMap)
+{
+    cl_int errNum;
+    size_t pixels = (size_t)width * height;
+    
+    // intermediates, none of which leave the device
+    cl_mem magnitude = PoolCreateBuffer(context, CL_MEM_READ_WRITE,
+                                      sizeof(cl_float) * pixels, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(magnitude)");
+    cl_mem direction = PoolCreateBuffer(context, CL_MEM_READ_WRITE,
+                                      pixels, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(direction)");
+    cl_mem thin = PoolCreateBuffer(context, CL_MEM_READ_WRITE,
+                                 sizeof(cl_float) * pixels, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(thin)");
+    cl_mem edges = PoolCreateBuffer(context, CL_MEM_READ_WRITE,
+                                  pixels, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(edges)");
+    cl_int zero = 0;
+    cl_mem changed = PoolCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                    sizeof(cl_int), &zero, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(changed)");
+    
+    cl_kernel sobel = clCreateKernel(program, "sobel", &errNum);
+    checkErr(errNum, "clCreateKernel(sobel)");
+    cl_kernel suppress = clCreateKernel(program, "non_max_suppression", &errNum);
+    checkErr(errNum, "clCreateKernel(non_max_suppression)");
+    cl_kernel threshold = clCreateKernel(program, "hysteresis_threshold", &errNum);
+    checkErr(errNum, "clCreateKernel(hysteresis_threshold)");
+    cl_kernel propagate = clCreateKernel(program, "hysteresis_propagate", &errNum);
+    checkErr(errNum, "clCreateKernel(hysteresis_propagate)");
+    cl_kernel finalize = clCreateKernel(program, "hysteresis_finalize", &errNum);
+    checkErr(errNum, "clCreateKernel(hysteresis_finalize)");
+    
+    // Rec. 601 luma, placed to match FreeImage's channel order
+    cl_float4 lumaWeights;
+    lumaWeights.s[FI_RGBA_RED] = 0.299f;
+    lumaWeights.s[FI_RGBA_GREEN] = 0.587f;
+    lumaWeights.s[FI_RGBA_BLUE] = 0.114f;
+    lumaWeights.s[FI_RGBA_ALPHA] = 0.0f;
+    
+    errNum = clSetKernelArg(sobel, 0, sizeof(cl_mem), &image);
+    errNum |= clSetKernelArg(sobel, 1, sizeof(cl_sampler), &sampler);
+    errNum |= clSetKernelArg(sobel, 2, sizeof(cl_int), &width);
+    errNum |= clSetKernelArg(sobel, 3, sizeof(cl_int), &height);
+    errNum |= clSetKernelArg(sobel, 4, sizeof(cl_float4), &lumaWeights);
+    errNum |= clSetKernelArg(sobel, 5, sizeof(cl_mem), &magnitude);
+    errNum |= clSetKernelArg(sobel, 6, sizeof(cl_mem), &direction);
+    checkErr(errNum, "clSetKernelArg(sobel)");
+    
+    errNum = clSetKernelArg(suppress, 0, sizeof(cl_mem), &magnitude);
+    errNum |= clSetKernelArg(suppress, 1, sizeof(cl_mem), &direction);
+    errNum |= clSetKernelArg(suppress, 2, sizeof(cl_int), &width);
+    errNum |= clSetKernelArg(suppress, 3, sizeof(cl_int), &height);
+    errNum |= clSetKernelArg(suppress, 4, sizeof(cl_mem), &thin);
+    checkErr(errNum, "clSetKernelArg(non_max_suppression)");
+    
+    errNum = clSetKernelArg(threshold, 0, sizeof(cl_mem), &thin);
+    errNum |= clSetKernelArg(threshold, 1, sizeof(cl_int), &width);
+    errNum |= clSetKernelArg(threshold, 2, sizeof(cl_int), &height);
+    errNum |= clSetKernelArg(threshold, 3, sizeof(cl_float), &lowThreshold);
+    errNum |= clSetKernelArg(threshold, 4, sizeof(cl_float), &highThreshold);
+    errNum |= clSetKernelArg(threshold, 5, sizeof(cl_mem), &edges);
+    checkErr(errNum, "clSetKernelArg(hysteresis_threshold)");
+    
+    errNum = clSetKernelArg(propagate, 0, sizeof(cl_mem), &edges);
+    errNum |= clSetKernelArg(propagate, 1, sizeof(cl_int), &width);
+    errNum |= clSetKernelArg(propagate, 2, sizeof(cl_int), &height);
+    errNum |= clSetKernelArg(propagate, 3, sizeof(cl_mem), &changed);
+    checkErr(errNum, "clSetKernelArg(hysteresis_propagate)");
+    
+    errNum = clSetKernelArg(finalize, 0, sizeof(cl_mem), &edges);
+    errNum |= clSetKernelArg(finalize, 1, sizeof(cl_int), &width);
+    errNum |= clSetKernelArg(finalize, 2, sizeof(cl_int), &height);
+    checkErr(errNum, "clSetKernelArg(hysteresis_finalize)");
+    
+    enqueue2D(commands, sobel, width, height, "clEnqueueNDRangeKernel(sobel)");
+    enqueue2D(commands, suppress, width, height, "clEnqueueNDRangeKernel(non_max_suppression)");
+    enqueue2D(commands, threshold, width, height, "clEnqueueNDRangeKernel(hysteresis_threshold)");
+    
+    // Batches of propagation passes, reading back just the flag in between.
+    // Each pass moves strong edges at least one pixel so this terminates.
+    int passes = 0;
+    cl_int flag;
+    do {
+        errNum = clEnqueueWriteBuffer(commands, changed, CL_FALSE, 0,
+                                      sizeof(cl_int), &zero, 0, NULL, NULL);
+        checkErr(errNum, "clEnqueueWriteBuffer(changed)");
+        for (int i = 0; i < HYSTERESIS_PASSES_PER_CHECK; i++)
+            enqueue2D(commands, propagate, width, height,
+                      "clEnqueueNDRangeKernel(hysteresis_propagate)");
+        passes += HYSTERESIS_PASSES_PER_CHECK;
+        errNum = clEnqueueReadBuffer(commands, changed, CL_TRUE, 0,
+                                     sizeof(cl_int), &flag, 0, NULL, NULL);
+        checkErr(errNum, "clEnqueueReadBuffer(changed)");
+    } while (flag);
+    
+    enqueue2D(commands, finalize, width, height, "clEnqueueNDRangeKernel(hysteresis_finalize)");
+    errNum = clEnqueueReadBuffer(commands, edges, CL_TRUE, 0, pixels, edgeMap,
+                                 0, NULL, NULL);
+    checkErr(errNum, "clEnqueueReadBuffer(edges)");
+    std::cout << "Edge hysteresis converged within " << passes << " passes" << std::endl;
+    
+    clReleaseKernel(sobel);
+    clReleaseKernel(suppress);
+    clReleaseKernel(threshold);
+    clReleaseKernel(propagate);
+    clReleaseKernel(finalize);
+    PoolReleaseMemObject(magnitude);
+    PoolReleaseMemObject(direction);
+    PoolReleaseMemObject(thin);
+    PoolReleaseMemObject(edges);
+    PoolReleaseMemObject(changed);
+    return true;
+}
@@ -0,0 +1,28 @@
+//
+//  edge.h
+//  Simple
+//
+
+#ifndef Simple_edge_h
+#define Simple_edge_h
+
+#include "openCLUtilities.h"
+
+// How many hysteresis_propagate launches are queued between checks of the
+// changed flag
+#define HYSTERESIS_PASSES_PER_CHECK 8
+
+// Run Sobel, non-maximum suppression and hysteresis on a (blurred) RGBA
+// image already on the device. Only the final width * height 8-bit edge map
+// is copied back, into edgeMap. Thresholds are gradient magnitudes on
+// normalised [0, 1] luminance.
+bool DetectEdges(cl_context context,
+                 cl_command_queue commands,
+                 cl_program program,
+                 cl_mem image,
+                 cl_sampler sampler,
+                 int width, int height,
+                 float lowThreshold, float highThreshold,
+                 unsigned char *edgeMap);
+
+#endif
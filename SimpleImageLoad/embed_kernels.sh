@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+#  embed_kernels.sh
+#  Simple
+#
+#  Regenerates kernelsources.cpp, every .cl file in the kernel directory as
+#  a string constant, so the binary does not read its kernels from the
+#  working directory, along with the SPIR-V compile_spirv.sh left beside
+#  any of them. Run by the "Embed Kernel Sources" build phase, or by hand
+#  after editing a kernel:
+#
+#      sh embed_kernels.sh [kernel directory] [output file]
+
+here=`dirname "$0"`
+kernels=${1:-"$here/../DerivedData/SimpleImageLoad/Build/Products/Debug"}
+output=${2:-"$here/kernelsources.cpp"}
+
+{
+    echo "//"
+    echo "//  kernelsources.cpp"
+    echo "//  Simple"
+    echo "//"
+    echo "//  Generated by embed_kernels.sh from the .cl files, do not edit."
+    echo "//"
+    echo ""
+    echo "#include \"kernelsources.h\""
+    echo ""
+    echo "const EmbeddedKernel embeddedKernels[] = {"
+    for file in "$kernels"/*.cl; do
+        echo "    { \"`basename "$file"`\","
+        # one literal per line, quotes and backslashes escaped
+        sed -e 's/\\/\\\\/g' -e 's/"/\\"/g' -e 's/^/      "/' -e 's/$/\\n"/' "$file"
+        spirv="${file%.cl}.spv"
+        if [ -f "$spirv" ]; then
+            echo "      ,"
+            od -An -v -tx1 "$spirv" | sed -e 's/^ *//' -e 's/ *$//' -e 's/ /\\x/g' -e 's/^/      "\\x/' -e 's/$/"/'
+            echo "      , `wc -c < "$spirv" | tr -d ' '`"
+        else
+            echo "      , 0, 0"
+        fi
+        echo "    },"
+    done
+    echo "    { 0, 0, 0, 0 }"
+    echo "};"
+} > "$output.tmp" && mv "$output.tmp" "$output"
@@ -0,0 +1,1021 @@
+//
+//  kernelsources.cpp
+//  Simple
+//
+//  Generated by embed_kernels.sh from the .cl files, do not edit.
+//
+
+#include "kernelsources.h"
+
+const EmbeddedKernel embeddedKernels[] = {
+    { "calibrate.cl",
+      "// A short run of the kind of work the filters do, a 3x3 box over an RGBA\n"
+      "// image through a sampler, timed by devices.cpp to rank the devices\n"
+      "// against each other.\n"
+      "\n"
+      "__kernel void calibrate(__read_only image2d_t srcImg,\n"
+      "                        __write_only image2d_t dstImg)\n"
+      "{\n"
+      "    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |\n"
+      "                              CLK_ADDRESS_CLAMP_TO_EDGE |\n"
+      "                              CLK_FILTER_NEAREST;\n"
+      "    int2 coord = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    float4 sum = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "    for (int j = -1; j <= 1; j++)\n"
+      "        for (int i = -1; i <= 1; i++)\n"
+      "            sum += read_imagef(srcImg, sampler, coord + (int2)(i, j));\n"
+      "    write_imagef(dstImg, coord, sum / 9.0f);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "colour.cl",
+      "// Colour space conversions, usable on their own (colour_convert) or fused\n"
+      "// into the load and store side of the Gaussian filter\n"
+      "// (gaussian_filter_colour) so a linear light blur needs no extra pass.\n"
+      "//\n"
+      "// Keep these in step with enum ColourTransform in colour.h\n"
+      "#define COLOUR_NONE             0\n"
+      "#define COLOUR_SRGB_TO_LINEAR   1\n"
+      "#define COLOUR_LINEAR_TO_SRGB   2\n"
+      "#define COLOUR_RGB_TO_YCBCR     3\n"
+      "#define COLOUR_YCBCR_TO_RGB     4\n"
+      "#define COLOUR_RGB_TO_GRAY      5\n"
+      "\n"
+      "float4 srgbToLinear(float4 c, __constant float *srgbLUT)\n"
+      "{\n"
+      "    // 8-bit input, so the 256 entry table is exact\n"
+      "    int4 index = convert_int4_sat_rte(c * 255.0f);\n"
+      "    return (float4)(srgbLUT[clamp(index.x, 0, 255)],\n"
+      "                    srgbLUT[clamp(index.y, 0, 255)],\n"
+      "                    srgbLUT[clamp(index.z, 0, 255)],\n"
+      "                    c.w);\n"
+      "}\n"
+      "\n"
+      "float4 linearToSrgb(float4 c)\n"
+      "{\n"
+      "    float3 v = clamp(c.xyz, 0.0f, 1.0f);\n"
+      "    float3 low = v * 12.92f;\n"
+      "    float3 high = 1.055f * powr(v, 1.0f / 2.4f) - 0.055f;\n"
+      "    float3 srgb = select(high, low, isless(v, (float3)(0.0031308f)));\n"
+      "    return (float4)(srgb, c.w);\n"
+      "}\n"
+      "\n"
+      "// full range BT.601 (JFIF), result is (Y, Cb, Cr, A)\n"
+      "float4 rgbToYCbCr(float4 c)\n"
+      "{\n"
+      "    float y  =  0.299f    * c.x + 0.587f    * c.y + 0.114f    * c.z;\n"
+      "    float cb = -0.168736f * c.x - 0.331264f * c.y + 0.5f      * c.z + 0.5f;\n"
+      "    float cr =  0.5f      * c.x - 0.418688f * c.y - 0.081312f * c.z + 0.5f;\n"
+      "    return (float4)(y, cb, cr, c.w);\n"
+      "}\n"
+      "\n"
+      "float4 yCbCrToRgb(float4 c)\n"
+      "{\n"
+      "    float cb = c.y - 0.5f;\n"
+      "    float cr = c.z - 0.5f;\n"
+      "    return (float4)(c.x + 1.402f * cr,\n"
+      "                    c.x - 0.344136f * cb - 0.714136f * cr,\n"
+      "                    c.x + 1.772f * cb,\n"
+      "                    c.w);\n"
+      "}\n"
+      "\n"
+      "float4 rgbToGray(float4 c)\n"
+      "{\n"
+      "    float y = 0.299f * c.x + 0.587f * c.y + 0.114f * c.z;\n"
+      "    return (float4)(y, y, y, c.w);\n"
+      "}\n"
+      "\n"
+      "float4 applyColourTransform(float4 c, int transform, __constant float *srgbLUT)\n"
+      "{\n"
+      "    switch (transform)\n"
+      "    {\n"
+      "        case COLOUR_SRGB_TO_LINEAR: return srgbToLinear(c, srgbLUT);\n"
+      "        case COLOUR_LINEAR_TO_SRGB: return linearToSrgb(c);\n"
+      "        case COLOUR_RGB_TO_YCBCR:   return rgbToYCbCr(c);\n"
+      "        case COLOUR_YCBCR_TO_RGB:   return yCbCrToRgb(c);\n"
+      "        case COLOUR_RGB_TO_GRAY:    return rgbToGray(c);\n"
+      "    }\n"
+      "    return c;\n"
+      "}\n"
+      "\n"
+      "// Images loaded through FreeImage on little endian hosts hold BGRA in the\n"
+      "// CL_RGBA channels, swapRB puts red back in .x while the transforms run\n"
+      "__kernel void colour_convert(__read_only image2d_t srcImg,\n"
+      "                             __write_only image2d_t dstImg,\n"
+      "                             sampler_t sampler,\n"
+      "                             int width, int height,\n"
+      "                             __constant float *srgbLUT,\n"
+      "                             int loadTransform, int storeTransform,\n"
+      "                             int swapRB)\n"
+      "{\n"
+      "    int2 coord = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    if (coord.x >= width || coord.y >= height)\n"
+      "        return;\n"
+      "    float4 c = read_imagef(srcImg, sampler, coord);\n"
+      "    if (swapRB)\n"
+      "        c = c.zyxw;\n"
+      "    c = applyColourTransform(c, loadTransform, srgbLUT);\n"
+      "    c = applyColourTransform(c, storeTransform, srgbLUT);\n"
+      "    write_imagef(dstImg, coord, swapRB ? c.zyxw : c);\n"
+      "}\n"
+      "\n"
+      "__kernel void gaussian_filter_colour(__read_only image2d_t srcImg,\n"
+      "                                     __write_only image2d_t dstImg,\n"
+      "                                     sampler_t sampler,\n"
+      "                                     int width, int height,\n"
+      "                                     __constant float *srgbLUT,\n"
+      "                                     int loadTransform, int storeTransform,\n"
+      "                                     int swapRB)\n"
+      "{\n"
+      "    // Gaussian Kernel is:\n"
+      "    // 1  2  1\n"
+      "    // 2  4  2\n"
+      "    // 1  2  1\n"
+      "    float kernelWeights[9] = { 1.0f, 2.0f, 1.0f,\n"
+      "        2.0f, 4.0f, 2.0f,\n"
+      "        1.0f, 2.0f, 1.0f };\n"
+      "    int2 outImageCoord = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    if (outImageCoord.x >= width || outImageCoord.y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    int weight = 0;\n"
+      "    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "    for (int y = outImageCoord.y - 1; y <= outImageCoord.y + 1; y++)\n"
+      "    {\n"
+      "        for (int x = outImageCoord.x - 1; x <= outImageCoord.x + 1; x++)\n"
+      "        {\n"
+      "            float4 c = read_imagef(srcImg, sampler, (int2)(x, y));\n"
+      "            if (swapRB)\n"
+      "                c = c.zyxw;\n"
+      "            c = applyColourTransform(c, loadTransform, srgbLUT);\n"
+      "            outColor += c * (kernelWeights[weight] / 16.0f);\n"
+      "            weight += 1;\n"
+      "        }\n"
+      "    }\n"
+      "    outColor = applyColourTransform(outColor, storeTransform, srgbLUT);\n"
+      "    write_imagef(dstImg, outImageCoord, swapRB ? outColor.zyxw : outColor);\n"
+      "}\n"
+      "\n"
+      "// gaussian_filter_colour and colour_convert over a batch of small images\n"
+      "// packed into one atlas, each with a filter of its own. tiles holds\n"
+      "// (x, y, width, height) of every image and filters its (blur,\n"
+      "// loadTransform, storeTransform, unused); the launch is (widest, tallest,\n"
+      "// images). Blurred reads are clamped to the image's own tile so its\n"
+      "// neighbours in the atlas never bleed into it.\n"
+      "__kernel void colour_filter_atlas(__read_only image2d_t srcImg,\n"
+      "                                  __write_only image2d_t dstImg,\n"
+      "                                  sampler_t sampler,\n"
+      "                                  __global const int4 *tiles,\n"
+      "                                  __global const int4 *filters,\n"
+      "                                  __constant float *srgbLUT,\n"
+      "                                  int swapRB)\n"
+      "{\n"
+      "    float kernelWeights[9] = { 1.0f, 2.0f, 1.0f,\n"
+      "        2.0f, 4.0f, 2.0f,\n"
+      "        1.0f, 2.0f, 1.0f };\n"
+      "    int4 tile = tiles[get_global_id(2)];\n"
+      "    int4 filter = filters[get_global_id(2)];\n"
+      "    int2 pixel = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    if (pixel.x >= tile.z || pixel.y >= tile.w)\n"
+      "        return;\n"
+      "\n"
+      "    int2 outImageCoord = tile.xy + pixel;\n"
+      "    float4 outColor;\n"
+      "    if (filter.x)\n"
+      "    {\n"
+      "        int2 firstCoord = tile.xy;\n"
+      "        int2 lastCoord = tile.xy + tile.zw - 1;\n"
+      "        int weight = 0;\n"
+      "        outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "        for (int y = -1; y <= 1; y++)\n"
+      "        {\n"
+      "            for (int x = -1; x <= 1; x++)\n"
+      "            {\n"
+      "                int2 coord = clamp(outImageCoord + (int2)(x, y), firstCoord, lastCoord);\n"
+      "                float4 c = read_imagef(srcImg, sampler, coord);\n"
+      "                if (swapRB)\n"
+      "                    c = c.zyxw;\n"
+      "                c = applyColourTransform(c, filter.y, srgbLUT);\n"
+      "                outColor += c * (kernelWeights[weight] / 16.0f);\n"
+      "                weight += 1;\n"
+      "            }\n"
+      "        }\n"
+      "    }\n"
+      "    else\n"
+      "    {\n"
+      "        outColor = read_imagef(srcImg, sampler, outImageCoord);\n"
+      "        if (swapRB)\n"
+      "            outColor = outColor.zyxw;\n"
+      "        outColor = applyColourTransform(outColor, filter.y, srgbLUT);\n"
+      "    }\n"
+      "    outColor = applyColourTransform(outColor, filter.z, srgbLUT);\n"
+      "    write_imagef(dstImg, outImageCoord, swapRB ? outColor.zyxw : outColor);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "edge_detect.cl",
+      "// Canny style edge detection, chained after gaussian_filter.\n"
+      "//\n"
+      "// sobel -> non_max_suppression -> hysteresis_threshold, then\n"
+      "// hysteresis_propagate is launched repeatedly until no weak edge changes,\n"
+      "// and hysteresis_finalize drops the weak edges that were never reached.\n"
+      "// Everything but the final 8-bit edge map stays on the device.\n"
+      "\n"
+      "#define EDGE_NONE   0\n"
+      "#define EDGE_WEAK   128\n"
+      "#define EDGE_STRONG 255\n"
+      "\n"
+      "// lumaWeights is set up by the host to match the channel order of the image\n"
+      "__kernel void sobel(__read_only image2d_t srcImg,\n"
+      "                    sampler_t sampler,\n"
+      "                    int width, int height,\n"
+      "                    float4 lumaWeights,\n"
+      "                    __global float *magnitude,\n"
+      "                    __global uchar *direction)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    float l[3][3];\n"
+      "    for (int j = -1; j <= 1; j++)\n"
+      "        for (int i = -1; i <= 1; i++)\n"
+      "            l[j + 1][i + 1] = dot(read_imagef(srcImg, sampler, (int2)(x + i, y + j)), lumaWeights);\n"
+      "\n"
+      "    float gx = (l[0][2] + 2.0f * l[1][2] + l[2][2]) - (l[0][0] + 2.0f * l[1][0] + l[2][0]);\n"
+      "    float gy = (l[2][0] + 2.0f * l[2][1] + l[2][2]) - (l[0][0] + 2.0f * l[0][1] + l[0][2]);\n"
+      "\n"
+      "    // quantise the gradient direction to 0, 45, 90 or 135 degrees\n"
+      "    float angle = atan2(gy, gx);\n"
+      "    if (angle < 0.0f)\n"
+      "        angle += M_PI_F;\n"
+      "    int sector = (int)floor(angle / (M_PI_F / 4.0f) + 0.5f) & 3;\n"
+      "\n"
+      "    magnitude[y * width + x] = hypot(gx, gy);\n"
+      "    direction[y * width + x] = (uchar)sector;\n"
+      "}\n"
+      "\n"
+      "__kernel void non_max_suppression(__global const float *magnitude,\n"
+      "                                  __global const uchar *direction,\n"
+      "                                  int width, int height,\n"
+      "                                  __global float *thin)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    // neighbour offsets along the gradient for each sector\n"
+      "    const int2 offsets[4] = { (int2)(1, 0), (int2)(1, 1), (int2)(0, 1), (int2)(-1, 1) };\n"
+      "    int2 d = offsets[direction[y * width + x]];\n"
+      "    int ax = clamp(x + d.x, 0, width - 1), ay = clamp(y + d.y, 0, height - 1);\n"
+      "    int bx = clamp(x - d.x, 0, width - 1), by = clamp(y - d.y, 0, height - 1);\n"
+      "\n"
+      "    float m = magnitude[y * width + x];\n"
+      "    bool isMax = m >= magnitude[ay * width + ax] && m >= magnitude[by * width + bx];\n"
+      "    thin[y * width + x] = isMax ? m : 0.0f;\n"
+      "}\n"
+      "\n"
+      "__kernel void hysteresis_threshold(__global const float *thin,\n"
+      "                                   int width, int height,\n"
+      "                                   float lowThreshold, float highThreshold,\n"
+      "                                   __global uchar *edges)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    float m = thin[y * width + x];\n"
+      "    edges[y * width + x] = m >= highThreshold ? EDGE_STRONG :\n"
+      "                           (m >= lowThreshold ? EDGE_WEAK : EDGE_NONE);\n"
+      "}\n"
+      "\n"
+      "// Promote weak edges touching a strong one. Updates are made in place and\n"
+      "// only ever go from weak to strong, so racing with a neighbour can only make\n"
+      "// a pass converge sooner.\n"
+      "__kernel void hysteresis_propagate(__global uchar *edges,\n"
+      "                                   int width, int height,\n"
+      "                                   __global int *changed)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height || edges[y * width + x] != EDGE_WEAK)\n"
+      "        return;\n"
+      "\n"
+      "    for (int j = max(y - 1, 0); j <= min(y + 1, height - 1); j++)\n"
+      "    {\n"
+      "        for (int i = max(x - 1, 0); i <= min(x + 1, width - 1); i++)\n"
+      "        {\n"
+      "            if (edges[j * width + i] == EDGE_STRONG)\n"
+      "            {\n"
+      "                edges[y * width + x] = EDGE_STRONG;\n"
+      "                *changed = 1;\n"
+      "                return;\n"
+      "            }\n"
+      "        }\n"
+      "    }\n"
+      "}\n"
+      "\n"
+      "__kernel void hysteresis_finalize(__global uchar *edges, int width, int height)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    if (edges[y * width + x] != EDGE_STRONG)\n"
+      "        edges[y * width + x] = EDGE_NONE;\n"
+      "}\n"
+      , 0, 0
+    },
+    { "edge_preserving.cl",
+      "// Edge preserving filters. Every kernel takes the same leading arguments as\n"
+      "// gaussian_filter (srcImg, dstImg, sampler, width, height) so they drop into\n"
+      "// the same launch and sampler setup.\n"
+      "\n"
+      "// compare-exchange, lane by lane, leaving the minimum in a\n"
+      "#define SORT2(a, b) { float4 t_ = fmin(a, b); b = fmax(a, b); a = t_; }\n"
+      "\n"
+      "// 3x3 median with the 19 exchange network (Paeth / Devillard)\n"
+      "__kernel void median_3x3(__read_only image2d_t srcImg,\n"
+      "                         __write_only image2d_t dstImg,\n"
+      "                         sampler_t sampler,\n"
+      "                         int width, int height)\n"
+      "{\n"
+      "    int2 coord = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    if (coord.x >= width || coord.y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    float4 p[9];\n"
+      "    for (int k = 0; k < 9; k++)\n"
+      "        p[k] = read_imagef(srcImg, sampler, coord + (int2)(k % 3 - 1, k / 3 - 1));\n"
+      "\n"
+      "    SORT2(p[1], p[2]); SORT2(p[4], p[5]); SORT2(p[7], p[8]);\n"
+      "    SORT2(p[0], p[1]); SORT2(p[3], p[4]); SORT2(p[6], p[7]);\n"
+      "    SORT2(p[1], p[2]); SORT2(p[4], p[5]); SORT2(p[7], p[8]);\n"
+      "    SORT2(p[0], p[3]); SORT2(p[5], p[8]); SORT2(p[4], p[7]);\n"
+      "    SORT2(p[3], p[6]); SORT2(p[1], p[4]); SORT2(p[2], p[5]);\n"
+      "    SORT2(p[4], p[7]); SORT2(p[4], p[2]); SORT2(p[6], p[4]);\n"
+      "    SORT2(p[4], p[2]);\n"
+      "\n"
+      "    write_imagef(dstImg, coord, p[4]);\n"
+      "}\n"
+      "\n"
+      "// 5x5 median by forgetful selection: only 14 of the 25 samples are ever\n"
+      "// live. Each step pushes the minimum and maximum of the set to its ends,\n"
+      "// drops both and pulls in the next sample; neither can be the median.\n"
+      "__kernel void median_5x5(__read_only image2d_t srcImg,\n"
+      "                         __write_only image2d_t dstImg,\n"
+      "                         sampler_t sampler,\n"
+      "                         int width, int height)\n"
+      "{\n"
+      "    int2 coord = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    if (coord.x >= width || coord.y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    float4 w[14];\n"
+      "    for (int k = 0; k < 14; k++)\n"
+      "        w[k] = read_imagef(srcImg, sampler, coord + (int2)(k % 5 - 2, k / 5 - 2));\n"
+      "\n"
+      "    int size = 14;\n"
+      "    for (int k = 14; k < 25; k++)\n"
+      "    {\n"
+      "        for (int i = 1; i < size; i++)\n"
+      "            SORT2(w[0], w[i]);\n"
+      "        for (int i = 1; i < size - 1; i++)\n"
+      "            SORT2(w[i], w[size - 1]);\n"
+      "        w[0] = read_imagef(srcImg, sampler, coord + (int2)(k % 5 - 2, k / 5 - 2));\n"
+      "        size--;\n"
+      "    }\n"
+      "    SORT2(w[0], w[1]); SORT2(w[1], w[2]); SORT2(w[0], w[1]);\n"
+      "\n"
+      "    write_imagef(dstImg, coord, w[1]);\n"
+      "}\n"
+      "\n"
+      "// Constant time median filter (Perreault & Hebert) for any radius.\n"
+      "//\n"
+      "// Each work item owns a vertical strip of stripWidth output columns over\n"
+      "// bandHeight rows, and keeps one 4 x 256 histogram per input column the\n"
+      "// strip touches, in its slice of scratch. Moving down a row adds one pixel\n"
+      "// to and removes one from every column histogram; moving right along the\n"
+      "// row adds one column histogram to the window histogram and removes\n"
+      "// another. Neither depends on the radius.\n"
+      "#define CTMF_BINS 256\n"
+      "#define CTMF_HISTOGRAM (4 * CTMF_BINS)\n"
+      "\n"
+      "void ctmfColumnUpdate(__global ushort *columns, int column, uint4 bin, int delta)\n"
+      "{\n"
+      "    __global ushort *h = columns + column * CTMF_HISTOGRAM;\n"
+      "    h[bin.x] += delta;\n"
+      "    h[CTMF_BINS + bin.y] += delta;\n"
+      "    h[2 * CTMF_BINS + bin.z] += delta;\n"
+      "    h[3 * CTMF_BINS + bin.w] += delta;\n"
+      "}\n"
+      "\n"
+      "uint4 ctmfBin(__read_only image2d_t srcImg, sampler_t sampler, int x, int y)\n"
+      "{\n"
+      "    // the clamp to edge sampler does the border handling\n"
+      "    return convert_uint4_sat_rte(read_imagef(srcImg, sampler, (int2)(x, y)) * 255.0f);\n"
+      "}\n"
+      "\n"
+      "float4 ctmfMedian(__global const ushort *window, int half)\n"
+      "{\n"
+      "    float m[4];\n"
+      "    for (int c = 0; c < 4; c++)\n"
+      "    {\n"
+      "        __global const ushort *h = window + c * CTMF_BINS;\n"
+      "        int count = 0;\n"
+      "        int bin = 0;\n"
+      "        while (bin < CTMF_BINS - 1 && (count += h[bin]) <= half)\n"
+      "            bin++;\n"
+      "        m[c] = bin / 255.0f;\n"
+      "    }\n"
+      "    return (float4)(m[0], m[1], m[2], m[3]);\n"
+      "}\n"
+      "\n"
+      "__kernel void median_ctmf(__read_only image2d_t srcImg,\n"
+      "                          __write_only image2d_t dstImg,\n"
+      "                          sampler_t sampler,\n"
+      "                          int width, int height,\n"
+      "                          int radius,\n"
+      "                          int stripWidth, int bandHeight,\n"
+      "                          __global ushort *scratch)\n"
+      "{\n"
+      "    int x0 = get_global_id(0) * stripWidth;\n"
+      "    int y0 = get_global_id(1) * bandHeight;\n"
+      "    if (x0 >= width || y0 >= height)\n"
+      "        return;\n"
+      "    int x1 = min(x0 + stripWidth, width);\n"
+      "    int y1 = min(y0 + bandHeight, height);\n"
+      "    int diameter = 2 * radius + 1;\n"
+      "    int half = (diameter * diameter) / 2;\n"
+      "    int columnCount = (x1 - x0) + 2 * radius;\n"
+      "\n"
+      "    size_t item = get_global_id(1) * get_global_size(0) + get_global_id(0);\n"
+      "    __global ushort *columns = scratch +\n"
+      "        item * (size_t)(stripWidth + 2 * radius + 1) * CTMF_HISTOGRAM;\n"
+      "    __global ushort *window = columns + columnCount * CTMF_HISTOGRAM;\n"
+      "\n"
+      "    for (int i = 0; i < columnCount * CTMF_HISTOGRAM; i++)\n"
+      "        columns[i] = 0;\n"
+      "    // prime the columns with the 2 * radius rows above the first output row\n"
+      "    for (int y = y0 - radius; y < y0 + radius; y++)\n"
+      "        for (int j = 0; j < columnCount; j++)\n"
+      "            ctmfColumnUpdate(columns, j, ctmfBin(srcImg, sampler, x0 - radius + j, y), 1);\n"
+      "\n"
+      "    for (int y = y0; y < y1; y++)\n"
+      "    {\n"
+      "        for (int j = 0; j < columnCount; j++)\n"
+      "        {\n"
+      "            int x = x0 - radius + j;\n"
+      "            ctmfColumnUpdate(columns, j, ctmfBin(srcImg, sampler, x, y + radius), 1);\n"
+      "            if (y > y0)\n"
+      "                ctmfColumnUpdate(columns, j, ctmfBin(srcImg, sampler, x, y - radius - 1), -1);\n"
+      "        }\n"
+      "\n"
+      "        for (int i = 0; i < CTMF_HISTOGRAM; i++)\n"
+      "        {\n"
+      "            ushort sum = 0;\n"
+      "            for (int j = 0; j < diameter; j++)\n"
+      "                sum += columns[j * CTMF_HISTOGRAM + i];\n"
+      "            window[i] = sum;\n"
+      "        }\n"
+      "        write_imagef(dstImg, (int2)(x0, y), ctmfMedian(window, half));\n"
+      "\n"
+      "        for (int x = x0 + 1; x < x1; x++)\n"
+      "        {\n"
+      "            __global const ushort *in = columns + (x - x0 + 2 * radius) * CTMF_HISTOGRAM;\n"
+      "            __global const ushort *out = columns + (x - x0 - 1) * CTMF_HISTOGRAM;\n"
+      "            for (int i = 0; i < CTMF_HISTOGRAM; i++)\n"
+      "                window[i] += in[i] - out[i];\n"
+      "            write_imagef(dstImg, (int2)(x, y), ctmfMedian(window, half));\n"
+      "        }\n"
+      "    }\n"
+      "}\n"
+      "\n"
+      "// Bilateral filter. spatialLUT holds the (2 radius + 1)^2 spatial weights,\n"
+      "// rangeLUT the weight for each 8-bit difference between a sample and the\n"
+      "// centre pixel (mean absolute difference over the colour channels).\n"
+      "__kernel void bilateral_filter(__read_only image2d_t srcImg,\n"
+      "                               __write_only image2d_t dstImg,\n"
+      "                               sampler_t sampler,\n"
+      "                               int width, int height,\n"
+      "                               int radius,\n"
+      "                               __constant float *spatialLUT,\n"
+      "                               __constant float *rangeLUT)\n"
+      "{\n"
+      "    int2 coord = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    if (coord.x >= width || coord.y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    float4 centre = read_imagef(srcImg, sampler, coord);\n"
+      "    float4 sum = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "    float weightSum = 0.0f;\n"
+      "    int weight = 0;\n"
+      "    for (int j = -radius; j <= radius; j++)\n"
+      "    {\n"
+      "        for (int i = -radius; i <= radius; i++)\n"
+      "        {\n"
+      "            float4 c = read_imagef(srcImg, sampler, coord + (int2)(i, j));\n"
+      "            float3 diff = fabs(c.xyz - centre.xyz);\n"
+      "            int index = convert_int_sat_rte((diff.x + diff.y + diff.z) * (255.0f / 3.0f));\n"
+      "            float w = spatialLUT[weight++] * rangeLUT[min(index, 255)];\n"
+      "            sum += c * w;\n"
+      "            weightSum += w;\n"
+      "        }\n"
+      "    }\n"
+      "\n"
+      "    write_imagef(dstImg, coord, sum / weightSum);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "gaussian_filter.cl",
+      "__kernel void gaussian_filter(__read_only image2d_t srcImg,\n"
+      "                              __write_only image2d_t dstImg,\n"
+      "                              sampler_t sampler,\n"
+      "                              int width, int height)\n"
+      "{\n"
+      "    // Gaussian Kernel is:\n"
+      "    // 1  2  1\n"
+      "    // 2  4  2\n"
+      "    // 1  2  1\n"
+      "    float kernelWeights[9] = { 1.0f, 2.0f, 1.0f,\n"
+      "        2.0f, 4.0f, 2.0f,\n"
+      "        1.0f, 2.0f, 1.0f };\n"
+      "    int2 startImageCoord = (int2) (get_global_id(0) - 1,\n"
+      "                                   get_global_id(1) - 1);\n"
+      "    int2 endImageCoord   = (int2) (get_global_id(0) + 1,\n"
+      "                                   get_global_id(1) + 1);\n"
+      "    int2 outImageCoord = (int2) (get_global_id(0),\n"
+      "                                 get_global_id(1));\n"
+      "    if (outImageCoord.x < width && outImageCoord.y < height)\n"
+      "    {\n"
+      "        int weight = 0;\n"
+      "        float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "        for(int y = startImageCoord.y; y <= endImageCoord.y; y++)\n"
+      "        {\n"
+      "            for(int x= startImageCoord.x; x <= endImageCoord.x; x++)\n"
+      "            {\n"
+      "                outColor +=\n"
+      "                (read_imagef(srcImg, sampler, (int2)(x, y)) *\n"
+      "                 (kernelWeights[weight] / 16.0f));\n"
+      "                weight += 1;\n"
+      "            }\n"
+      "        }\n"
+      "        // Write the output value to image\n"
+      "        write_imagef(dstImg, outImageCoord, outColor);\n"
+      "    }\n"
+      "}\n"
+      "\n"
+      "// gaussian_filter over a batch of small images packed into one atlas.\n"
+      "// tiles holds (x, y, width, height) of every image and the launch is\n"
+      "// (widest, tallest, images); reads are clamped to the image's own tile so\n"
+      "// its neighbours in the atlas never bleed into it.\n"
+      "__kernel void gaussian_filter_atlas(__read_only image2d_t srcImg,\n"
+      "                                    __write_only image2d_t dstImg,\n"
+      "                                    sampler_t sampler,\n"
+      "                                    __global const int4 *tiles)\n"
+      "{\n"
+      "    float kernelWeights[9] = { 1.0f, 2.0f, 1.0f,\n"
+      "        2.0f, 4.0f, 2.0f,\n"
+      "        1.0f, 2.0f, 1.0f };\n"
+      "    int4 tile = tiles[get_global_id(2)];\n"
+      "    int2 pixel = (int2)(get_global_id(0), get_global_id(1));\n"
+      "    if (pixel.x < tile.z && pixel.y < tile.w)\n"
+      "    {\n"
+      "        int2 firstCoord = tile.xy;\n"
+      "        int2 lastCoord = tile.xy + tile.zw - 1;\n"
+      "        int2 outImageCoord = tile.xy + pixel;\n"
+      "        int weight = 0;\n"
+      "        float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "        for(int y = -1; y <= 1; y++)\n"
+      "        {\n"
+      "            for(int x = -1; x <= 1; x++)\n"
+      "            {\n"
+      "                int2 coord = clamp(outImageCoord + (int2)(x, y), firstCoord, lastCoord);\n"
+      "                outColor +=\n"
+      "                (read_imagef(srcImg, sampler, coord) *\n"
+      "                 (kernelWeights[weight] / 16.0f));\n"
+      "                weight += 1;\n"
+      "            }\n"
+      "        }\n"
+      "        write_imagef(dstImg, outImageCoord, outColor);\n"
+      "    }\n"
+      "}\n"
+      , 0, 0
+    },
+    { "morphology.cl",
+      "// Separable grey scale morphology with the van Herk / Gil-Werman algorithm.\n"
+      "//\n"
+      "// Each pass runs along lines (rows or columns) of a single channel buffer.\n"
+      "// A line is padded by radius identity samples on both sides and cut into\n"
+      "// blocks of k = 2 radius + 1. vhgw_scan stores the running max (or min)\n"
+      "// from the start of each block in g and from the end of each block in h;\n"
+      "// any k wide window then spans at most two blocks, so vhgw_merge needs\n"
+      "// just h at its first sample and g at its last. The cost per pixel does not\n"
+      "// depend on k.\n"
+      "//\n"
+      "// Positions and lines are mapped to memory through strides so the same\n"
+      "// kernels do the horizontal and the vertical pass.\n"
+      "\n"
+      "uchar morphOp(uchar a, uchar b, int dilate)\n"
+      "{\n"
+      "    return dilate ? max(a, b) : min(a, b);\n"
+      "}\n"
+      "\n"
+      "__kernel void vhgw_scan(__global const uchar *src,\n"
+      "                        __global uchar *g,\n"
+      "                        __global uchar *h,\n"
+      "                        int length, int lines,\n"
+      "                        int srcPosStride, int srcLineStride,\n"
+      "                        int padPosStride, int padLineStride,\n"
+      "                        int radius, int dilate)\n"
+      "{\n"
+      "    int line = get_global_id(0);\n"
+      "    int block = get_global_id(1);\n"
+      "    int k = 2 * radius + 1;\n"
+      "    int padded = length + 2 * radius;\n"
+      "    int p0 = block * k;\n"
+      "    if (line >= lines || p0 >= padded)\n"
+      "        return;\n"
+      "    int p1 = min(p0 + k, padded);\n"
+      "    uchar identity = dilate ? 0 : 255;\n"
+      "\n"
+      "    __global const uchar *in = src + line * srcLineStride;\n"
+      "    __global uchar *gLine = g + line * padLineStride;\n"
+      "    __global uchar *hLine = h + line * padLineStride;\n"
+      "\n"
+      "    uchar acc = identity;\n"
+      "    for (int p = p0; p < p1; p++)\n"
+      "    {\n"
+      "        int x = p - radius;\n"
+      "        uchar v = (x >= 0 && x < length) ? in[x * srcPosStride] : identity;\n"
+      "        acc = morphOp(acc, v, dilate);\n"
+      "        gLine[p * padPosStride] = acc;\n"
+      "    }\n"
+      "    acc = identity;\n"
+      "    for (int p = p1 - 1; p >= p0; p--)\n"
+      "    {\n"
+      "        int x = p - radius;\n"
+      "        uchar v = (x >= 0 && x < length) ? in[x * srcPosStride] : identity;\n"
+      "        acc = morphOp(acc, v, dilate);\n"
+      "        hLine[p * padPosStride] = acc;\n"
+      "    }\n"
+      "}\n"
+      "\n"
+      "// posDim picks which global dimension walks along the line, so that\n"
+      "// neighbouring work items always touch neighbouring bytes of dst\n"
+      "__kernel void vhgw_merge(__global const uchar *g,\n"
+      "                         __global const uchar *h,\n"
+      "                         __global uchar *dst,\n"
+      "                         int length, int lines,\n"
+      "                         int dstPosStride, int dstLineStride,\n"
+      "                         int padPosStride, int padLineStride,\n"
+      "                         int radius, int dilate, int posDim)\n"
+      "{\n"
+      "    int x = get_global_id(posDim);\n"
+      "    int line = get_global_id(1 - posDim);\n"
+      "    if (x >= length || line >= lines)\n"
+      "        return;\n"
+      "\n"
+      "    // output x covers padded samples x .. x + 2 radius\n"
+      "    int first = line * padLineStride + x * padPosStride;\n"
+      "    int last = line * padLineStride + (x + 2 * radius) * padPosStride;\n"
+      "    dst[line * dstLineStride + x * dstPosStride] = morphOp(h[first], g[last], dilate);\n"
+      "}\n"
+      "\n"
+      "// dst = saturate(a - b), for the top-hat transforms\n"
+      "__kernel void morph_subtract(__global const uchar *a,\n"
+      "                             __global const uchar *b,\n"
+      "                             __global uchar *dst,\n"
+      "                             int count)\n"
+      "{\n"
+      "    int i = get_global_id(0);\n"
+      "    if (i < count)\n"
+      "        dst[i] = sub_sat(a[i], b[i]);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "pyramid.cl",
+      "// Gaussian pyramid REDUCE step.\n"
+      "//\n"
+      "// Every level of the pyramid lives in the same buffer, packed one after the\n"
+      "// other (level 0 first), so a whole chain is a sequence of launches of this\n"
+      "// kernel over a single allocation. Each launch reads the level starting at\n"
+      "// srcOffset and writes the half sized level starting at dstOffset.\n"
+      "\n"
+      "// 5-tap binomial (Burt & Adelson) weights, 1 4 6 4 1 / 16\n"
+      "__constant float pyramidWeights[5] = { 0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f };\n"
+      "\n"
+      "__kernel void pyramid_reduce(__global uchar4 *pyramid,\n"
+      "                             int srcOffset, int srcWidth, int srcHeight,\n"
+      "                             int dstOffset, int dstWidth, int dstHeight)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= dstWidth || y >= dstHeight)\n"
+      "        return;\n"
+      "\n"
+      "    __global uchar4 *src = pyramid + srcOffset;\n"
+      "    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "\n"
+      "    // blur and decimate in one go: only the even source samples are filtered\n"
+      "    for (int j = -2; j <= 2; j++)\n"
+      "    {\n"
+      "        int sy = clamp(2 * y + j, 0, srcHeight - 1);\n"
+      "        float4 rowColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "        for (int i = -2; i <= 2; i++)\n"
+      "        {\n"
+      "            int sx = clamp(2 * x + i, 0, srcWidth - 1);\n"
+      "            rowColor += convert_float4(src[sy * srcWidth + sx]) * pyramidWeights[i + 2];\n"
+      "        }\n"
+      "        outColor += rowColor * pyramidWeights[j + 2];\n"
+      "    }\n"
+      "\n"
+      "    pyramid[dstOffset + y * dstWidth + x] = convert_uchar4_sat_rte(outColor);\n"
+      "}\n"
+      "\n"
+      "// Copies one level into an image for reading back. The image's channel\n"
+      "// order need not be the buffer's: a CL_BGRA one swaps red and blue on the\n"
+      "// way in, so the level comes back in the order its encoder takes.\n"
+      "__kernel void pyramid_level_to_image(__global const uchar4 *pyramid,\n"
+      "                                     int offset, int width, int height,\n"
+      "                                     __write_only image2d_t dstImg)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    float4 color = convert_float4(pyramid[offset + y * width + x]) / 255.0f;\n"
+      "    write_imagef(dstImg, (int2)(x, y), color);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "resample.cl",
+      "// Separable resampling.\n"
+      "//\n"
+      "// The host precomputes, for every output column (and every output row), the\n"
+      "// first source sample it touches and a fixed number of weights, zero padded\n"
+      "// up to taps. The Gaussian blur and, when shrinking, the antialias prefilter\n"
+      "// are already folded into those weights, so a resize is exactly two passes:\n"
+      "// horizontal into a float4 scratch buffer, then vertical into the output.\n"
+      "\n"
+      "__kernel void resample_horizontal(__read_only image2d_t srcImg,\n"
+      "                                  __global float4 *dst,\n"
+      "                                  sampler_t sampler,\n"
+      "                                  __global const int *starts,\n"
+      "                                  __global const float *weights,\n"
+      "                                  int taps, int dstWidth, int height)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= dstWidth || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    int start = starts[x];\n"
+      "    __global const float *w = weights + x * taps;\n"
+      "    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "    // the clamp to edge sampler takes care of taps hanging off either side\n"
+      "    for (int t = 0; t < taps; t++)\n"
+      "        outColor += read_imagef(srcImg, sampler, (int2)(start + t, y)) * w[t];\n"
+      "\n"
+      "    dst[y * dstWidth + x] = outColor;\n"
+      "}\n"
+      "\n"
+      "__kernel void resample_vertical(__global const float4 *src,\n"
+      "                                __write_only image2d_t dstImg,\n"
+      "                                __global const int *starts,\n"
+      "                                __global const float *weights,\n"
+      "                                int taps, int width, int srcHeight, int dstHeight)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= dstHeight)\n"
+      "        return;\n"
+      "\n"
+      "    int start = starts[y];\n"
+      "    __global const float *w = weights + y * taps;\n"
+      "    float4 outColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);\n"
+      "    for (int t = 0; t < taps; t++)\n"
+      "    {\n"
+      "        int sy = clamp(start + t, 0, srcHeight - 1);\n"
+      "        outColor += src[sy * width + x] * w[t];\n"
+      "    }\n"
+      "\n"
+      "    write_imagef(dstImg, (int2)(x, y), outColor);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "statistics.cl",
+      "#pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable\n"
+      "#pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable\n"
+      "\n"
+      "#define HISTOGRAM_BINS 256\n"
+      "\n"
+      "// Per channel 8-bit histogram of an RGBA image.\n"
+      "//\n"
+      "// Each work-group builds a private histogram in __local memory, striding\n"
+      "// over the image so only a few groups are launched, and then merges it into\n"
+      "// the global result with one atomic per non-empty bin. histogram holds four\n"
+      "// consecutive 256 bin tables (one per channel) and must start zeroed.\n"
+      "__kernel void histogram_rgba(__read_only image2d_t srcImg,\n"
+      "                             sampler_t sampler,\n"
+      "                             int width, int height,\n"
+      "                             __global uint *histogram)\n"
+      "{\n"
+      "    __local uint localHistogram[4 * HISTOGRAM_BINS];\n"
+      "    int lid = get_local_id(0);\n"
+      "    int localSize = get_local_size(0);\n"
+      "\n"
+      "    for (int i = lid; i < 4 * HISTOGRAM_BINS; i += localSize)\n"
+      "        localHistogram[i] = 0;\n"
+      "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+      "\n"
+      "    int pixels = width * height;\n"
+      "    for (int p = get_global_id(0); p < pixels; p += get_global_size(0))\n"
+      "    {\n"
+      "        int2 coord = (int2)(p % width, p / width);\n"
+      "        uint4 bin = convert_uint4_sat_rte(read_imagef(srcImg, sampler, coord) * 255.0f);\n"
+      "        atomic_inc(&localHistogram[bin.x]);\n"
+      "        atomic_inc(&localHistogram[HISTOGRAM_BINS + bin.y]);\n"
+      "        atomic_inc(&localHistogram[2 * HISTOGRAM_BINS + bin.z]);\n"
+      "        atomic_inc(&localHistogram[3 * HISTOGRAM_BINS + bin.w]);\n"
+      "    }\n"
+      "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+      "\n"
+      "    for (int i = lid; i < 4 * HISTOGRAM_BINS; i += localSize)\n"
+      "    {\n"
+      "        uint count = localHistogram[i];\n"
+      "        if (count)\n"
+      "            atomic_add(&histogram[i], count);\n"
+      "    }\n"
+      "}\n"
+      , 0, 0
+    },
+    { "stream.cl",
+      "// Planar Y'CbCr <-> RGBA conversions for the Y4M streaming mode.\n"
+      "//\n"
+      "// A frame arrives as one buffer holding the Y plane followed by the Cb and\n"
+      "// Cr planes (subsampled by 2 in both directions for 4:2:0, full size for\n"
+      "// 4:4:4). yuv_to_rgba expands it into the RGBA image the filters read and\n"
+      "// rgba_to_yuv packs the filtered image back into the same layout.\n"
+      "//\n"
+      "// Y4M writers use studio swing BT.601 (Y' 16-235, CbCr 16-240), unlike the\n"
+      "// full range JFIF matrices in colour.cl.\n"
+      "\n"
+      "__kernel void yuv_to_rgba(__global const uchar *planes,\n"
+      "                          __write_only image2d_t dstImg,\n"
+      "                          int width, int height,\n"
+      "                          int chromaShift, int swapRB)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    int chromaWidth = (width + chromaShift) >> chromaShift;\n"
+      "    int chromaHeight = (height + chromaShift) >> chromaShift;\n"
+      "    __global const uchar *cbPlane = planes + width * height;\n"
+      "    __global const uchar *crPlane = cbPlane + chromaWidth * chromaHeight;\n"
+      "    int chroma = (y >> chromaShift) * chromaWidth + (x >> chromaShift);\n"
+      "\n"
+      "    float luma = 1.164383f * ((float)planes[y * width + x] - 16.0f);\n"
+      "    float cb = (float)cbPlane[chroma] - 128.0f;\n"
+      "    float cr = (float)crPlane[chroma] - 128.0f;\n"
+      "\n"
+      "    float4 c = (float4)(luma + 1.596027f * cr,\n"
+      "                        luma - 0.391762f * cb - 0.812968f * cr,\n"
+      "                        luma + 2.017232f * cb,\n"
+      "                        255.0f) / 255.0f;\n"
+      "    // keep the same channel order FreeImage gives the other kernels\n"
+      "    if (swapRB)\n"
+      "        c = c.zyxw;\n"
+      "    write_imagef(dstImg, (int2)(x, y), clamp(c, 0.0f, 1.0f));\n"
+      "}\n"
+      "\n"
+      "// One work item per chroma sample, covering the 2x2 (or 1x1) block of luma\n"
+      "// samples it is shared by\n"
+      "__kernel void rgba_to_yuv(__read_only image2d_t srcImg,\n"
+      "                          __global uchar *planes,\n"
+      "                          int width, int height,\n"
+      "                          int chromaShift, int swapRB)\n"
+      "{\n"
+      "    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE |\n"
+      "                              CLK_ADDRESS_CLAMP_TO_EDGE |\n"
+      "                              CLK_FILTER_NEAREST;\n"
+      "    int cx = get_global_id(0);\n"
+      "    int cy = get_global_id(1);\n"
+      "    int chromaWidth = (width + chromaShift) >> chromaShift;\n"
+      "    int chromaHeight = (height + chromaShift) >> chromaShift;\n"
+      "    if (cx >= chromaWidth || cy >= chromaHeight)\n"
+      "        return;\n"
+      "\n"
+      "    int block = 1 << chromaShift;\n"
+      "    float3 sum = (float3)(0.0f, 0.0f, 0.0f);\n"
+      "    for (int j = 0; j < block; j++)\n"
+      "    {\n"
+      "        for (int i = 0; i < block; i++)\n"
+      "        {\n"
+      "            int x = cx * block + i;\n"
+      "            int y = cy * block + j;\n"
+      "            // clamped reads repeat the last row/column of odd sized frames\n"
+      "            float4 c = read_imagef(srcImg, sampler, (int2)(x, y));\n"
+      "            float3 rgb = swapRB ? c.zyx : c.xyz;\n"
+      "            sum += rgb;\n"
+      "            if (x < width && y < height)\n"
+      "            {\n"
+      "                float luma = 16.0f + 65.481f * rgb.x + 128.553f * rgb.y + 24.966f * rgb.z;\n"
+      "                planes[y * width + x] = convert_uchar_sat_rte(luma);\n"
+      "            }\n"
+      "        }\n"
+      "    }\n"
+      "\n"
+      "    float3 rgb = sum / (float)(block * block);\n"
+      "    float cb = 128.0f - 37.797f * rgb.x - 74.203f * rgb.y + 112.0f * rgb.z;\n"
+      "    float cr = 128.0f + 112.0f * rgb.x - 93.786f * rgb.y - 18.214f * rgb.z;\n"
+      "    int chroma = cy * chromaWidth + cx;\n"
+      "    planes[width * height + chroma] = convert_uchar_sat_rte(cb);\n"
+      "    planes[width * height + chromaWidth * chromaHeight + chroma] = convert_uchar_sat_rte(cr);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "unpack.cl",
+      "// Expands packed 8-bit pixels into the 32-bit image the filters read.\n"
+      "//\n"
+      "// The loaders upload 24-bit RGB and 8-bit grey scanlines as they are, a\n"
+      "// quarter (or three quarters) fewer bytes than the RGBA they become, and\n"
+      "// this fills in the alpha on the device instead of on the host. Rows are\n"
+      "// pitch bytes apart, so FreeImage's padded scanlines go up untouched.\n"
+      "\n"
+      "__kernel void unpack_pixels(__global const uchar *packed,\n"
+      "                            int pitch, int channels, int swapRB,\n"
+      "                            __write_only image2d_t dstImg,\n"
+      "                            int width, int height)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    if (x >= width || y >= height)\n"
+      "        return;\n"
+      "\n"
+      "    __global const uchar *p = packed + y * pitch + x * channels;\n"
+      "    float4 c;\n"
+      "    if (channels == 1)\n"
+      "        c = (float4)(p[0], p[0], p[0], 255.0f);\n"
+      "    else\n"
+      "        c = (float4)(p[0], p[1], p[2], 255.0f);\n"
+      "    // keep the same channel order FreeImage gives the other kernels\n"
+      "    if (swapRB)\n"
+      "        c = c.zyxw;\n"
+      "    write_imagef(dstImg, (int2)(x, y), c / 255.0f);\n"
+      "}\n"
+      , 0, 0
+    },
+    { "volume.cl",
+      "// Separable 3D Gaussian over a float volume (or a z slab of one).\n"
+      "//\n"
+      "// One launch per axis. Dimension 0 of the launch is always x, so even the\n"
+      "// y and z passes have neighbouring work items reading neighbouring\n"
+      "// addresses: a work group walks whole rows of the planes above and below\n"
+      "// rather than striding through memory a plane at a time.\n"
+      "\n"
+      "__kernel void gaussian_volume_pass(__global const float *src,\n"
+      "                                   __global float *dst,\n"
+      "                                   int width, int height, int depth,\n"
+      "                                   int axis,\n"
+      "                                   __constant float *weights,\n"
+      "                                   int radius)\n"
+      "{\n"
+      "    int x = get_global_id(0);\n"
+      "    int y = get_global_id(1);\n"
+      "    int z = get_global_id(2);\n"
+      "    if (x >= width || y >= height || z >= depth)\n"
+      "        return;\n"
+      "\n"
+      "    long centre = ((long)z * height + y) * width + x;\n"
+      "    int coord, length;\n"
+      "    long stride;\n"
+      "    if (axis == 0) {\n"
+      "        coord = x; length = width; stride = 1;\n"
+      "    } else if (axis == 1) {\n"
+      "        coord = y; length = height; stride = width;\n"
+      "    } else {\n"
+      "        coord = z; length = depth; stride = (long)width * height;\n"
+      "    }\n"
+      "\n"
+      "    // clamp to edge; inside a slab the z halo makes the clamp unreachable\n"
+      "    // for every plane that is kept\n"
+      "    float sum = 0.0f;\n"
+      "    for (int i = -radius; i <= radius; i++)\n"
+      "    {\n"
+      "        int c = clamp(coord + i, 0, length - 1);\n"
+      "        sum += weights[i + radius] * src[centre + (c - coord) * stride];\n"
+      "    }\n"
+      "    dst[centre] = sum;\n"
+      "}\n"
+      , 0, 0
+    },
+    { 0, 0, 0, 0 }
+};
@@ -0,0 +1,22 @@
+//
+//  kernelsources.h
+//  Simple
+//
+
+#ifndef Simple_kernelsources_h
+#define Simple_kernelsources_h
+
+#include <cstddef>
+
+struct EmbeddedKernel {
+    const char *fileName;       // as passed to BuildProgramFromFile
+    const char *source;
+    const char *spirv;          // compile_spirv.sh's output, NULL without it
+    size_t spirvSize;
+};
+
+// Every .cl file as it was at build time (kernelsources.cpp, generated by
+// embed_kernels.sh), ending with a { 0, 0, 0, 0 } entry
+extern const EmbeddedKernel embeddedKernels[];
+
+#endif
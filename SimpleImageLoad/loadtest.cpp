@@ -0,0 +1,173 @@
+//
+//  loadtest.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+struct LoadTestClient {
+    pthread_t thread;
+    int index;
+    int clients;
+    int jobsPerClient;
+    const char *socketPath;
+    const std::vector<std::string> *jobs;
+    // results
+    std::vector<double> latencies;      // round trip, in ms
+    double serverLatency;               // sum of what the daemon reported
+    int succeeded;
+    int failures;
+};
+
+static double milliseconds(){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+static int connectTo(const char *socketPath){
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0)
+        return -1;
+    if (connect(connection, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+static bool readReply(int connection, std::string &buffered, std::string &line){
+    size_t newline;
+    while ((newline = buffered.find('\n')) == std::string::npos) {
+        char chunk[512];
+        ssize_t got = read(connection, chunk, sizeof(chunk));
+        if (got <= 0)
+            return false;
+        buffered.append(chunk, got);
+    }
+    line = buffered.substr(0, newline);
+    buffered.erase(0, newline + 1);
+    return true;
+}
+
+// Each client keeps one job outstanding, so the daemon sees as many
+// concurrent jobs as there are clients
+static void *runClient(void *argument){
+    LoadTestClient &client = *(LoadTestClient *)argument;
+    client.serverLatency = 0;
+    client.succeeded = 0;
+    client.failures = 0;
+    int connection = connectTo(client.socketPath);
+    if (connection < 0) {
+        client.failures = client.jobsPerClient;
+        return NULL;
+    }
+
+    std::string buffered, reply;
+    for (int i = 0; i < client.jobsPerClient; i++) {
+        const std::string &job = (*client.jobs)[(client.index + i * client.clients) % client.jobs->size()];
+        double sent = milliseconds();
+        std::string request = job + "\n";
+        if (write(connection, request.c_str(), request.size()) != (ssize_t)request.size() ||
+            !readReply(connection, buffered, reply)) {
+            client.failures += client.jobsPerClient - i;
+            break;
+        }
+        client.latencies.push_back(milliseconds() - sent);
+
+        char output[1024];
+        double latency;
+        if (sscanf(reply.c_str(), "OK %1023s %lf", output, &latency) == 2) {
+            client.serverLatency += latency;
+            client.succeeded++;
+        } else {
+            client.failures++;
+            std::cerr << reply << std::endl;
+        }
+    }
+    close(connection);
+    return NULL;
+}
+
+static double percentile(const std::vector<double> &sorted, double p){
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+bool RunLoadTest(const char *socketPath,
+                 const char *jobFile,
+                 int clients,
+                 int jobsPerClient)
+{
+    std::ifstream in(jobFile);
+    std::vector<std::string> jobs;
+    std::string line;
+    while (std::getline(in, line))
+        if (!line.empty() && line[0] != '#')
+            jobs.push_back(line);
+    if (jobs.empty()) {
+        std::cerr << "No jobs in " << jobFile << std::endl;
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<LoadTestClient> threads(clients);
+    double start = milliseconds();
+    for (int i = 0; i < clients; i++) {
+        threads[i].index = i;
+        threads[i].clients = clients;
+        threads[i].jobsPerClient = jobsPerClient;
+        threads[i].socketPath = socketPath;
+        threads[i].jobs = &jobs;
+        pthread_create(&threads[i].thread, NULL, runClient, &threads[i]);
+    }
+
+    std::vector<double> latencies;
+    double serverLatency = 0;
+    int succeeded = 0;
+    int failures = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i].thread, NULL);
+        latencies.insert(latencies.end(), threads[i].latencies.begin(), threads[i].latencies.end());
+        serverLatency += threads[i].serverLatency;
+        succeeded += threads[i].succeeded;
+        failures += threads[i].failures;
+    }
+    double elapsed = milliseconds() - start;
+    std::sort(latencies.begin(), latencies.end());
+
+    int completed = (int)latencies.size();
+    double total = 0;
+    for (size_t i = 0; i < latencies.size(); i++)
+        total += latencies[i];
+
+    std::cout << clients << " clients, " << completed << " jobs, "
+    << failures << " failed, in " << elapsed << " ms ("
+    << (elapsed > 0 ? completed * 1000.0 / elapsed : 0) << " jobs/s)" << std::endl;
+    if (completed > 0) {
+        std::cout << "Round trip latency ms: mean " << total / completed
+        << " p50 " << percentile(latencies, 0.5)
+        << " p95 " << percentile(latencies, 0.95)
+        << " p99 " << percentile(latencies, 0.99)
+        << " max " << latencies.back() << std::endl;
+    }
+    if (succeeded > 0)
+        std::cout << "Daemon reported latency ms: mean " << serverLatency / succeeded << std::endl;
+    return failures == 0;
+}
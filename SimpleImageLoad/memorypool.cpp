@@ -0,0 +1,286 @@
+//
+//  memorypool.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <list>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "memorypool.h"
+
+// CL_MEM_COPY_HOST_PTR only matters at creation, pooled objects get the
+// copy done by hand, so it is not part of an object's identity
+#define POOL_KEY_FLAGS(flags) ((flags) & ~(cl_mem_flags)CL_MEM_COPY_HOST_PTR)
+
+struct PoolKey {
+    cl_context context;
+    cl_mem_object_type type;
+    cl_mem_flags flags;
+    cl_channel_order order;     // images only
+    cl_channel_type dataType;
+    size_t width;               // bytes for buffers
+    size_t height;
+
+    bool operator==(const PoolKey &other) const {
+        return context == other.context && type == other.type &&
+               flags == other.flags && order == other.order &&
+               dataType == other.dataType && width == other.width &&
+               height == other.height;
+    }
+};
+
+struct PoolEntry {
+    PoolKey key;
+    cl_mem memory;
+    size_t bytes;
+};
+
+static std::list<PoolEntry> idleObjects;        // most recently released first
+static std::map<cl_mem, PoolEntry> liveObjects;
+static std::map<cl_context, cl_command_queue> uploadQueues;
+static size_t poolCapacity = DEFAULT_POOL_CAPACITY;
+static MemoryPoolStatistics poolStats = { 0, 0, 0, 0, 0, 0 };
+
+static size_t imageElementSize(const cl_image_format *format){
+    switch (format->image_channel_data_type) {
+        case CL_UNORM_SHORT_565:
+        case CL_UNORM_SHORT_555:
+            return 2;
+        case CL_UNORM_INT_101010:
+            return 4;
+    }
+    size_t channels = 4;
+    switch (format->image_channel_order) {
+        case CL_R: case CL_A: case CL_INTENSITY: case CL_LUMINANCE:
+            channels = 1;
+            break;
+        case CL_RG: case CL_RA:
+            channels = 2;
+            break;
+        case CL_RGB:
+            channels = 3;
+            break;
+    }
+    size_t bytes = 4;
+    switch (format->image_channel_data_type) {
+        case CL_SNORM_INT8: case CL_UNORM_INT8:
+        case CL_SIGNED_INT8: case CL_UNSIGNED_INT8:
+            bytes = 1;
+            break;
+        case CL_SNORM_INT16: case CL_UNORM_INT16:
+        case CL_SIGNED_INT16: case CL_UNSIGNED_INT16: case CL_HALF_FLOAT:
+            bytes = 2;
+            break;
+    }
+    return channels * bytes;
+}
+
+static void freeEntry(const PoolEntry &entry){
+    clReleaseMemObject(entry.memory);
+    poolStats.allocatedBytes -= entry.bytes;
+}
+
+// Frees idle objects, oldest first, until bytes more would fit
+static void evictFor(size_t bytes){
+    while (!idleObjects.empty() && poolStats.allocatedBytes + bytes > poolCapacity) {
+        const PoolEntry &oldest = idleObjects.back();
+        poolStats.idleBytes -= oldest.bytes;
+        freeEntry(oldest);
+        idleObjects.pop_back();
+        poolStats.evictions++;
+    }
+}
+
+static cl_command_queue uploadQueue(cl_context context){
+    cl_command_queue &queue = uploadQueues[context];
+    if (!queue) {
+        // a context may hold several devices, any of them can do the upload
+        size_t size = 0;
+        cl_int errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &size);
+        std::vector<cl_device_id> devices(std::max(size / sizeof(cl_device_id), (size_t)1));
+        if (errNum == CL_SUCCESS && size > 0)
+            errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, size, &devices[0], NULL);
+        if (errNum == CL_SUCCESS && size > 0)
+            queue = clCreateCommandQueue(context, devices[0], 0, &errNum);
+        static bool reported = false;
+        if ((errNum != CL_SUCCESS || !queue) && !reported) {
+            reported = true;
+            std::cerr << "Memory pool upload queue creation failed ("
+            << print_cl_errstring(errNum) << "), idle objects will not be refilled" << std::endl;
+        }
+        if (errNum != CL_SUCCESS)
+            queue = 0;
+    }
+    return queue;
+}
+
+// Reuses an idle object with this key, filling it from hostPtr if asked
+// to. NULL on a miss.
+static cl_mem takeIdle(const PoolKey &key, cl_mem_flags flags, const size_t *region,
+                       size_t rowPitch, void *hostPtr, cl_int *errNum){
+    for (std::list<PoolEntry>::iterator entry = idleObjects.begin();
+         entry != idleObjects.end(); ++entry) {
+        if (!(entry->key == key))
+            continue;
+
+        cl_int err = CL_SUCCESS;
+        if ((flags & CL_MEM_COPY_HOST_PTR) && hostPtr) {
+            // without a queue to refill it, a fresh object is the only way
+            if (!uploadQueue(key.context))
+                return NULL;
+            size_t origin[3] = { 0, 0, 0 };
+            // blocking, as CL_MEM_COPY_HOST_PTR would have been
+            if (key.type == CL_MEM_OBJECT_BUFFER)
+                err = clEnqueueWriteBuffer(uploadQueue(key.context), entry->memory, CL_TRUE,
+                                           0, key.width, hostPtr, 0, NULL, NULL);
+            else
+                err = clEnqueueWriteImage(uploadQueue(key.context), entry->memory, CL_TRUE,
+                                          origin, region, rowPitch, 0, hostPtr, 0, NULL, NULL);
+        }
+        if (err != CL_SUCCESS) {
+            // leave it idle, the caller gets a fresh one
+            continue;
+        }
+        cl_mem memory = entry->memory;
+        poolStats.idleBytes -= entry->bytes;
+        liveObjects[memory] = *entry;
+        idleObjects.erase(entry);
+        poolStats.hits++;
+        if (errNum)
+            *errNum = CL_SUCCESS;
+        return memory;
+    }
+    return NULL;
+}
+
+static void track(const PoolKey &key, cl_mem memory, size_t bytes){
+    PoolEntry entry = { key, memory, bytes };
+    liveObjects[memory] = entry;
+    poolStats.misses++;
+    poolStats.allocatedBytes += bytes;
+    if (poolStats.allocatedBytes > poolStats.peakBytes)
+        poolStats.peakBytes = poolStats.allocatedBytes;
+}
+
+static bool outOfMemory(cl_int err){
+    return err == CL_MEM_OBJECT_ALLOCATION_FAILURE || err == CL_OUT_OF_RESOURCES ||
+           err == CL_OUT_OF_HOST_MEMORY;
+}
+
+cl_mem PoolCreateImage2D(cl_context context,
+                         cl_mem_flags flags,
+                         const cl_image_format *format,
+                         size_t width,
+                         size_t height,
+                         size_t rowPitch,
+                         void *hostPtr,
+                         cl_int *errNum)
+{
+    if (flags & CL_MEM_USE_HOST_PTR)
+        return clCreateImage2D(context, flags, format, width, height, rowPitch, hostPtr, errNum);
+
+    PoolKey key = { context, CL_MEM_OBJECT_IMAGE2D, POOL_KEY_FLAGS(flags),
+                    format->image_channel_order, format->image_channel_data_type,
+                    width, height };
+    size_t region[3] = { width, height, 1 };
+    cl_mem memory = takeIdle(key, flags, region, rowPitch, hostPtr, errNum);
+    if (memory)
+        return memory;
+
+    size_t bytes = width * height * imageElementSize(format);
+    evictFor(bytes);
+    cl_int err;
+    memory = clCreateImage2D(context, flags, format, width, height, rowPitch, hostPtr, &err);
+    if (outOfMemory(err)) {
+        // idle objects under the cap can still be what stands in the way
+        DrainMemoryPool();
+        memory = clCreateImage2D(context, flags, format, width, height, rowPitch, hostPtr, &err);
+    }
+    if (errNum)
+        *errNum = err;
+    if (err == CL_SUCCESS)
+        track(key, memory, bytes);
+    return memory;
+}
+
+cl_mem PoolCreateBuffer(cl_context context,
+                        cl_mem_flags flags,
+                        size_t size,
+                        void *hostPtr,
+                        cl_int *errNum)
+{
+    if (flags & CL_MEM_USE_HOST_PTR)
+        return clCreateBuffer(context, flags, size, hostPtr, errNum);
+
+    PoolKey key = { context, CL_MEM_OBJECT_BUFFER, POOL_KEY_FLAGS(flags),
+                    0, 0, size, 0 };
+    cl_mem memory = takeIdle(key, flags, NULL, 0, hostPtr, errNum);
+    if (memory)
+        return memory;
+
+    evictFor(size);
+    cl_int err;
+    memory = clCreateBuffer(context, flags, size, hostPtr, &err);
+    if (outOfMemory(err)) {
+        DrainMemoryPool();
+        memory = clCreateBuffer(context, flags, size, hostPtr, &err);
+    }
+    if (errNum)
+        *errNum = err;
+    if (err == CL_SUCCESS)
+        track(key, memory, size);
+    return memory;
+}
+
+cl_int PoolReleaseMemObject(cl_mem memory){
+    std::map<cl_mem, PoolEntry>::iterator live = liveObjects.find(memory);
+    if (live == liveObjects.end())
+        return clReleaseMemObject(memory);
+
+    PoolEntry entry = live->second;
+    liveObjects.erase(live);
+    if (entry.bytes > poolCapacity) {
+        freeEntry(entry);
+        return CL_SUCCESS;
+    }
+    idleObjects.push_front(entry);
+    poolStats.idleBytes += entry.bytes;
+    evictFor(0);
+    return CL_SUCCESS;
+}
+
+void SetMemoryPoolCapacity(size_t bytes){
+    poolCapacity = bytes;
+    evictFor(0);
+}
+
+void GetMemoryPoolStatistics(MemoryPoolStatistics &stats){
+    stats = poolStats;
+}
+
+void PrintMemoryPoolStatistics(){
+    unsigned long requests = poolStats.hits + poolStats.misses;
+    if (requests == 0)
+        return;
+    std::cout << "Memory pool: " << requests << " requests, " << poolStats.hits
+    << " hits (" << 100.0 * poolStats.hits / requests << "%), " << poolStats.misses
+    << " misses, " << poolStats.evictions << " evictions" << std::endl;
+    std::cout << "Memory pool: " << poolStats.allocatedBytes << " bytes allocated ("
+    << poolStats.idleBytes << " idle), peak " << poolStats.peakBytes
+    << ", capacity " << poolCapacity << std::endl;
+}
+
+void DrainMemoryPool(){
+    for (std::list<PoolEntry>::iterator entry = idleObjects.begin();
+         entry != idleObjects.end(); ++entry)
+        freeEntry(*entry);
+    idleObjects.clear();
+    poolStats.idleBytes = 0;
+    for (std::map<cl_context, cl_command_queue>::iterator queue = uploadQueues.begin();
+         queue != uploadQueues.end(); ++queue)
+        if (queue->second)
+            clReleaseCommandQueue(queue->second);
+    uploadQueues.clear();
+}
@@ -0,0 +1,52 @@
+//
+//  memorypool.h
+//  Simple
+//
+
+#ifndef Simple_memorypool_h
+#define Simple_memorypool_h
+
+#include "openCLUtilities.h"
+
+// Cap on the device memory the pool holds, in use and idle together
+#define DEFAULT_POOL_CAPACITY ((size_t)512 * 1024 * 1024)
+
+struct MemoryPoolStatistics {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t allocatedBytes;      // in use plus idle
+    size_t idleBytes;
+    size_t peakBytes;
+};
+
+// Drop in replacements for clCreateImage2D, clCreateBuffer and
+// clReleaseMemObject. Released objects are kept and handed out again to
+// requests with the same context, flags, format and extent; the least
+// recently released are freed once the pool would go over its capacity.
+//
+// Only release an object once the commands using it have completed: the
+// next request for that shape may start writing to it straight away.
+// CL_MEM_USE_HOST_PTR objects are passed straight through, never pooled.
+cl_mem PoolCreateImage2D(cl_context context,
+                         cl_mem_flags flags,
+                         const cl_image_format *format,
+                         size_t width,
+                         size_t height,
+                         size_t rowPitch,
+                         void *hostPtr,
+                         cl_int *errNum);
+cl_mem PoolCreateBuffer(cl_context context,
+                        cl_mem_flags flags,
+                        size_t size,
+                        void *hostPtr,
+                        cl_int *errNum);
+cl_int PoolReleaseMemObject(cl_mem memory);
+
+void SetMemoryPoolCapacity(size_t bytes);
+void GetMemoryPoolStatistics(MemoryPoolStatistics &stats);
+void PrintMemoryPoolStatistics();
+// Frees every idle object (in use ones are left alone)
+void DrainMemoryPool();
+
+#endif
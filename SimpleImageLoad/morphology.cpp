@@ -0,0 +1,207 @@
+//
+//  morphology.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <algorithm>
+#include "morphology.h"
+#include "memorypool.h"
+#include "staging.h"
+
+bool ParseMorphOp(const char *name, MorphOp &op){
+    if (!strcmp(name, "erode"))
+        op = MORPH_ERODE;
+    else if (!strcmp(name, "dilate"))
+        op = MORPH_DILATE;
+    else if (!strcmp(name, "open"))
+        op = MORPH_OPEN;
+    else if (!strcmp(name, "close"))
+        op = MORPH_CLOSE;
+    else if (!strcmp(name, "tophat"))
+        op = MORPH_TOPHAT;
+    else if (!strcmp(name, "blackhat"))
+        op = MORPH_BLACKHAT;
+    else
+        return false;
+    return true;
+}
+
+struct MorphKernels {
+    cl_kernel scan;
+    cl_kernel merge;
+    cl_kernel subtract;
+};
+
+// One van Herk/Gil-Werman pass along the rows (or columns) of src
+static void enqueueLinePass(cl_command_queue commands, MorphKernels &kernels,
+                            cl_mem src, cl_mem dst, cl_mem g, cl_mem h,
+                            int width, int height, int radius, int dilate,
+                            bool vertical)
+{
+    cl_int errNum;
+    cl_int length = vertical ? height : width;
+    cl_int lines = vertical ? width : height;
+    cl_int posStride = vertical ? width : 1;
+    cl_int lineStride = vertical ? 1 : width;
+    cl_int padded = length + 2 * radius;
+    // vertical passes keep neighbouring columns next to each other in g/h
+    cl_int padPosStride = vertical ? lines : 1;
+    cl_int padLineStride = vertical ? 1 : padded;
+    cl_int posDim = vertical ? 1 : 0;
+    int k = 2 * radius + 1;
+    
+    errNum = clSetKernelArg(kernels.scan, 0, sizeof(cl_mem), &src);
+    errNum |= clSetKernelArg(kernels.scan, 1, sizeof(cl_mem), &g);
+    errNum |= clSetKernelArg(kernels.scan, 2, sizeof(cl_mem), &h);
+    errNum |= clSetKernelArg(kernels.scan, 3, sizeof(cl_int), &length);
+    errNum |= clSetKernelArg(kernels.scan, 4, sizeof(cl_int), &lines);
+    errNum |= clSetKernelArg(kernels.scan, 5, sizeof(cl_int), &posStride);
+    errNum |= clSetKernelArg(kernels.scan, 6, sizeof(cl_int), &lineStride);
+    errNum |= clSetKernelArg(kernels.scan, 7, sizeof(cl_int), &padPosStride);
+    errNum |= clSetKernelArg(kernels.scan, 8, sizeof(cl_int), &padLineStride);
+    errNum |= clSetKernelArg(kernels.scan, 9, sizeof(cl_int), &radius);
+    errNum |= clSetKernelArg(kernels.scan, 10, sizeof(cl_int), &dilate);
+    checkErr(errNum, "clSetKernelArg(vhgw_scan)");
+    size_t scanWorkSize[2] = { (size_t)lines, (size_t)((padded + k - 1) / k) };
+    errNum = clEnqueueNDRangeKernel(commands, kernels.scan, 2, NULL,
+                                    scanWorkSize, NULL, 0, NULL, NULL);
+    checkErr(errNum, "clEnqueueNDRangeKernel(vhgw_scan)");
+    
+    errNum = clSetKernelArg(kernels.merge, 0, sizeof(cl_mem), &g);
+    errNum |= clSetKernelArg(kernels.merge, 1, sizeof(cl_mem), &h);
+    errNum |= clSetKernelArg(kernels.merge, 2, sizeof(cl_mem), &dst);
+    errNum |= clSetKernelArg(kernels.merge, 3, sizeof(cl_int), &length);
+    errNum |= clSetKernelArg(kernels.merge, 4, sizeof(cl_int), &lines);
+    errNum |= clSetKernelArg(kernels.merge, 5, sizeof(cl_int), &posStride);
+    errNum |= clSetKernelArg(kernels.merge, 6, sizeof(cl_int), &lineStride);
+    errNum |= clSetKernelArg(kernels.merge, 7, sizeof(cl_int), &padPosStride);
+    errNum |= clSetKernelArg(kernels.merge, 8, sizeof(cl_int), &padLineStride);
+    errNum |= clSetKernelArg(kernels.merge, 9, sizeof(cl_int), &radius);
+    errNum |= clSetKernelArg(kernels.merge, 10, sizeof(cl_int), &dilate);
+    errNum |= clSetKernelArg(kernels.merge, 11, sizeof(cl_int), &posDim);
+    checkErr(errNum, "clSetKernelArg(vhgw_merge)");
+    size_t mergeWorkSize[2] = { (size_t)width, (size_t)height };
+    errNum = clEnqueueNDRangeKernel(commands, kernels.merge, 2, NULL,
+                                    mergeWorkSize, NULL, 0, NULL, NULL);
+    checkErr(errNum, "clEnqueueNDRangeKernel(vhgw_merge)");
+}
+
+// Square element erosion/dilation as a horizontal then a vertical pass
+static void enqueueErodeDilate(cl_command_queue commands, MorphKernels &kernels,
+                               cl_mem src, cl_mem dst, cl_mem temp,
+                               cl_mem g, cl_mem h,
+                               int width, int height, int radius, bool dilate)
+{
+    enqueueLinePass(commands, kernels, src, temp, g, h, width, height, radius, dilate, false);
+    enqueueLinePass(commands, kernels, temp, dst, g, h, width, height, radius, dilate, true);
+}
+
+static void enqueueSubtract(cl_command_queue commands, MorphKernels &kernels,
+                            cl_mem a, cl_mem b, cl_mem dst, cl_int count)
+{
+    cl_int errNum;
+    errNum = clSetKernelArg(kernels.subtract, 0, sizeof(cl_mem), &a);
+    errNum |= clSetKernelArg(kernels.subtract, 1, sizeof(cl_mem), &b);
+    errNum |= clSetKernelArg(kernels.subtract, 2, sizeof(cl_mem), &dst);
+    errNum |= clSetKernelArg(kernels.subtract, 3, sizeof(cl_int), &count);
+    checkErr(errNum, "clSetKernelArg(morph_subtract)");
+    size_t globalWorkSize = count;
+    errNum = clEnqueueNDRangeKernel(commands, kernels.subtract, 1, NULL,
+                                    &globalWorkSize, NULL, 0, NULL, NULL);
+    checkErr(errNum, "clEnqueueNDRangeKernel(morph_subtract)");
+}
+
+bool RunMorphology(cl_context context,
+                   cl_command_queue commands,
+                   cl_program program,
+                   char *inputFile,
+                   char *outputFile,
+                   MorphOp op,
+                   int size)
+{
+    cl_int errNum;
+    int width, height;
+    unsigned char *pixels = LoadGreyImageData(inputFile, width, height);
+    if (!pixels)
+        return false;
+    int radius = size / 2;
+    size_t count = (size_t)width * height;
+    
+    MorphKernels kernels;
+    kernels.scan = clCreateKernel(program, "vhgw_scan", &errNum);
+    checkErr(errNum, "clCreateKernel(vhgw_scan)");
+    kernels.merge = clCreateKernel(program, "vhgw_merge", &errNum);
+    checkErr(errNum, "clCreateKernel(vhgw_merge)");
+    kernels.subtract = clCreateKernel(program, "morph_subtract", &errNum);
+    checkErr(errNum, "clCreateKernel(morph_subtract)");
+    
+    // single channel buffers throughout: the source, the result, two
+    // intermediates for the compound operators and the g/h block scans
+    size_t rowScan = (size_t)height * (width + 2 * radius);
+    size_t columnScan = (size_t)width * (height + 2 * radius);
+    size_t scanBytes = rowScan > columnScan ? rowScan : columnScan;
+    cl_mem src = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                count, pixels, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(morphology source)");
+    cl_mem dst = PoolCreateBuffer(context, CL_MEM_READ_WRITE, count, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(morphology result)");
+    cl_mem temp = PoolCreateBuffer(context, CL_MEM_READ_WRITE, count, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(morphology temp)");
+    cl_mem stage = PoolCreateBuffer(context, CL_MEM_READ_WRITE, count, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(morphology stage)");
+    cl_mem g = PoolCreateBuffer(context, CL_MEM_READ_WRITE, scanBytes, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(morphology g)");
+    cl_mem h = PoolCreateBuffer(context, CL_MEM_READ_WRITE, scanBytes, NULL, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(morphology h)");
+    
+    // compound operators are chained on the device, nothing comes back
+    // until the final result
+    switch (op) {
+        case MORPH_ERODE:
+            enqueueErodeDilate(commands, kernels, src, dst, temp, g, h, width, height, radius, false);
+            break;
+        case MORPH_DILATE:
+            enqueueErodeDilate(commands, kernels, src, dst, temp, g, h, width, height, radius, true);
+            break;
+        case MORPH_OPEN:
+            enqueueErodeDilate(commands, kernels, src, stage, temp, g, h, width, height, radius, false);
+            enqueueErodeDilate(commands, kernels, stage, dst, temp, g, h, width, height, radius, true);
+            break;
+        case MORPH_CLOSE:
+            enqueueErodeDilate(commands, kernels, src, stage, temp, g, h, width, height, radius, true);
+            enqueueErodeDilate(commands, kernels, stage, dst, temp, g, h, width, height, radius, false);
+            break;
+        case MORPH_TOPHAT:
+            enqueueErodeDilate(commands, kernels, src, stage, temp, g, h, width, height, radius, false);
+            enqueueErodeDilate(commands, kernels, stage, dst, temp, g, h, width, height, radius, true);
+            enqueueSubtract(commands, kernels, src, dst, stage, (cl_int)count);
+            std::swap(stage, dst);
+            break;
+        case MORPH_BLACKHAT:
+            enqueueErodeDilate(commands, kernels, src, stage, temp, g, h, width, height, radius, true);
+            enqueueErodeDilate(commands, kernels, stage, dst, temp, g, h, width, height, radius, false);
+            enqueueSubtract(commands, kernels, dst, src, stage, (cl_int)count);
+            std::swap(stage, dst);
+            break;
+    }
+    
+    errNum = clEnqueueReadBuffer(commands, dst, CL_TRUE, 0, count, pixels,
+                                 0, NULL, NULL);
+    checkErr(errNum, "clEnqueueReadBuffer(morphology)");
+    std::cout << "Morphology with a " << 2 * radius + 1 << "x" << 2 * radius + 1
+    << " element -> " << outputFile << std::endl;
+    bool saved = SaveGreyImage(outputFile, pixels, width, height);
+    
+    ReleaseStaging(pixels);
+    PoolReleaseMemObject(src);
+    PoolReleaseMemObject(dst);
+    PoolReleaseMemObject(temp);
+    PoolReleaseMemObject(stage);
+    PoolReleaseMemObject(g);
+    PoolReleaseMemObject(h);
+    clReleaseKernel(kernels.scan);
+    clReleaseKernel(kernels.merge);
+    clReleaseKernel(kernels.subtract);
+    return saved;
+}
@@ -0,0 +1,31 @@
+//
+//  morphology.h
+//  Simple
+//
+
+#ifndef Simple_morphology_h
+#define Simple_morphology_h
+
+#include "openCLUtilities.h"
+
+enum MorphOp {
+    MORPH_ERODE,
+    MORPH_DILATE,
+    MORPH_OPEN,
+    MORPH_CLOSE,
+    MORPH_TOPHAT,       // src - open(src)
+    MORPH_BLACKHAT      // close(src) - src
+};
+
+bool ParseMorphOp(const char *name, MorphOp &op);
+// Apply op with a size x size square structuring element (size is rounded
+// up to odd) to the greyscale version of inputFile
+bool RunMorphology(cl_context context,
+                   cl_command_queue commands,
+                   cl_program program,
+                   char *inputFile,
+                   char *outputFile,
+                   MorphOp op,
+                   int size);
+
+#endif
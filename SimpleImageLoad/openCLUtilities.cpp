@@ -7,7 +7,16 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
 #include "openCLUtilities.h"
+#include "memorypool.h"
+#include "staging.h"
+#include "pngencode.h"
+#include "kernelsources.h"
 
 size_t RoundUp(size_t groupSize, size_t globalSize){ 
     size_t r = globalSize % groupSize; 
@@ -247,38 +256,356 @@ char *load_program_source(const char *filename)
     FILE        *fh;
     char        *source;
 	
-    fh = fopen(filename, "r");
+    fh = fopen(filename, "rb");
     if (fh == 0)
         return 0;
 	
-    stat(filename, &statbuf);
+    fstat(fileno(fh), &statbuf);
     source = (char *) malloc((unsigned long)statbuf.st_size + 1);
-    fread(source, (unsigned long)statbuf.st_size, 1, fh);
-    source[statbuf.st_size] = '\0';
+    size_t length = fread(source, 1, (unsigned long)statbuf.st_size, fh);
+    source[length] = '\0';
+    fclose(fh);
 	
     return source;
 }
 
-cl_mem LoadImage(cl_context context, char *fileName, int &width, int &height)
-{ 
+static double milliseconds(){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+static const char *kernelDirectory = getenv("SIMPLE_KERNEL_DIR");
+static ProgramBuildStatistics buildStats = { 0, 0, 0, 0, 0, 0 };
+
+void SetKernelSourceDirectory(const char *directory){
+    kernelDirectory = directory;
+}
+
+static const EmbeddedKernel *embeddedKernel(const char *fileName){
+    for (const EmbeddedKernel *kernel = embeddedKernels; kernel->fileName; kernel++)
+        if (!strcmp(kernel->fileName, fileName))
+            return kernel;
+    return NULL;
+}
+
+#ifdef CL_VERSION_2_1
+// Whether every device takes SPIR-V through clCreateProgramWithIL
+static bool devicesTakeSpirv(cl_uint numDevices, const cl_device_id *deviceIDs){
+    for (cl_uint i = 0; i < numDevices; i++) {
+        char version[256] = "";
+        if (clGetDeviceInfo(deviceIDs[i], CL_DEVICE_IL_VERSION, sizeof(version),
+                            version, NULL) != CL_SUCCESS || !strstr(version, "SPIR-V"))
+            return false;
+    }
+    return true;
+}
+#endif
+
+struct ProgramBuild {
+    cl_program program;
+    std::string fileName;
+    bool fromSpirv;
+    std::vector<cl_device_id> devices;
+    std::string options;
+    bool fatal;             // a failure ends the process rather than returning NULL
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t built;
+    bool done;
+    cl_int errNum;
+    double started;
+    double finished;
+};
+
+static void CL_CALLBACK programBuilt(cl_program, void *data){
+    ProgramBuild *build = (ProgramBuild *)data;
+    pthread_mutex_lock(&build->lock);
+    build->done = true;
+    build->finished = milliseconds();
+    pthread_cond_signal(&build->built);
+    pthread_mutex_unlock(&build->lock);
+}
+
+// clBuildProgram may block even with a callback, so it gets a thread of
+// its own; an error it returns means the callback is never called
+static void *buildProgram(void *data){
+    ProgramBuild *build = (ProgramBuild *)data;
+    cl_int errNum = clBuildProgram(build->program, build->devices.size(), &build->devices[0],
+                                   build->options.c_str(), programBuilt, build);
+    if (errNum != CL_SUCCESS) {
+        pthread_mutex_lock(&build->lock);
+        build->errNum = errNum;
+        build->done = true;
+        build->finished = milliseconds();
+        pthread_cond_signal(&build->built);
+        pthread_mutex_unlock(&build->lock);
+    }
+    return NULL;
+}
+
+static ProgramBuild *beginBuild(cl_context context,
+                                cl_uint numDevices,
+                                const cl_device_id *deviceIDs,
+                                const char *fileName,
+                                bool allowSpirv,
+                                bool fatal)
+{
+    cl_int errNum = CL_SUCCESS;
+    ProgramBuild *build = new ProgramBuild;
+    build->fileName = fileName;
+    build->fatal = fatal;
+    build->devices.assign(deviceIDs, deviceIDs + numDevices);
+    build->fromSpirv = false;
+    build->program = NULL;
+    const EmbeddedKernel *embedded = kernelDirectory ? NULL : embeddedKernel(fileName);
+#ifdef CL_VERSION_2_1
+    // precompiled SPIR-V skips the OpenCL C front end where devices take it
+    if (allowSpirv && embedded && embedded->spirv && devicesTakeSpirv(numDevices, deviceIDs)) {
+        build->program = clCreateProgramWithIL(context, embedded->spirv, embedded->spirvSize,
+                                               &errNum);
+        build->fromSpirv = errNum == CL_SUCCESS;
+        if (!build->fromSpirv)
+            build->program = NULL;
+    }
+#else
+    (void)allowSpirv;
+#endif
+
+    if (!build->program) {
+        double started = milliseconds();
+        // the override directory wins, so kernels can be edited without a
+        // rebuild; a file the binary was built without is looked for here
+        std::string path = fileName;
+        build->options = "-I.";
+        if (kernelDirectory) {
+            path = std::string(kernelDirectory) + "/" + fileName;
+            build->options = std::string("-I") + kernelDirectory;
+        }
+        const char *src = embedded ? embedded->source : NULL;
+        char *loaded = NULL;
+        if (src) {
+            buildStats.embedded++;
+        } else {
+            loaded = load_program_source(path.c_str());
+            if (fatal)
+                checkErr(loaded ? CL_SUCCESS : -1, path.c_str());
+            else if (!loaded)
+                std::cerr << "Cannot read OpenCL C source " << path << std::endl;
+            src = loaded;
+            buildStats.fromDisk++;
+        }
+        buildStats.loadMilliseconds += milliseconds() - started;
+        
+        if (src) {
+            build->program = clCreateProgramWithSource(context,
+                                                       1,
+                                                       &src,
+                                                       NULL,
+                                                       &errNum);
+            if (fatal)
+                checkErr(errNum, "clCreateProgramWithSource");
+        } else {
+            errNum = CL_INVALID_PROGRAM;
+        }
+        free(loaded);
+        if (errNum != CL_SUCCESS)
+            build->program = NULL;
+    }
+
+    pthread_mutex_init(&build->lock, NULL);
+    pthread_cond_init(&build->built, NULL);
+    build->done = false;
+    build->errNum = errNum;
+    build->started = milliseconds();
+    // nothing to build, FinishProgramBuild reports the failure
+    if (!build->program) {
+        build->done = true;
+        build->finished = build->started;
+        build->thread = pthread_self();
+    } else if (pthread_create(&build->thread, NULL, buildProgram, build) != 0) {
+        build->thread = pthread_self();
+        buildProgram(build);
+    }
+    return build;
+}
+
+ProgramBuild *BeginProgramBuild(cl_context context,
+                                cl_uint numDevices,
+                                const cl_device_id *deviceIDs,
+                                const char *fileName)
+{
+    return beginBuild(context, numDevices, deviceIDs, fileName, true, true);
+}
+
+cl_program FinishProgramBuild(ProgramBuild *build){
+    double waitStarted = milliseconds();
+    pthread_mutex_lock(&build->lock);
+    while (!build->done)
+        pthread_cond_wait(&build->built, &build->lock);
+    pthread_mutex_unlock(&build->lock);
+    if (!pthread_equal(build->thread, pthread_self()))
+        pthread_join(build->thread, NULL);
+    buildStats.waitMilliseconds += milliseconds() - waitStarted;
+    buildStats.buildMilliseconds += build->finished - build->started;
+    pthread_mutex_destroy(&build->lock);
+    pthread_cond_destroy(&build->built);
+
+    // with a callback the outcome is in the build status, not the return
+    cl_int errNum = build->errNum;
+    cl_build_status status = CL_BUILD_ERROR;
+    if (errNum == CL_SUCCESS && build->program)
+        clGetProgramBuildInfo(build->program, build->devices[0], CL_PROGRAM_BUILD_STATUS,
+                              sizeof(status), &status, NULL);
+    if (errNum == CL_SUCCESS && status != CL_BUILD_SUCCESS)
+        errNum = CL_BUILD_PROGRAM_FAILURE;
+
+    cl_program program = build->program;
+    if (errNum != CL_SUCCESS && build->fromSpirv) {
+        std::cerr << "SPIR-V for " << build->fileName << " did not build ("
+        << print_cl_errstring(errNum) << "), using its source" << std::endl;
+        cl_context context;
+        clGetProgramInfo(program, CL_PROGRAM_CONTEXT, sizeof(context), &context, NULL);
+        clReleaseProgram(program);
+        program = FinishProgramBuild(beginBuild(context, build->devices.size(), &build->devices[0],
+                                                build->fileName.c_str(), false, build->fatal));
+    } else if (errNum != CL_SUCCESS && !program) {
+        if (build->fatal)
+            checkErr(errNum, build->fileName.c_str());
+    } else if (errNum != CL_SUCCESS) {
+        // Determine the reason for the error
+        char buildLog[16384];
+        clGetProgramBuildInfo(program,
+                              build->devices[0],
+                              CL_PROGRAM_BUILD_LOG,
+                              sizeof(buildLog),
+                              buildLog,
+                              NULL);
+        std::cerr << "Error in OpenCL C source " << build->fileName << ": " << std::endl;
+        std::cerr << buildLog;
+        if (build->fatal)
+            checkErr(errNum, "clBuildProgram");
+        clReleaseProgram(program);
+        program = NULL;
+    } else if (build->fromSpirv) {
+        buildStats.spirv++;
+    }
+    delete build;
+    return program;
+}
+
+cl_program BuildProgramFromFile(cl_context context,
+                                cl_uint numDevices,
+                                const cl_device_id *deviceIDs,
+                                const char *fileName)
+{
+    return FinishProgramBuild(BeginProgramBuild(context, numDevices, deviceIDs, fileName));
+}
+
+cl_program TryBuildProgramFromFile(cl_context context,
+                                   cl_uint numDevices,
+                                   const cl_device_id *deviceIDs,
+                                   const char *fileName)
+{
+    return FinishProgramBuild(beginBuild(context, numDevices, deviceIDs, fileName, true, false));
+}
+
+bool GetKernelSource(const char *fileName, std::string &source){
+    const EmbeddedKernel *embedded = kernelDirectory ? NULL : embeddedKernel(fileName);
+    if (embedded) {
+        source = embedded->source;
+        return true;
+    }
+    std::string path = kernelDirectory ? std::string(kernelDirectory) + "/" + fileName
+                                       : std::string(fileName);
+    char *loaded = load_program_source(path.c_str());
+    if (!loaded)
+        return false;
+    source = loaded;
+    free(loaded);
+    return true;
+}
+
+void GetProgramBuildStatistics(ProgramBuildStatistics &stats){
+    stats = buildStats;
+}
+
+void PrintProgramBuildStatistics(){
+    if (buildStats.spirv + buildStats.embedded + buildStats.fromDisk == 0)
+        return;
+    printf("Programs: %d from SPIR-V, %d from the binary's source, %d from %s, "
+           "%.2f ms loading source, %.1f ms building (%.1f ms waited on, %.1f ms hidden)\n",
+           buildStats.spirv, buildStats.embedded, buildStats.fromDisk,
+           kernelDirectory ? kernelDirectory : "the working directory",
+           buildStats.loadMilliseconds, buildStats.buildMilliseconds,
+           buildStats.waitMilliseconds,
+           std::max(0.0, buildStats.buildMilliseconds - buildStats.waitMilliseconds));
+}
+
+char *LoadImageData(char *fileName, int &width, int &height)
+{
     FREE_IMAGE_FORMAT format = FreeImage_GetFileType(fileName, 0); 
     FIBITMAP* image = FreeImage_Load(format, fileName);
+    if (!image) {
+        printf("Error loading image %s\n", fileName);
+        return 0;
+    }
     // Convert to 32-bit image 
     FIBITMAP* temp = image; 
     image = FreeImage_ConvertTo32Bits(image); 
     FreeImage_Unload(temp);
     width = FreeImage_GetWidth(image); 
     height = FreeImage_GetHeight(image);
-    char *buffer = new char[width * height * 4]; 
+    char *buffer = AcquireStaging((size_t)width * height * 4);
+    if (!buffer) {
+        FreeImage_Unload(image);
+        return 0;
+    }
     memcpy(buffer, FreeImage_GetBits(image), width * height * 4);
     FreeImage_Unload(image);
+    return buffer;
+}
+
+// Single channel variant of LoadImageData: width * height 8-bit samples,
+// bottom-up like the rest of FreeImage, with no row padding
+unsigned char *LoadGreyImageData(char *fileName, int &width, int &height)
+{
+    FREE_IMAGE_FORMAT format = FreeImage_GetFileType(fileName, 0); 
+    FIBITMAP* image = FreeImage_Load(format, fileName);
+    if (!image) {
+        printf("Error loading image %s\n", fileName);
+        return 0;
+    }
+    FIBITMAP* temp = image; 
+    image = FreeImage_ConvertToGreyscale(image); 
+    FreeImage_Unload(temp);
+    width = FreeImage_GetWidth(image); 
+    height = FreeImage_GetHeight(image);
+    unsigned pitch = FreeImage_GetPitch(image);
+    unsigned char *buffer = (unsigned char *)AcquireStaging((size_t)width * height);
+    if (!buffer) {
+        FreeImage_Unload(image);
+        return 0;
+    }
+    for (int y = 0; y < height; y++)
+        memcpy(buffer + y * width, FreeImage_GetBits(image) + y * pitch, width);
+    FreeImage_Unload(image);
+    return buffer;
+}
+
+cl_mem LoadImage(cl_context context, char *fileName, int &width, int &height)
+{ 
+    StagingBuffer buffer(LoadImageData(fileName, width, height));
+    if (!buffer) {
+        return 0;
+    }
     // Create OpenCL image 
     cl_image_format clImageFormat; 
     clImageFormat.image_channel_order = CL_RGBA; 
     clImageFormat.image_channel_data_type = CL_UNORM_INT8;
     cl_int errNum; 
     cl_mem clImage; 
-    clImage = clCreateImage2D(context,
+    clImage = PoolCreateImage2D(context,
                               CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
                               &clImageFormat, 
                               width,
@@ -293,8 +620,46 @@ cl_mem LoadImage(cl_context context, char *fileName, int &width, int &height)
     return clImage; 
 }
 
-bool SaveImage(char *fileName, char *buffer, int width, int height) {
+// buffer holds width * height 8-bit samples, saved as a greyscale image
+bool SaveGreyImage(char *fileName, unsigned char *buffer, int width, int height) {
     FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(fileName);
+    FIBITMAP *image = FreeImage_ConvertFromRawBits((BYTE*)buffer,
+                                                   width,
+                                                   height,
+                                                   width,
+                                                   8,
+                                                   0,
+                                                   0,
+                                                   0);
+    bool saved = FreeImage_Save(format, image, fileName);
+    FreeImage_Unload(image);
+    return saved;
+}
+
+// outRGBA.png + "_L3" -> outRGBA_L3.png
+std::string AppendToFileName(const char *fileName, const std::string &suffix){
+    std::string name(fileName);
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos)
+        return name + suffix;
+    return name.substr(0, dot) + suffix + name.substr(dot);
+}
+
+cl_channel_order ChannelOrderFor(bool rgba){
+    return rgba && FI_RGBA_RED == 2 ? CL_BGRA : CL_RGBA;
+}
+
+bool SavesRGBA(const char *fileName){
+    return FreeImage_GetFIFFromFilename(fileName) == FIF_PNG;
+}
+
+static bool saveImage(char *fileName, char *buffer, int width, int height, bool rgba) {
+    FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(fileName);
+    // our own encoder, for the compression level, filters and threads; it
+    // takes R,G,B,A only, so a caller that kept FreeImage's order gets
+    // FreeImage's own writer, which ignores those options
+    if (format == FIF_PNG && (rgba || FI_RGBA_RED == 0))
+        return SavePng(fileName, buffer, width, height, GetPngEncodeOptions(), NULL);
     FIBITMAP *image = FreeImage_ConvertFromRawBits((BYTE*)buffer,
                                                    width,
                                                    height,
@@ -303,6 +668,25 @@ bool SaveImage(char *fileName, char *buffer, int width, int height) {
                                                    0xFF000000,
                                                    0x00FF0000,
                                                    0x0000FF00);
-    return FreeImage_Save(format, image, fileName);
+    // only reached when the caller read back RGBA for a format that does
+    // not take it, FreeImage wants its own order
+    if (rgba && FI_RGBA_RED != 0) {
+        for (int y = 0; y < height; y++) {
+            BYTE *row = FreeImage_GetScanLine(image, y);
+            for (int x = 0; x < width; x++)
+                std::swap(row[4 * x], row[4 * x + 2]);
+        }
+    }
+    bool saved = FreeImage_Save(format, image, fileName);
+    FreeImage_Unload(image);
+    return saved;
+}
+
+bool SaveImage(char *fileName, char *buffer, int width, int height) {
+    return saveImage(fileName, buffer, width, height, false);
+}
+
+bool SaveRGBAImage(char *fileName, char *buffer, int width, int height) {
+    return saveImage(fileName, buffer, width, height, true);
 }
 
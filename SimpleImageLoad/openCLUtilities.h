@@ -19,6 +19,7 @@
 
 #include "FreeImage.h"
 #include <sys/stat.h>
+#include <string>
 
 
 #define FATAL(msg)\
@@ -48,8 +49,60 @@ void getGPUUnitSupportedImageFormats(cl_context context);
 cl_bool doesGPUSupportImageObjects(cl_device_id device_id);
 char *load_program_source(const char *filename);
 cl_bool cleanupAndKill();
+// Builds the named kernel file from the copy compiled into the binary
+// (kernelsources.cpp, regenerate it with embed_kernels.sh), or from the
+// working directory for one it was built without. With OpenCL 2.1 headers
+// and devices that report SPIR-V in CL_DEVICE_IL_VERSION, the SPIR-V
+// compile_spirv.sh made is loaded instead, falling back to the source if
+// there is none or it does not build.
+cl_program BuildProgramFromFile(cl_context context, cl_uint numDevices, const cl_device_id *deviceIDs, const char *fileName);
+// BuildProgramFromFile for callers that outlive a bad kernel (the daemon,
+// device calibration): a program that cannot be read or built has its
+// build log printed and NULL is returned instead of ending the process
+cl_program TryBuildProgramFromFile(cl_context context, cl_uint numDevices, const cl_device_id *deviceIDs, const char *fileName);
+// BuildProgramFromFile in two halves: Begin loads and creates the program
+// and returns at once, building it for every device on a thread of its own
+// (clBuildProgram with a completion callback); Finish waits for that
+// callback, reports a failed build as BuildProgramFromFile does, and frees
+// the handle. Work done in between hides the build.
+struct ProgramBuild;
+ProgramBuild *BeginProgramBuild(cl_context context, cl_uint numDevices, const cl_device_id *deviceIDs, const char *fileName);
+cl_program FinishProgramBuild(ProgramBuild *build);
+// The OpenCL C source BuildProgramFromFile builds fileName from, wherever
+// it is taken from; false if there is none
+bool GetKernelSource(const char *fileName, std::string &source);
+// Reads every kernel file from directory instead, for working on kernels
+// without rebuilding. Defaults to $SIMPLE_KERNEL_DIR, NULL for none.
+void SetKernelSourceDirectory(const char *directory);
+
+struct ProgramBuildStatistics {
+    int spirv;                  // programs loaded through clCreateProgramWithIL
+    int embedded;               // built from the binary's copy of the source
+    int fromDisk;
+    double loadMilliseconds;    // finding and reading the source
+    double buildMilliseconds;   // clBuildProgram, start to completion callback
+    double waitMilliseconds;    // of that, spent blocked in FinishProgramBuild
+};
+
+void GetProgramBuildStatistics(ProgramBuildStatistics &stats);
+void PrintProgramBuildStatistics();
+// Both return staging memory, give it back with ReleaseStaging
+char *LoadImageData(char *fileName, int &width, int &height);
+unsigned char *LoadGreyImageData(char *fileName, int &width, int &height);
 cl_mem LoadImage(cl_context context, char *fileName, int &width, int &height);
 bool SaveImage(char *fileName, char *buffer, int width, int height);
+// Host pixels and kernels need not agree on channel order: an image over
+// bytes in R,G,B,A order (rgba) rather than FreeImage's gets the order
+// that has the image unit swap red and blue on every read and write, so
+// kernels still see FreeImage's order and the host never swizzles
+cl_channel_order ChannelOrderFor(bool rgba);
+// Whether fileName's encoder takes R,G,B,A bytes as they are (PNG), making
+// an RGBA read back the cheaper one to save
+bool SavesRGBA(const char *fileName);
+// SaveImage for bytes in R,G,B,A order, still bottom-up
+bool SaveRGBAImage(char *fileName, char *buffer, int width, int height);
+bool SaveGreyImage(char *fileName, unsigned char *buffer, int width, int height);
+std::string AppendToFileName(const char *fileName, const std::string &suffix);
 
 
 
@@ -0,0 +1,329 @@
+//
+//  pngencode.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "FreeImage.h"
+#include "pngencode.h"
+
+// deflate's window, the most of the previous chunk that can help
+#define DEFLATE_WINDOW 32768
+
+static PngEncodeOptions encodeOptions = DEFAULT_PNG_ENCODE_OPTIONS;
+
+static const char *filterNames[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+
+bool ParsePngFilterStrategy(const char *name, PngFilterStrategy &filter){
+    for (int i = 0; i <= PNG_FILTERS_ADAPTIVE; i++) {
+        if (!strcmp(name, filterNames[i])) {
+            filter = (PngFilterStrategy)i;
+            return true;
+        }
+    }
+    std::cerr << "Unknown PNG filter " << name << std::endl;
+    return false;
+}
+
+const char *PngFilterStrategyName(PngFilterStrategy filter){
+    return filterNames[filter];
+}
+
+void SetPngEncodeOptions(const PngEncodeOptions &options){
+    encodeOptions = options;
+}
+
+const PngEncodeOptions &GetPngEncodeOptions(){
+    return encodeOptions;
+}
+
+static double milliseconds(){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+
+static unsigned char paeth(int a, int b, int c){
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return (unsigned char)a;
+    return (unsigned char)(pb <= pc ? b : c);
+}
+
+static void filterRow(int type, const unsigned char *row, const unsigned char *above,
+                      size_t bytes, unsigned char *out){
+    out[0] = (unsigned char)type;
+    out++;
+    for (size_t i = 0; i < bytes; i++) {
+        int left = i >= 4 ? row[i - 4] : 0;
+        int up = above[i];
+        int corner = i >= 4 ? above[i - 4] : 0;
+        int predicted = 0;
+        switch (type) {
+            case PNG_FILTERS_SUB: predicted = left; break;
+            case PNG_FILTERS_UP: predicted = up; break;
+            case PNG_FILTERS_AVERAGE: predicted = (left + up) >> 1; break;
+            case PNG_FILTERS_PAETH: predicted = paeth(left, up, corner); break;
+        }
+        out[i] = (unsigned char)(row[i] - predicted);
+    }
+}
+
+// libpng's heuristic: the filter with the smallest sum of the outputs
+// taken as signed bytes
+static void filterRowAdaptive(const unsigned char *row, const unsigned char *above,
+                              size_t bytes, unsigned char *out, unsigned char *trial){
+    unsigned long best = ~0UL;
+    for (int type = PNG_FILTERS_NONE; type <= PNG_FILTERS_PAETH; type++) {
+        filterRow(type, row, above, bytes, trial);
+        unsigned long sum = 0;
+        for (size_t i = 1; i <= bytes && sum < best; i++)
+            sum += abs((signed char)trial[i]);
+        if (sum < best) {
+            best = sum;
+            memcpy(out, trial, bytes + 1);
+        }
+    }
+}
+
+struct EncodeChunk {
+    int firstRow;
+    int lastRow;
+    std::vector<unsigned char> deflated;
+    uLong adler;
+    size_t filteredBytes;
+    bool ok;
+};
+
+struct EncodeJob {
+    const char *pixels;
+    int width;
+    int height;
+    PngEncodeOptions options;
+    std::vector<EncodeChunk> chunks;
+    size_t nextChunk;
+    pthread_mutex_t lock;
+};
+
+// Row y from the top of the picture, filtered where it lies
+static const unsigned char *pngRow(const EncodeJob &job, int y){
+    return (const unsigned char *)job.pixels + (size_t)(job.height - 1 - y) * job.width * 4;
+}
+
+// Filters the chunk's rows, plus enough rows before it to refill deflate's
+// window with what the previous chunk ended on, and deflates them as a
+// raw stream that stops on a byte boundary so the pieces can be joined
+static void encodeChunk(EncodeJob &job, EncodeChunk &chunk, bool first, bool last){
+    size_t rowBytes = (size_t)job.width * 4;
+    size_t filteredRow = rowBytes + 1;
+    int primeRows = first ? 0 : (int)((DEFLATE_WINDOW + filteredRow - 1) / filteredRow);
+    int startRow = std::max(0, chunk.firstRow - primeRows);
+    primeRows = chunk.firstRow - startRow;
+
+    std::vector<unsigned char> filtered(filteredRow * (chunk.lastRow - startRow));
+    // a row of zeros above the first
+    std::vector<unsigned char> zeros(rowBytes, 0), trial(filteredRow);
+    const unsigned char *above = &zeros[0];
+    if (startRow > 0)
+        above = pngRow(job, startRow - 1);
+    for (int y = startRow; y < chunk.lastRow; y++) {
+        const unsigned char *row = pngRow(job, y);
+        unsigned char *out = &filtered[filteredRow * (y - startRow)];
+        if (job.options.filter == PNG_FILTERS_ADAPTIVE)
+            filterRowAdaptive(row, above, rowBytes, out, &trial[0]);
+        else
+            filterRow(job.options.filter, row, above, rowBytes, out);
+        above = row;
+    }
+
+    const unsigned char *data = &filtered[filteredRow * primeRows];
+    chunk.filteredBytes = filteredRow * (chunk.lastRow - chunk.firstRow);
+    chunk.adler = adler32(adler32(0L, Z_NULL, 0), data, (uInt)chunk.filteredBytes);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int strategy = job.options.filter == PNG_FILTERS_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    chunk.ok = deflateInit2(&stream, job.options.level, Z_DEFLATED, -15, 8, strategy) == Z_OK;
+    if (!chunk.ok)
+        return;
+    if (primeRows > 0 && job.options.level > 0) {
+        size_t primed = std::min((size_t)DEFLATE_WINDOW, filteredRow * primeRows);
+        deflateSetDictionary(&stream, data - primed, (uInt)primed);
+    }
+    // room for the empty stored block a sync flush ends with
+    chunk.deflated.resize(deflateBound(&stream, chunk.filteredBytes) + 16);
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)chunk.filteredBytes;
+    stream.next_out = &chunk.deflated[0];
+    stream.avail_out = (uInt)chunk.deflated.size();
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    chunk.ok = last ? result == Z_STREAM_END : result == Z_OK && stream.avail_in == 0;
+    chunk.deflated.resize(stream.total_out);
+    deflateEnd(&stream);
+}
+
+static void *encodeWorker(void *argument){
+    EncodeJob &job = *(EncodeJob *)argument;
+    for (;;) {
+        pthread_mutex_lock(&job.lock);
+        size_t c = job.nextChunk++;
+        pthread_mutex_unlock(&job.lock);
+        if (c >= job.chunks.size())
+            return NULL;
+        encodeChunk(job, job.chunks[c], c == 0, c == job.chunks.size() - 1);
+    }
+}
+
+static void appendBigEndian(std::vector<unsigned char> &out, uLong value){
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)value);
+}
+
+static void appendChunk(std::vector<unsigned char> &out, const char *type,
+                        const unsigned char *data, size_t length){
+    appendBigEndian(out, (uLong)length);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (length)
+        out.insert(out.end(), data, data + length);
+    appendBigEndian(out, crc32(crc32(0L, Z_NULL, 0), &out[start], (uInt)(length + 4)));
+}
+
+static bool encodePng(const char *pixels, int width, int height,
+                      const PngEncodeOptions &options, std::vector<unsigned char> &png){
+    int threads = options.threads;
+    if (threads <= 0)
+        threads = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    EncodeJob job;
+    job.pixels = pixels;
+    job.width = width;
+    job.height = height;
+    job.options = options;
+    job.nextChunk = 0;
+    // one thread keeps the whole image in one stream, the best ratio
+    size_t filteredRow = (size_t)width * 4 + 1;
+    int chunkRows = threads == 1 ? height
+                                 : std::max(1, (int)(PNG_ENCODE_CHUNK_BYTES / filteredRow));
+    for (int y = 0; y < height; y += chunkRows) {
+        EncodeChunk chunk;
+        chunk.firstRow = y;
+        chunk.lastRow = std::min(height, y + chunkRows);
+        job.chunks.push_back(chunk);
+    }
+
+    threads = std::min(threads, (int)job.chunks.size());
+    pthread_mutex_init(&job.lock, NULL);
+    // a worker that does not start leaves its chunks to the others, this
+    // thread drains the queue regardless
+    std::vector<pthread_t> workers(threads - 1);
+    int started = 0;
+    for (int i = 0; i < threads - 1; i++)
+        if (pthread_create(&workers[started], NULL, encodeWorker, &job) == 0)
+            started++;
+    encodeWorker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+
+    // zlib header (FLEVEL as zlib would set it), the pieces, and the
+    // adler32 of everything combined from the pieces'
+    std::vector<unsigned char> idat;
+    int flevel = options.level < 2 ? 0 : options.level < 6 ? 1 : options.level == 6 ? 2 : 3;
+    unsigned header = 0x7800 | (flevel << 6);
+    header += 31 - header % 31;
+    idat.push_back((unsigned char)(header >> 8));
+    idat.push_back((unsigned char)header);
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (size_t c = 0; c < job.chunks.size(); c++) {
+        EncodeChunk &chunk = job.chunks[c];
+        if (!chunk.ok)
+            return false;
+        idat.insert(idat.end(), chunk.deflated.begin(), chunk.deflated.end());
+        adler = adler32_combine(adler, chunk.adler, (z_off_t)chunk.filteredBytes);
+    }
+    appendBigEndian(idat, adler);
+
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    png.assign(signature, signature + 8);
+    unsigned char ihdr[13];
+    std::vector<unsigned char> fields;
+    appendBigEndian(fields, width);
+    appendBigEndian(fields, height);
+    memcpy(ihdr, &fields[0], 8);
+    ihdr[8] = 8;        // bits per sample
+    ihdr[9] = 6;        // RGBA
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    appendChunk(png, "IHDR", ihdr, sizeof(ihdr));
+    appendChunk(png, "IDAT", &idat[0], idat.size());
+    appendChunk(png, "IEND", NULL, 0);
+    return true;
+}
+
+bool SavePng(const char *fileName, const char *pixels, int width, int height,
+             const PngEncodeOptions &options, size_t *encodedBytes){
+    std::vector<unsigned char> png;
+    if (!encodePng(pixels, width, height, options, png)) {
+        std::cout << "PNG encode of " << fileName << " failed" << std::endl;
+        return false;
+    }
+    FILE *file = fopen(fileName, "wb");
+    if (!file) {
+        std::cout << "Could not open " << fileName << " for writing" << std::endl;
+        return false;
+    }
+    bool written = fwrite(&png[0], 1, png.size(), file) == png.size();
+    written &= fclose(file) == 0;
+    if (encodedBytes)
+        *encodedBytes = png.size();
+    return written;
+}
+
+void PrintPngEncodeReport(const char *fileName, const char *pixels, int width, int height,
+                          bool rgba){
+    static const int levels[] = {0, 1, 3, 6, 9};
+    // the encoder only takes R,G,B,A, so FreeImage's order is converted once
+    // up front and left out of the timings
+    std::vector<char> converted;
+    if (!rgba && FI_RGBA_RED != 0) {
+        converted.assign(pixels, pixels + (size_t)width * height * 4);
+        for (size_t i = 0; i < converted.size(); i += 4)
+            std::swap(converted[i], converted[i + 2]);
+        pixels = &converted[0];
+    }
+    int cores = std::max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    std::cout << "PNG encode report for " << fileName << " (" << width << "x" << height
+    << ", " << (size_t)width * height * 4 << " bytes raw)" << std::endl;
+    std::cout << "level  filter    threads      ms       bytes  ratio" << std::endl;
+    for (int l = 0; l < 5; l++) {
+        for (int f = PNG_FILTERS_NONE; f <= PNG_FILTERS_ADAPTIVE; f++) {
+            for (int t = 1; t <= cores; t = t == 1 && cores > 1 ? cores : cores + 1) {
+                PngEncodeOptions options = { levels[l], (PngFilterStrategy)f, t };
+                std::vector<unsigned char> png;
+                double start = milliseconds();
+                bool ok = encodePng(pixels, width, height, options, png);
+                double elapsed = milliseconds() - start;
+                if (!ok)
+                    continue;
+                char line[128];
+                snprintf(line, sizeof(line), "%5d  %-8s  %7d  %6.1f  %10lu  %5.3f",
+                         levels[l], filterNames[f], t, elapsed, (unsigned long)png.size(),
+                         (double)png.size() / ((double)width * height * 4));
+                std::cout << line << std::endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,49 @@
+//
+//  pngencode.h
+//  Simple
+//
+
+#ifndef Simple_pngencode_h
+#define Simple_pngencode_h
+
+#include <cstddef>
+
+// Filtered bytes each thread deflates at a time when encoding in parallel
+#define PNG_ENCODE_CHUNK_BYTES (256 * 1024)
+
+enum PngFilterStrategy {PNG_FILTERS_NONE, PNG_FILTERS_SUB, PNG_FILTERS_UP,
+    PNG_FILTERS_AVERAGE, PNG_FILTERS_PAETH, PNG_FILTERS_ADAPTIVE};
+
+struct PngEncodeOptions {
+    int level;                  // zlib level, 0 (stored) to 9
+    PngFilterStrategy filter;
+    int threads;                // 1 for one zlib stream, 0 for one per core
+};
+
+// libpng's defaults, what FreeImage_Save gives
+#define DEFAULT_PNG_ENCODE_OPTIONS { 6, PNG_FILTERS_ADAPTIVE, 1 }
+
+bool ParsePngFilterStrategy(const char *name, PngFilterStrategy &filter);
+const char *PngFilterStrategyName(PngFilterStrategy filter);
+
+// What SaveImage uses for .png outputs
+void SetPngEncodeOptions(const PngEncodeOptions &options);
+const PngEncodeOptions &GetPngEncodeOptions();
+
+// Writes 32-bit pixels, bottom-up like FreeImage's, as an 8-bit RGBA PNG.
+// The bytes must already be in R,G,B,A order (read back from a
+// ChannelOrderFor(true) image); they are filtered where they lie.
+// With more than one thread the image is split into chunks of rows that
+// are filtered and deflated in parallel, each primed with the 32K of
+// filtered data before it and ended on a byte boundary, then joined into
+// one zlib stream (the way pigz does it). encodedBytes may be NULL.
+bool SavePng(const char *fileName, const char *pixels, int width, int height,
+             const PngEncodeOptions &options, size_t *encodedBytes);
+
+// Encodes the image across compression levels, filter strategies and
+// thread counts and prints the time and size of each, for picking the
+// options of a batch run. rgba as for SaveRGBAImage.
+void PrintPngEncodeReport(const char *fileName, const char *pixels, int width, int height,
+                          bool rgba);
+
+#endif
@@ -0,0 +1,206 @@
+//
+//  pyramid.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "pyramid.h"
+#include "memorypool.h"
+#include "staging.h"
+
+// Fill in the size and buffer offset of each level, halving (rounding up)
+// until either maxLevels is reached or the image is down to a single pixel.
+// Returns the number of levels actually used.
+int ComputePyramidLevels(int width, int height, int maxLevels, PyramidLevel *levels){
+    size_t offset = 0;
+    int count = 0;
+    while (count < maxLevels) {
+        levels[count].width = width;
+        levels[count].height = height;
+        levels[count].offset = offset;
+        offset += (size_t)width * height;
+        count++;
+        if (width == 1 && height == 1)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    return count;
+}
+
+static std::string levelFileName(const char *outputFile, int level){
+    std::ostringstream suffix;
+    suffix << "_L" << level;
+    return AppendToFileName(outputFile, suffix.str());
+}
+
+// selection is a comma separated list of levels to download, e.g. "0,2,4",
+// or NULL to download them all
+static void parseLevelSelection(const char *selection, int numLevels, bool *wanted){
+    for (int i = 0; i < numLevels; i++)
+        wanted[i] = (selection == NULL);
+    if (selection == NULL)
+        return;
+    const char *p = selection;
+    while (*p) {
+        char *end;
+        long level = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        if (level >= 0 && level < numLevels)
+            wanted[level] = true;
+        else
+            std::cerr << "Ignoring pyramid level " << level << std::endl;
+        p = (*end == ',') ? end + 1 : end;
+    }
+}
+
+bool BuildImagePyramid(cl_context context,
+                       cl_command_queue commands,
+                       cl_program program,
+                       char *inputFile,
+                       char *outputFile,
+                       int numLevels,
+                       const char *selection)
+{
+    cl_int errNum;
+    int width, height;
+    StagingBuffer pixels(LoadImageData(inputFile, width, height));
+    if (!pixels)
+        return false;
+    
+    PyramidLevel *levels = new PyramidLevel[numLevels];
+    numLevels = ComputePyramidLevels(width, height, numLevels, levels);
+    PyramidLevel &last = levels[numLevels - 1];
+    size_t totalPixels = last.offset + (size_t)last.width * last.height;
+    
+    std::cout << "Building a " << numLevels << " level pyramid ("
+    << totalPixels * 4 << " bytes on device)" << std::endl;
+    
+    // one pooled allocation holds the whole mip chain
+    cl_mem pyramid = PoolCreateBuffer(context,
+                                    CL_MEM_READ_WRITE,
+                                    totalPixels * 4,
+                                    NULL,
+                                    &errNum);
+    if(there_was_an_error(errNum)){
+        std::cout << "Pyramid buffer creation error!" << std::endl;
+        delete [] levels;
+        return false;
+    }
+    
+    cl_kernel kernel = clCreateKernel(program, "pyramid_reduce", &errNum);
+    checkErr(errNum, "clCreateKernel(pyramid_reduce)");
+    
+    // Everything from here until clFinish is queued without waiting on the
+    // host: the upload, every reduce step and the selected read backs.
+    errNum = clEnqueueWriteBuffer(commands, pyramid, CL_FALSE, 0,
+                                  (size_t)width * height * 4, pixels,
+                                  0, NULL, NULL);
+    checkErr(errNum, "clEnqueueWriteBuffer(pyramid)");
+    
+    for (int l = 1; l < numLevels; l++) {
+        cl_int srcOffset = (cl_int)levels[l - 1].offset;
+        cl_int dstOffset = (cl_int)levels[l].offset;
+        errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &pyramid);
+        errNum |= clSetKernelArg(kernel, 1, sizeof(cl_int), &srcOffset);
+        errNum |= clSetKernelArg(kernel, 2, sizeof(cl_int), &levels[l - 1].width);
+        errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &levels[l - 1].height);
+        errNum |= clSetKernelArg(kernel, 4, sizeof(cl_int), &dstOffset);
+        errNum |= clSetKernelArg(kernel, 5, sizeof(cl_int), &levels[l].width);
+        errNum |= clSetKernelArg(kernel, 6, sizeof(cl_int), &levels[l].height);
+        checkErr(errNum, "clSetKernelArg(pyramid_reduce)");
+        
+        size_t globalWorkSize[2] = { (size_t)levels[l].width, (size_t)levels[l].height };
+        errNum = clEnqueueNDRangeKernel(commands, kernel, 2, NULL,
+                                        globalWorkSize, NULL,
+                                        0, NULL, NULL);
+        checkErr(errNum, "clEnqueueNDRangeKernel(pyramid_reduce)");
+    }
+    
+    bool *wanted = new bool[numLevels];
+    parseLevelSelection(selection, numLevels, wanted);
+    char **levelPixels = new char*[numLevels];
+    cl_mem *levelImages = new cl_mem[numLevels];
+    // the buffer holds FreeImage's order; for an encoder that takes R,G,B,A
+    // each level goes through an image that swaps it on the device
+    bool rgba = SavesRGBA(outputFile);
+    cl_kernel toImage = 0;
+    if (rgba) {
+        toImage = clCreateKernel(program, "pyramid_level_to_image", &errNum);
+        checkErr(errNum, "clCreateKernel(pyramid_level_to_image)");
+    }
+    cl_image_format format;
+    format.image_channel_order = ChannelOrderFor(rgba);
+    format.image_channel_data_type = CL_UNORM_INT8;
+    // a level that cannot be staged is not written, the rest still are
+    bool saved = true;
+    for (int l = 0; l < numLevels; l++) {
+        levelPixels[l] = NULL;
+        levelImages[l] = 0;
+        if (!wanted[l])
+            continue;
+        size_t bytes = (size_t)levels[l].width * levels[l].height * 4;
+        levelPixels[l] = AcquireStaging(bytes);
+        if (!levelPixels[l]) {
+            saved = false;
+            continue;
+        }
+        if (!rgba) {
+            errNum = clEnqueueReadBuffer(commands, pyramid, CL_FALSE,
+                                         levels[l].offset * 4, bytes, levelPixels[l],
+                                         0, NULL, NULL);
+            checkErr(errNum, "clEnqueueReadBuffer(pyramid)");
+            continue;
+        }
+        
+        levelImages[l] = PoolCreateImage2D(context, CL_MEM_WRITE_ONLY, &format,
+                                           levels[l].width, levels[l].height,
+                                           0, NULL, &errNum);
+        checkErr(errNum, "PoolCreateImage2D(pyramid level)");
+        cl_int offset = (cl_int)levels[l].offset;
+        errNum = clSetKernelArg(toImage, 0, sizeof(cl_mem), &pyramid);
+        errNum |= clSetKernelArg(toImage, 1, sizeof(cl_int), &offset);
+        errNum |= clSetKernelArg(toImage, 2, sizeof(cl_int), &levels[l].width);
+        errNum |= clSetKernelArg(toImage, 3, sizeof(cl_int), &levels[l].height);
+        errNum |= clSetKernelArg(toImage, 4, sizeof(cl_mem), &levelImages[l]);
+        checkErr(errNum, "clSetKernelArg(pyramid_level_to_image)");
+        size_t globalWorkSize[2] = { (size_t)levels[l].width, (size_t)levels[l].height };
+        errNum = clEnqueueNDRangeKernel(commands, toImage, 2, NULL,
+                                        globalWorkSize, NULL, 0, NULL, NULL);
+        checkErr(errNum, "clEnqueueNDRangeKernel(pyramid_level_to_image)");
+        size_t origin[3] = { 0, 0, 0 };
+        size_t region[3] = { (size_t)levels[l].width, (size_t)levels[l].height, 1 };
+        errNum = clEnqueueReadImage(commands, levelImages[l], CL_FALSE, origin, region,
+                                    0, 0, levelPixels[l], 0, NULL, NULL);
+        checkErr(errNum, "clEnqueueReadImage(pyramid level)");
+    }
+    
+    clFinish(commands);
+    for (int l = 0; l < numLevels; l++)
+        if (levelImages[l])
+            PoolReleaseMemObject(levelImages[l]);
+    
+    for (int l = 0; l < numLevels; l++) {
+        if (!levelPixels[l])
+            continue;
+        std::string name = levelFileName(outputFile, l);
+        std::cout << "Level " << l << ": " << levels[l].width << "x"
+        << levels[l].height << " -> " << name << std::endl;
+        saved &= (rgba ? SaveRGBAImage : SaveImage)((char*)name.c_str(), levelPixels[l],
+                                                    levels[l].width, levels[l].height);
+        ReleaseStaging(levelPixels[l]);
+    }
+    
+    delete [] levelImages;
+    delete [] levelPixels;
+    delete [] wanted;
+    delete [] levels;
+    if (toImage)
+        clReleaseKernel(toImage);
+    clReleaseKernel(kernel);
+    PoolReleaseMemObject(pyramid);
+    return saved;
+}
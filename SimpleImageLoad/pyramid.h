@@ -0,0 +1,28 @@
+//
+//  pyramid.h
+//  Simple
+//
+
+#ifndef Simple_pyramid_h
+#define Simple_pyramid_h
+
+#include "openCLUtilities.h"
+
+// A single level of a pyramid, stored at offset (in pixels) inside the
+// pooled pyramid buffer
+struct PyramidLevel {
+    int width;
+    int height;
+    size_t offset;
+};
+
+int ComputePyramidLevels(int width, int height, int maxLevels, PyramidLevel *levels);
+bool BuildImagePyramid(cl_context context,
+                       cl_command_queue commands,
+                       cl_program program,
+                       char *inputFile,
+                       char *outputFile,
+                       int numLevels,
+                       const char *selection);
+
+#endif
@@ -0,0 +1,132 @@
+//
+//  region.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <algorithm>
+#include "region.h"
+#include "memorypool.h"
+
+int ParseRegions(const char *list, ImageRegion *regions, int maxRegions){
+    int count = 0;
+    const char *p = list;
+    while (*p && count < maxRegions) {
+        int w, h, x, y, used;
+        if (sscanf(p, "%dx%d+%d+%d%n", &w, &h, &x, &y, &used) != 4 ||
+            w < 1 || h < 1 || x < 0 || y < 0)
+            return 0;
+        regions[count].x = x;
+        regions[count].y = y;
+        regions[count].width = w;
+        regions[count].height = h;
+        count++;
+        p += used;
+        if (*p == ',')
+            p++;
+    }
+    // more regions than there is room for
+    if (*p)
+        return 0;
+    return count;
+}
+
+int ClipRegions(ImageRegion *regions, int numRegions, int width, int height){
+    int kept = 0;
+    for (int i = 0; i < numRegions; i++) {
+        ImageRegion r = regions[i];
+        r.width = std::min(r.width, width - r.x);
+        r.height = std::min(r.height, height - r.y);
+        if (r.width > 0 && r.height > 0)
+            regions[kept++] = r;
+    }
+    return kept;
+}
+
+// The region grown by halo and clipped to the image, as an origin and
+// region for the device image, whose rows are bottom-up like FreeImage's
+static void deviceRect(const ImageRegion &r, int halo, int width, int height,
+                       size_t origin[3], size_t region[3])
+{
+    int left = std::max(0, r.x - halo);
+    int right = std::min(width, r.x + r.width + halo);
+    int top = std::max(0, r.y - halo);
+    int bottom = std::min(height, r.y + r.height + halo);
+    origin[0] = left;
+    origin[1] = height - bottom;
+    origin[2] = 0;
+    region[0] = right - left;
+    region[1] = bottom - top;
+    region[2] = 1;
+}
+
+static size_t pixelOffset(const size_t origin[3], int width){
+    return (origin[1] * width + origin[0]) * 4;
+}
+
+cl_mem UploadRegions(cl_context context,
+                     cl_command_queue commands,
+                     const char *pixels,
+                     int width, int height,
+                     const ImageRegion *regions, int numRegions,
+                     int halo)
+{
+    cl_image_format format;
+    format.image_channel_order = ChannelOrderFor(false);
+    format.image_channel_data_type = CL_UNORM_INT8;
+    cl_int errNum;
+    cl_mem image = PoolCreateImage2D(context, CL_MEM_READ_ONLY, &format,
+                                     width, height, 0, NULL, &errNum);
+    if (there_was_an_error(errNum)) {
+        printf("Error creating CL image object\n");
+        return NULL;
+    }
+    // pixels stays untouched until FilterRegions reads back, after these
+    // writes on the in order queue
+    for (int i = 0; i < numRegions; i++) {
+        size_t origin[3], region[3];
+        deviceRect(regions[i], halo, width, height, origin, region);
+        errNum = clEnqueueWriteImage(commands, image, CL_FALSE, origin, region,
+                                     (size_t)width * 4, 0,
+                                     pixels + pixelOffset(origin, width), 0, NULL, NULL);
+        if (there_was_an_error(errNum)) {
+            PoolReleaseMemObject(image);
+            return NULL;
+        }
+    }
+    return image;
+}
+
+bool FilterRegions(cl_command_queue commands,
+                   cl_kernel kernel,
+                   cl_mem outputImage,
+                   char *pixels,
+                   int width, int height,
+                   const ImageRegion *regions, int numRegions)
+{
+    cl_int errNum;
+    size_t area = 0;
+    for (int i = 0; i < numRegions; i++) {
+        size_t origin[3], region[3];
+        deviceRect(regions[i], 0, width, height, origin, region);
+        // the kernels index the whole image, so the offset puts the work
+        // items on the region's own pixels
+        errNum = clEnqueueNDRangeKernel(commands, kernel, 2, origin, region,
+                                        NULL, 0, NULL, NULL);
+        if (errNum == CL_SUCCESS)
+            errNum = clEnqueueReadImage(commands, outputImage, CL_FALSE, origin, region,
+                                        (size_t)width * 4, 0,
+                                        pixels + pixelOffset(origin, width), 0, NULL, NULL);
+        if (there_was_an_error(errNum)) {
+            std::cerr << "Error filtering region " << i << std::endl;
+            return false;
+        }
+        area += region[0] * region[1];
+    }
+    errNum = clFinish(commands);
+    if (there_was_an_error(errNum))
+        return false;
+    printf("Filtered %d regions, %.1f%% of the image\n", numRegions,
+           100.0 * area / ((double)width * height));
+    return true;
+}
@@ -0,0 +1,44 @@
+//
+//  region.h
+//  Simple
+//
+
+#ifndef Simple_region_h
+#define Simple_region_h
+
+#include "openCLUtilities.h"
+
+// A rectangle of the image, x and y from its top left corner
+struct ImageRegion {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// "WxH+X+Y[,WxH+X+Y...]", 0 if the list does not parse or holds more than
+// maxRegions
+int ParseRegions(const char *list, ImageRegion *regions, int maxRegions);
+// Clips every region to a width x height image, dropping those left empty;
+// returns how many remain
+int ClipRegions(ImageRegion *regions, int numRegions, int width, int height);
+// A width x height input image with only the regions, and halo pixels
+// around each for the filter taps, written from pixels (LoadImageData's
+// layout); the rest of the image is never uploaded
+cl_mem UploadRegions(cl_context context,
+                     cl_command_queue commands,
+                     const char *pixels,
+                     int width, int height,
+                     const ImageRegion *regions, int numRegions,
+                     int halo);
+// Launches kernel, its arguments already set, over each region alone with
+// a global work offset, and reads each region of outputImage back over
+// pixels, leaving the rest of the original as it was
+bool FilterRegions(cl_command_queue commands,
+                   cl_kernel kernel,
+                   cl_mem outputImage,
+                   char *pixels,
+                   int width, int height,
+                   const ImageRegion *regions, int numRegions);
+
+#endif
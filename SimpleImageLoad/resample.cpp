@@ -0,0 +1,326 @@
+//
+//  resample.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include "resample.h"
+#include "memorypool.h"
+#include "staging.h"
+#include "decode.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+bool ParseResampleFilter(const char *name, ResampleFilter &filter){
+    if (!strcmp(name, "bilinear"))
+        filter = RESAMPLE_BILINEAR;
+    else if (!strcmp(name, "bicubic"))
+        filter = RESAMPLE_BICUBIC;
+    else if (!strcmp(name, "lanczos"))
+        filter = RESAMPLE_LANCZOS3;
+    else
+        return false;
+    return true;
+}
+
+// list is of the form 640x480,320x240,...
+int ParseResampleSizes(const char *list, ResampleSize *sizes, int maxSizes){
+    int count = 0;
+    const char *p = list;
+    while (*p && count < maxSizes) {
+        int w, h, used;
+        if (sscanf(p, "%dx%d%n", &w, &h, &used) != 2 || w < 1 || h < 1)
+            return 0;
+        sizes[count].width = w;
+        sizes[count].height = h;
+        count++;
+        p += used;
+        if (*p == ',')
+            p++;
+    }
+    return count;
+}
+
+static double filterRadius(ResampleFilter filter){
+    switch (filter) {
+        case RESAMPLE_BILINEAR: return 1.0;
+        case RESAMPLE_BICUBIC:  return 2.0;
+        case RESAMPLE_LANCZOS3: return 3.0;
+    }
+    return 1.0;
+}
+
+static double sinc(double x){
+    if (x == 0.0)
+        return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double filterWeight(ResampleFilter filter, double x){
+    x = fabs(x);
+    switch (filter) {
+        case RESAMPLE_BILINEAR:
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case RESAMPLE_BICUBIC:
+            // Keys cubic convolution, a = -0.5
+            if (x < 1.0)
+                return (1.5 * x - 2.5) * x * x + 1.0;
+            if (x < 2.0)
+                return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+            return 0.0;
+        case RESAMPLE_LANCZOS3:
+            return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+    return 0.0;
+}
+
+// Build the weight table for resizing one axis from inSize to outSize
+// samples. When shrinking, the filter is stretched by 1/scale so it also acts
+// as the antialias prefilter. With fuseGaussian the 1 2 1 kernel used by
+// gaussian_filter is convolved into the weights in source space, so blur and
+// resize collapse into a single pass per axis.
+void ComputeResampleWeights(int inSize, int outSize, ResampleFilter filter,
+                            bool fuseGaussian, ResampleWeights &table){
+    double scale = (double)outSize / inSize;
+    double filterScale = scale < 1.0 ? scale : 1.0;
+    double support = filterRadius(filter) / filterScale;
+    int rawTaps = (int)ceil(2.0 * support) + 1;
+    int extra = fuseGaussian ? 1 : 0;
+    
+    table.taps = rawTaps + 2 * extra;
+    table.start = new int[outSize];
+    table.weights = new float[(size_t)outSize * table.taps];
+    double *raw = new double[rawTaps];
+    
+    for (int i = 0; i < outSize; i++) {
+        double center = (i + 0.5) / scale - 0.5;
+        int first = (int)floor(center - support);
+        for (int k = 0; k < rawTaps; k++)
+            raw[k] = filterWeight(filter, (first + k - center) * filterScale);
+        
+        float *w = table.weights + (size_t)i * table.taps;
+        double sum = 0.0;
+        for (int k = 0; k < table.taps; k++) {
+            double value;
+            if (fuseGaussian) {
+                // fused[k] = 0.25 raw[k-2] + 0.5 raw[k-1] + 0.25 raw[k]
+                value = 0.0;
+                if (k - 2 >= 0 && k - 2 < rawTaps) value += 0.25 * raw[k - 2];
+                if (k - 1 >= 0 && k - 1 < rawTaps) value += 0.5 * raw[k - 1];
+                if (k < rawTaps) value += 0.25 * raw[k];
+            } else {
+                value = raw[k];
+            }
+            w[k] = (float)value;
+            sum += value;
+        }
+        for (int k = 0; k < table.taps; k++)
+            w[k] = (float)(w[k] / sum);
+        table.start[i] = first - extra;
+    }
+    delete [] raw;
+}
+
+void ReleaseResampleWeights(ResampleWeights &table){
+    delete [] table.start;
+    delete [] table.weights;
+    table.start = NULL;
+    table.weights = NULL;
+}
+
+static bool uploadWeights(cl_context context, int outSize, ResampleWeights &table,
+                          cl_mem &starts, cl_mem &weights){
+    cl_int errNum;
+    starts = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                            sizeof(cl_int) * outSize, table.start, &errNum);
+    weights = 0;
+    if (there_was_an_error(errNum)) {
+        starts = 0;
+        return false;
+    }
+    weights = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                             sizeof(cl_float) * outSize * table.taps,
+                             table.weights, &errNum);
+    if (there_was_an_error(errNum)) {
+        PoolReleaseMemObject(starts);
+        starts = weights = 0;
+        return false;
+    }
+    return true;
+}
+
+static void releaseBuffer(cl_mem memory){
+    if (memory)
+        PoolReleaseMemObject(memory);
+}
+
+static bool resampleToSize(cl_context context,
+                           cl_command_queue commands,
+                           cl_kernel horizontal,
+                           cl_kernel vertical,
+                           cl_sampler sampler,
+                           cl_mem inputImage,
+                           int width, int height,
+                           const ResampleSize &size,
+                           ResampleFilter filter,
+                           const char *fileName)
+{
+    cl_int errNum;
+    int outWidth = size.width;
+    int outHeight = size.height;
+    
+    ResampleWeights columns, rows;
+    ComputeResampleWeights(width, outWidth, filter, true, columns);
+    ComputeResampleWeights(height, outHeight, filter, true, rows);
+    
+    // everything is released at the end, whichever step failed
+    bool saved = false;
+    cl_mem columnStarts = 0, columnWeights = 0, rowStarts = 0, rowWeights = 0;
+    cl_mem scratch = 0, outputImage = 0;
+    bool rgba = SavesRGBA(fileName);
+    if (!uploadWeights(context, outWidth, columns, columnStarts, columnWeights) ||
+        !uploadWeights(context, outHeight, rows, rowStarts, rowWeights)) {
+        std::cout << "Resample weight table creation error!" << std::endl;
+    } else {
+        // horizontal pass output: outWidth x height
+        scratch = PoolCreateBuffer(context, CL_MEM_READ_WRITE,
+                                   sizeof(cl_float) * 4 * outWidth * height,
+                                   NULL, &errNum);
+        if (there_was_an_error(errNum)) {
+            scratch = 0;
+            std::cout << "Resample scratch buffer creation error!" << std::endl;
+        }
+    }
+    
+    // the output image takes the requested size, not the input's, and is
+    // read back in the order the encoder wants
+    if (scratch) {
+        cl_image_format format;
+        format.image_channel_order = ChannelOrderFor(rgba);
+        format.image_channel_data_type = CL_UNORM_INT8;
+        outputImage = PoolCreateImage2D(context, CL_MEM_WRITE_ONLY, &format,
+                                        outWidth, outHeight, 0, NULL, &errNum);
+        if(there_was_an_error(errNum)){
+            outputImage = 0;
+            std::cout << "Output Image Buffer creation error!" << std::endl;
+        }
+    }
+    
+    if (outputImage) {
+        errNum = clSetKernelArg(horizontal, 0, sizeof(cl_mem), &inputImage);
+        errNum |= clSetKernelArg(horizontal, 1, sizeof(cl_mem), &scratch);
+        errNum |= clSetKernelArg(horizontal, 2, sizeof(cl_sampler), &sampler);
+        errNum |= clSetKernelArg(horizontal, 3, sizeof(cl_mem), &columnStarts);
+        errNum |= clSetKernelArg(horizontal, 4, sizeof(cl_mem), &columnWeights);
+        errNum |= clSetKernelArg(horizontal, 5, sizeof(cl_int), &columns.taps);
+        errNum |= clSetKernelArg(horizontal, 6, sizeof(cl_int), &outWidth);
+        errNum |= clSetKernelArg(horizontal, 7, sizeof(cl_int), &height);
+        checkErr(errNum, "clSetKernelArg(resample_horizontal)");
+    
+        errNum = clSetKernelArg(vertical, 0, sizeof(cl_mem), &scratch);
+        errNum |= clSetKernelArg(vertical, 1, sizeof(cl_mem), &outputImage);
+        errNum |= clSetKernelArg(vertical, 2, sizeof(cl_mem), &rowStarts);
+        errNum |= clSetKernelArg(vertical, 3, sizeof(cl_mem), &rowWeights);
+        errNum |= clSetKernelArg(vertical, 4, sizeof(cl_int), &rows.taps);
+        errNum |= clSetKernelArg(vertical, 5, sizeof(cl_int), &outWidth);
+        errNum |= clSetKernelArg(vertical, 6, sizeof(cl_int), &height);
+        errNum |= clSetKernelArg(vertical, 7, sizeof(cl_int), &outHeight);
+        checkErr(errNum, "clSetKernelArg(resample_vertical)");
+    
+        size_t horizontalWorkSize[2] = { (size_t)outWidth, (size_t)height };
+        errNum = clEnqueueNDRangeKernel(commands, horizontal, 2, NULL,
+                                        horizontalWorkSize, NULL, 0, NULL, NULL);
+        checkErr(errNum, "clEnqueueNDRangeKernel(resample_horizontal)");
+        size_t verticalWorkSize[2] = { (size_t)outWidth, (size_t)outHeight };
+        errNum = clEnqueueNDRangeKernel(commands, vertical, 2, NULL,
+                                        verticalWorkSize, NULL, 0, NULL, NULL);
+        checkErr(errNum, "clEnqueueNDRangeKernel(resample_vertical)");
+    
+        StagingBuffer buffer((size_t)outWidth * outHeight * 4);
+        if (buffer) {
+            size_t origin[3] = { 0, 0, 0 };
+            size_t region[3] = { (size_t)outWidth, (size_t)outHeight, 1 };
+            errNum = clEnqueueReadImage(commands, outputImage, CL_TRUE,
+                                        origin, region, 0, 0, buffer, 0, NULL, NULL);
+            checkErr(errNum, "clEnqueueReadImage(resample)");
+    
+            std::cout << "Resampled " << width << "x" << height << " -> "
+            << outWidth << "x" << outHeight << " (" << columns.taps << "x"
+            << rows.taps << " taps) " << fileName << std::endl;
+            saved = (rgba ? SaveRGBAImage : SaveImage)((char*)fileName, buffer,
+                                                       outWidth, outHeight);
+        }
+    }
+    
+    releaseBuffer(outputImage);
+    releaseBuffer(scratch);
+    releaseBuffer(columnStarts);
+    releaseBuffer(columnWeights);
+    releaseBuffer(rowStarts);
+    releaseBuffer(rowWeights);
+    ReleaseResampleWeights(columns);
+    ReleaseResampleWeights(rows);
+    return saved;
+}
+
+bool ResampleImage(cl_context context,
+                   cl_command_queue commands,
+                   cl_program program,
+                   char *inputFile,
+                   char *outputFile,
+                   const ResampleSize *sizes,
+                   int numSizes,
+                   ResampleFilter filter)
+{
+    cl_int errNum;
+    int width, height;
+    // every output is resampled from the one decode, so it has to cover the
+    // biggest of them
+    int minWidth = 0, minHeight = 0;
+    for (int i = 0; i < numSizes; i++) {
+        minWidth = std::max(minWidth, sizes[i].width);
+        minHeight = std::max(minHeight, sizes[i].height);
+    }
+    cl_mem inputImage = LoadImageStreamed(context, commands, inputFile,
+                                          minWidth, minHeight, width, height);
+    if (!inputImage)
+        return false;
+    
+    cl_sampler sampler = clCreateSampler(context,
+                                         CL_FALSE, // Non-normalized coordinates
+                                         CL_ADDRESS_CLAMP_TO_EDGE,
+                                         CL_FILTER_NEAREST,
+                                         &errNum);
+    checkErr(errNum, "clCreateSampler");
+    
+    cl_kernel horizontal = clCreateKernel(program, "resample_horizontal", &errNum);
+    checkErr(errNum, "clCreateKernel(resample_horizontal)");
+    cl_kernel vertical = clCreateKernel(program, "resample_vertical", &errNum);
+    checkErr(errNum, "clCreateKernel(resample_vertical)");
+    
+    bool saved = true;
+    for (int i = 0; i < numSizes; i++) {
+        // with several sizes each output is tagged with its dimensions
+        std::string name(outputFile);
+        if (numSizes > 1) {
+            std::ostringstream suffix;
+            suffix << "_" << sizes[i].width << "x" << sizes[i].height;
+            name = AppendToFileName(outputFile, suffix.str());
+        }
+        saved &= resampleToSize(context, commands, horizontal, vertical, sampler,
+                                inputImage, width, height, sizes[i], filter,
+                                name.c_str());
+    }
+    
+    clReleaseKernel(horizontal);
+    clReleaseKernel(vertical);
+    clReleaseSampler(sampler);
+    PoolReleaseMemObject(inputImage);
+    return saved;
+}
@@ -0,0 +1,44 @@
+//
+//  resample.h
+//  Simple
+//
+
+#ifndef Simple_resample_h
+#define Simple_resample_h
+
+#include "openCLUtilities.h"
+
+enum ResampleFilter {
+    RESAMPLE_BILINEAR,
+    RESAMPLE_BICUBIC,
+    RESAMPLE_LANCZOS3
+};
+
+// Per output row/column weight table: output sample i reads taps source
+// samples starting at start[i], weighted by weights[i * taps ... ]
+struct ResampleWeights {
+    int taps;
+    int *start;
+    float *weights;
+};
+
+struct ResampleSize {
+    int width;
+    int height;
+};
+
+bool ParseResampleFilter(const char *name, ResampleFilter &filter);
+int ParseResampleSizes(const char *list, ResampleSize *sizes, int maxSizes);
+void ComputeResampleWeights(int inSize, int outSize, ResampleFilter filter,
+                            bool fuseGaussian, ResampleWeights &table);
+void ReleaseResampleWeights(ResampleWeights &table);
+bool ResampleImage(cl_context context,
+                   cl_command_queue commands,
+                   cl_program program,
+                   char *inputFile,
+                   char *outputFile,
+                   const ResampleSize *sizes,
+                   int numSizes,
+                   ResampleFilter filter);
+
+#endif
@@ -0,0 +1,405 @@
+//
+//  resultcache.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "resultcache.h"
+#include "openCLUtilities.h"
+#include "pngencode.h"
+
+#define INDEX_MAGIC 0x3143524c504d4953ULL      // "SIMPLRC1"
+
+enum SlotState {
+    SLOT_EMPTY,
+    SLOT_USED,
+    SLOT_DELETED        // keeps the probe chains through it intact
+};
+
+struct IndexHeader {
+    uint64_t magic;
+    uint64_t slots;
+    uint64_t clock;     // ticks on every hit and store, for the LRU order
+    uint64_t entries;
+    uint64_t deleted;   // slots marked SLOT_DELETED
+    uint64_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+};
+
+struct IndexSlot {
+    uint64_t key[2];
+    uint64_t size;
+    uint64_t lastUsed;
+    uint64_t state;
+};
+
+static std::string cacheDirectory;
+static size_t cacheCapacity = DEFAULT_RESULT_CACHE_CAPACITY;
+static int indexFd = -1;
+static IndexHeader *header = NULL;
+static IndexSlot *slots = NULL;
+
+static size_t indexBytes(){
+    return sizeof(IndexHeader) + (size_t)RESULT_CACHE_SLOTS * sizeof(IndexSlot);
+}
+
+// Processes sharing the directory take turns with the index
+class IndexLock {
+public:
+    IndexLock() { flock(indexFd, LOCK_EX); }
+    ~IndexLock() { flock(indexFd, LOCK_UN); }
+};
+
+bool OpenResultCache(const char *directory, size_t capacity){
+    CloseResultCache();
+    mkdir(directory, 0755);
+    std::string path = std::string(directory) + "/index";
+    indexFd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (indexFd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    IndexLock lock;
+    struct stat info;
+    if (fstat(indexFd, &info) != 0 ||
+        ((size_t)info.st_size < indexBytes() && ftruncate(indexFd, indexBytes()) != 0)) {
+        perror(path.c_str());
+        close(indexFd);
+        indexFd = -1;
+        return false;
+    }
+    void *mapped = mmap(NULL, indexBytes(), PROT_READ | PROT_WRITE, MAP_SHARED, indexFd, 0);
+    if (mapped == MAP_FAILED) {
+        perror(path.c_str());
+        close(indexFd);
+        indexFd = -1;
+        return false;
+    }
+    header = (IndexHeader *)mapped;
+    slots = (IndexSlot *)(header + 1);
+    // a new file is all zeroes, an index of another layout starts over
+    if (header->magic != INDEX_MAGIC || header->slots != RESULT_CACHE_SLOTS) {
+        memset(mapped, 0, indexBytes());
+        header->magic = INDEX_MAGIC;
+        header->slots = RESULT_CACHE_SLOTS;
+    }
+    cacheDirectory = directory;
+    cacheCapacity = capacity;
+    return true;
+}
+
+void CloseResultCache(){
+    if (header)
+        munmap(header, indexBytes());
+    if (indexFd >= 0)
+        close(indexFd);
+    header = NULL;
+    slots = NULL;
+    indexFd = -1;
+}
+
+bool ResultCacheOpen(){
+    return header != NULL;
+}
+
+static inline uint64_t rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix(uint64_t k){
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Two multiply-rotate lanes over 8 byte words, after MurmurHash3's x64
+// body; the tail and the length go in before the final mix
+static void hashBytes(uint64_t hash[2], const void *data, size_t size){
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t h1 = hash[0], h2 = hash[1];
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t k;
+        memcpy(&k, bytes + i * 8, 8);
+        h1 ^= rotl(k * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+        h1 = rotl(h1, 27) + h2;
+        h2 ^= rotl(k * 0x4cf5ad432745937fULL, 33) * 0x87c37b91114253d5ULL;
+        h2 = rotl(h2, 31) + h1;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + words * 8, size % 8);
+    h1 ^= fmix(tail ^ size);
+    h2 ^= fmix(h1 + size);
+    hash[0] = fmix(h1 + h2);
+    hash[1] = fmix(h2 + hash[0]);
+}
+
+static void hashString(uint64_t hash[2], const std::string &text){
+    // the terminator keeps "ab","c" apart from "a","bc"
+    hashBytes(hash, text.c_str(), text.size() + 1);
+}
+
+std::string ResultFilterName(const char *kernelName, int loadTransform, int storeTransform,
+                             int medianRadius, int bilateralRadius,
+                             float sigmaSpatial, float sigmaRange){
+    char name[256];
+    if (bilateralRadius > 0)
+        snprintf(name, sizeof(name), "%s %d %d bilateral %d %g,%g", kernelName,
+                 loadTransform, storeTransform, bilateralRadius, sigmaSpatial, sigmaRange);
+    else if (medianRadius > 0)
+        snprintf(name, sizeof(name), "%s %d %d median %d", kernelName,
+                 loadTransform, storeTransform, medianRadius);
+    else
+        snprintf(name, sizeof(name), "%s %d %d", kernelName, loadTransform, storeTransform);
+    return name;
+}
+
+bool MakeResultKey(const char *inputFile, const std::string &filter,
+                   const char *kernelFile, const char *outputFile, ResultKey &key){
+    std::string source;
+    if (!GetKernelSource(kernelFile, source))
+        return false;
+    int fd = open(inputFile, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    key.hash[0] = key.hash[1] = 0;
+    if (info.st_size > 0) {
+        void *bytes = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (bytes == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        hashBytes(key.hash, bytes, info.st_size);
+        munmap(bytes, info.st_size);
+    }
+    close(fd);
+    const char *extension = strrchr(outputFile, '.');
+    hashString(key.hash, filter);
+    hashString(key.hash, source);
+    hashString(key.hash, extension ? extension : "");
+    // our PNG encoder's settings change the bytes it writes, chunking across
+    // threads included
+    if (FreeImage_GetFIFFromFilename(outputFile) == FIF_PNG) {
+        const PngEncodeOptions &options = GetPngEncodeOptions();
+        char encoder[64];
+        snprintf(encoder, sizeof(encoder), "png %d %d %d",
+                 options.level, (int)options.filter, options.threads);
+        hashString(key.hash, encoder);
+    }
+    return true;
+}
+
+static std::string resultPath(const uint64_t key[2]){
+    char name[40];
+    sprintf(name, "/%016llx%016llx", (unsigned long long)key[0], (unsigned long long)key[1]);
+    return cacheDirectory + name;
+}
+
+// The slot holding key, or with insert the first free one its probe passes
+static IndexSlot *findSlot(const ResultKey &key, bool insert){
+    IndexSlot *free = NULL;
+    for (size_t probe = 0; probe < RESULT_CACHE_SLOTS; probe++) {
+        IndexSlot &slot = slots[(key.hash[0] + probe) % RESULT_CACHE_SLOTS];
+        if (slot.state == SLOT_USED) {
+            if (slot.key[0] == key.hash[0] && slot.key[1] == key.hash[1])
+                return &slot;
+        } else {
+            if (!free)
+                free = &slot;
+            if (slot.state == SLOT_EMPTY)
+                break;
+        }
+    }
+    return insert ? free : NULL;
+}
+
+static void removeSlot(IndexSlot &slot){
+    unlink(resultPath(slot.key).c_str());
+    header->entries--;
+    header->deleted++;
+    header->bytes -= slot.size;
+    slot.state = SLOT_DELETED;
+}
+
+// Reinserts every entry once deleted slots make up an eighth of the index,
+// before they turn every probe for a missing key into a full scan
+static void compactIndex(){
+    if (header->deleted < RESULT_CACHE_SLOTS / 8)
+        return;
+    std::vector<IndexSlot> used;
+    for (size_t i = 0; i < RESULT_CACHE_SLOTS; i++)
+        if (slots[i].state == SLOT_USED)
+            used.push_back(slots[i]);
+    memset(slots, 0, (size_t)RESULT_CACHE_SLOTS * sizeof(IndexSlot));
+    header->deleted = 0;
+    for (size_t i = 0; i < used.size(); i++) {
+        ResultKey key = { { used[i].key[0], used[i].key[1] } };
+        *findSlot(key, true) = used[i];
+    }
+}
+
+// Drops least recently used results until extraBytes more fit
+static void evictFor(uint64_t extraBytes){
+    while (header->entries > 0 &&
+           (header->bytes + extraBytes > cacheCapacity ||
+            header->entries >= RESULT_CACHE_SLOTS * 3 / 4)) {
+        IndexSlot *oldest = NULL;
+        for (size_t i = 0; i < RESULT_CACHE_SLOTS; i++)
+            if (slots[i].state == SLOT_USED && (!oldest || slots[i].lastUsed < oldest->lastUsed))
+                oldest = &slots[i];
+        removeSlot(*oldest);
+        header->evictions++;
+    }
+}
+
+// readFailed tells a bad source from a bad destination
+static bool copyFile(const std::string &from, const char *to, uint64_t &size,
+                     bool &readFailed){
+    readFailed = false;
+    FILE *in = fopen(from.c_str(), "rb");
+    if (!in) {
+        readFailed = true;
+        return false;
+    }
+    FILE *out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+    char chunk[65536];
+    size_t got;
+    bool ok = true;
+    size = 0;
+    while (ok && (got = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        ok = fwrite(chunk, 1, got, out) == got;
+        size += got;
+    }
+    readFailed = ferror(in) != 0;
+    ok = !readFailed && ok;
+    fclose(in);
+    ok = (fclose(out) == 0) && ok;
+    return ok;
+}
+
+bool FetchResult(const ResultKey &key, const char *outputFile){
+    if (!header)
+        return false;
+    IndexLock lock;
+    IndexSlot *slot = findSlot(key, false);
+    uint64_t size = 0;
+    bool readFailed = false;
+    bool copied = slot && copyFile(resultPath(slot->key), outputFile, size, readFailed);
+    if (copied && size == slot->size) {
+        slot->lastUsed = ++header->clock;
+        header->hits++;
+        return true;
+    }
+    // a result file that has gone missing, unreadable or the wrong size is
+    // forgotten; one that could not be written out is still good for the
+    // next caller
+    if (slot && (readFailed || copied))
+        removeSlot(*slot);
+    header->misses++;
+    return false;
+}
+
+void StoreResult(const ResultKey &key, const char *outputFile){
+    if (!header)
+        return;
+    IndexLock lock;
+    struct stat info;
+    if (stat(outputFile, &info) != 0 || (uint64_t)info.st_size > cacheCapacity)
+        return;
+    IndexSlot *slot = findSlot(key, false);
+    if (slot)
+        removeSlot(*slot);
+    evictFor(info.st_size);
+    compactIndex();
+    // copied under a temporary name, so a reader never sees half a result
+    std::string path = resultPath(key.hash);
+    std::string partial = path + ".partial";
+    uint64_t size;
+    bool readFailed;
+    if (!copyFile(outputFile, partial.c_str(), size, readFailed) ||
+        rename(partial.c_str(), path.c_str()) != 0) {
+        unlink(partial.c_str());
+        return;
+    }
+    slot = findSlot(key, true);
+    if (slot->state == SLOT_DELETED)
+        header->deleted--;
+    slot->key[0] = key.hash[0];
+    slot->key[1] = key.hash[1];
+    slot->size = size;
+    slot->lastUsed = ++header->clock;
+    slot->state = SLOT_USED;
+    header->entries++;
+    header->bytes += size;
+    header->stores++;
+}
+
+void GetResultCacheStatistics(ResultCacheStatistics &stats){
+    memset(&stats, 0, sizeof(stats));
+    if (!header)
+        return;
+    stats.hits = header->hits;
+    stats.misses = header->misses;
+    stats.stores = header->stores;
+    stats.evictions = header->evictions;
+    stats.entries = header->entries;
+    stats.bytes = header->bytes;
+    stats.capacity = cacheCapacity;
+}
+
+void PrintResultCacheStatistics(){
+    if (!header)
+        return;
+    ResultCacheStatistics stats;
+    GetResultCacheStatistics(stats);
+    uint64_t lookups = stats.hits + stats.misses;
+    double hitRate = lookups ? (double)stats.hits / lookups : 0.0;
+    printf("Result cache: %llu hits, %llu misses (%.1f%% hit rate), %llu evictions, "
+           "%llu results in %.1f of %.1f MB\n",
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           100.0 * hitRate, (unsigned long long)stats.evictions,
+           (unsigned long long)stats.entries, stats.bytes / 1048576.0,
+           stats.capacity / 1048576.0);
+
+    // Prometheus text format, for a node exporter's textfile collector
+    std::string path = cacheDirectory + "/metrics.prom";
+    std::string partial = path + ".partial";
+    FILE *metrics = fopen(partial.c_str(), "w");
+    if (!metrics)
+        return;
+    fprintf(metrics, "simple_result_cache_hits_total %llu\n", (unsigned long long)stats.hits);
+    fprintf(metrics, "simple_result_cache_misses_total %llu\n", (unsigned long long)stats.misses);
+    fprintf(metrics, "simple_result_cache_stores_total %llu\n", (unsigned long long)stats.stores);
+    fprintf(metrics, "simple_result_cache_evictions_total %llu\n", (unsigned long long)stats.evictions);
+    fprintf(metrics, "simple_result_cache_hit_ratio %.4f\n", hitRate);
+    fprintf(metrics, "simple_result_cache_entries %llu\n", (unsigned long long)stats.entries);
+    fprintf(metrics, "simple_result_cache_bytes %llu\n", (unsigned long long)stats.bytes);
+    fprintf(metrics, "simple_result_cache_capacity_bytes %llu\n", (unsigned long long)stats.capacity);
+    if (fclose(metrics) == 0)
+        rename(partial.c_str(), path.c_str());
+    else
+        unlink(partial.c_str());
+}
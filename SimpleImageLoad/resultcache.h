@@ -0,0 +1,60 @@
+//
+//  resultcache.h
+//  Simple
+//
+
+#ifndef Simple_resultcache_h
+#define Simple_resultcache_h
+
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+
+// Slots in the index; it is kept under three quarters full by eviction
+#define RESULT_CACHE_SLOTS 65536
+#define DEFAULT_RESULT_CACHE_CAPACITY ((size_t)1024 * 1024 * 1024)
+
+// 128 bits over the input file's bytes, the filter and its parameters, the
+// kernel source, the output format and, for PNG, the encoder's options
+struct ResultKey {
+    uint64_t hash[2];
+};
+
+// Counters live in the index, so they add up over every run sharing it
+struct ResultCacheStatistics {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;             // of cached results
+    uint64_t capacity;
+};
+
+// Finished output files, content addressed, under directory: one file per
+// result and a memory mapped index of them, evicting the least recently
+// used past capacity bytes. Without a cache every lookup misses and
+// nothing is stored.
+bool OpenResultCache(const char *directory, size_t capacity);
+void CloseResultCache();
+bool ResultCacheOpen();
+// The filter part of a key, spelled the same from the command line and
+// the daemon so each finds the other's results
+std::string ResultFilterName(const char *kernelName, int loadTransform, int storeTransform,
+                             int medianRadius, int bilateralRadius,
+                             float sigmaSpatial, float sigmaRange);
+// filter names the filter and its parameters; false if the input or the
+// kernel source cannot be read
+bool MakeResultKey(const char *inputFile, const std::string &filter,
+                   const char *kernelFile, const char *outputFile, ResultKey &key);
+// Copies a cached result to outputFile, true on a hit. A result whose file
+// is missing or unreadable is dropped; failing to write outputFile is not
+// held against it.
+bool FetchResult(const ResultKey &key, const char *outputFile);
+// Adds outputFile, just written, as the result for key
+void StoreResult(const ResultKey &key, const char *outputFile);
+void GetResultCacheStatistics(ResultCacheStatistics &stats);
+// Also rewrites the metrics file beside the index
+void PrintResultCacheStatistics();
+
+#endif
@@ -11,20 +11,36 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <cmath>
 
 #include "openCLUtilities.h"
+#include "memorypool.h"
+#include "staging.h"
+#include "decode.h"
+#include "pngencode.h"
+#include "pyramid.h"
+#include "resample.h"
+#include "colour.h"
+#include "statistics.h"
+#include "edge.h"
+#include "denoise.h"
+#include "morphology.h"
+#include "stream.h"
+#include "daemon.h"
+#include "atlas.h"
+#include "volume.h"
+#include "devices.h"
+#include "region.h"
+#include "resultcache.h"
 
 
-// If more than one platform installed then set this to pick which
-// one to use
-#define PLATFORM_INDEX 0
 #define NUM_BUFFER_ELEMENTS 10 
+#define MAX_RESAMPLE_SIZES 16
+#define MAX_REGIONS 64
 
 cl_int errNum;
-cl_uint numPlatforms;
 cl_uint numDevices;
-cl_platform_id * platformIDs;
 cl_device_id * deviceIDs;
 cl_context context;
 cl_program program;
@@ -32,6 +48,8 @@ cl_program program;
 //std::vector<cl_command_queue> queues;
 //std::vector<cl_mem> imageObjects; // device memory used for the input/output array
 cl_mem inputImage, outputImage;
+cl_mem srgbLUT;                     // only used by the colour kernels
+cl_mem filterResources[2];          // scratch and tables of the denoise kernels
 
 cl_sampler sampler;
 cl_kernel kernel;                   // compute kernel
@@ -39,9 +57,60 @@ cl_command_queue commands;          // compute command queue
 int width;
 int height;                  //input and output image specs
 
+char *inputFile = (char*)"rgba.png";
+char *outputFile = (char*)"outRGBA.png";
+int pyramidLevels = 0;              // 0 for a single gaussian_filter pass
+char *pyramidSelection = NULL;      // levels to download, NULL for all
+ResampleSize resampleSizes[MAX_RESAMPLE_SIZES];
+int numResampleSizes = 0;           // 0 to filter at native size
+ResampleFilter resampleFilter = RESAMPLE_LANCZOS3;
+ColourTransform loadTransform = COLOUR_NONE;    // applied to each filter tap
+ColourTransform storeTransform = COLOUR_NONE;   // applied to the filter result
+bool convertOnly = false;           // colour conversion without the blur
+bool computeStatistics = false;     // histogram and moments of the output
+char *histogramFile = NULL;         // optional csv dump of the histogram
+bool detectEdges = false;           // save an edge map instead of the blur
+float edgeLowThreshold = 0.1f;
+float edgeHighThreshold = 0.3f;
+int medianRadius = 0;               // replaces the blur with a median
+int bilateralRadius = 0;            // replaces the blur with a bilateral
+float bilateralSigmaSpatial = 2.0f; // pixels
+float bilateralSigmaRange = 25.0f;  // 8-bit code values
+int morphSize = 0;                  // 0 unless running -morph
+MorphOp morphOp = MORPH_ERODE;
+StreamFormat streamFormat = STREAM_NONE;    // filter stdin to stdout
+FrameStream frameStream;
+char *resultCacheDir = NULL;        // finished outputs kept here by content
+size_t resultCacheCapacity = DEFAULT_RESULT_CACHE_CAPACITY;
+int incrementalTile = 0;            // raw frames redone only in changed tiles this size
+char *daemonSocket = NULL;          // serve jobs instead of one image
+char *loadTestSocket = NULL;        // drive a running daemon
+char *loadTestJobs = NULL;
+int loadTestClients = 8;
+int loadTestJobsPerClient = 100;
+char *atlasList = NULL;             // "input output" lines blurred in atlases
+float volumeSigma = 0.0f;           // 3D Gaussian of a page stack when > 0
+int volumeSlabDepth = 0;            // planes per slab, 0 to fit the device
+PngEncodeOptions pngOptions = DEFAULT_PNG_ENCODE_OPTIONS;
+bool pngReport = false;             // time and size the output's PNG encodings
+char *deviceSelector = NULL;        // NULL picks the best scoring device
+bool listDevices = false;
+ImageRegion regions[MAX_REGIONS];
+int numRegions = 0;                 // 0 to filter the whole image
+
 void cleanKill(int errNumber){
-    clReleaseMemObject(inputImage);
-	clReleaseMemObject(outputImage);
+    PoolReleaseMemObject(inputImage);
+	PoolReleaseMemObject(outputImage);
+    PoolReleaseMemObject(srgbLUT);
+    PoolReleaseMemObject(filterResources[0]);
+    PoolReleaseMemObject(filterResources[1]);
+    PrintMemoryPoolStatistics();
+    PrintStagingStatistics();
+    PrintProgramBuildStatistics();
+    PrintResultCacheStatistics();
+    CloseResultCache();
+    ReleaseDecodeKernels();
+    DrainMemoryPool();
 	clReleaseProgram(program);
     clReleaseSampler(sampler);
 	clReleaseKernel(kernel);
@@ -50,64 +119,289 @@ void cleanKill(int errNumber){
     exit(errNumber);
 }
 
+void usage(char *name){
+    std::cout << "usage: " << name << " [-i input] [-o output]"
+    << " [-pyramid levels [-levels l0,l1,...]]"
+    << " [-resize WxH[,WxH...] [-filter bilinear|bicubic|lanczos]]"
+    << " [-linear] [-load-colour transform] [-store-colour transform]"
+    << " [-convert transform] [-stats] [-histogram file.csv]"
+    << " [-edges [-edge-thresholds low,high]]"
+    << " [-roi WxH+X+Y[,WxH+X+Y...]]"
+    << " [-median radius] [-bilateral radius [-bilateral-sigma spatial,range]]"
+    << " [-morph erode|dilate|open|close|tophat|blackhat size]"
+    << " [-stream y4m|rgba WxH [-incremental tile]] [-volume sigma [-slab planes]]"
+    << " [-pool-cap MB] [-huge-pages]"
+    << " [-png-level 0-9] [-png-filter none|sub|up|average|paeth|adaptive]"
+    << " [-png-threads n] [-png-report] [-kernel-dir dir]"
+    << " [-result-cache dir [-result-cache-cap MB]]"
+    << " [-device auto|p:d|gpu|cpu|accelerator|name]" << std::endl;
+    std::cout << "       " << name << " -list-devices" << std::endl;
+    std::cout << "       " << name << " -atlas list.txt" << std::endl;
+    std::cout << "       " << name << " -daemon socket" << std::endl;
+    std::cout << "       " << name << " -load-test socket jobs.txt [clients [jobs per client]]" << std::endl;
+    std::cout << "colour transforms: none srgb-to-linear linear-to-srgb"
+    << " rgb-to-ycbcr ycbcr-to-rgb rgb-to-gray" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void parseArguments(int argc, char** argv){
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            inputFile = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (!strcmp(argv[i], "-pyramid") && i + 1 < argc) {
+            pyramidLevels = atoi(argv[++i]);
+            if (pyramidLevels < 1)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-levels") && i + 1 < argc) {
+            pyramidSelection = argv[++i];
+        } else if (!strcmp(argv[i], "-resize") && i + 1 < argc) {
+            numResampleSizes = ParseResampleSizes(argv[++i], resampleSizes, MAX_RESAMPLE_SIZES);
+            if (numResampleSizes == 0)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-roi") && i + 1 < argc) {
+            // repeatable, each adds to the regions already given
+            int added = ParseRegions(argv[++i], regions + numRegions,
+                                     MAX_REGIONS - numRegions);
+            if (added == 0) {
+                std::cerr << "Bad -roi " << argv[i] << ": regions are WxH+X+Y, at most "
+                << MAX_REGIONS << " in all" << std::endl;
+                usage(argv[0]);
+            }
+            numRegions += added;
+        } else if (!strcmp(argv[i], "-filter") && i + 1 < argc) {
+            if (!ParseResampleFilter(argv[++i], resampleFilter))
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-linear")) {
+            // blur in linear light
+            loadTransform = COLOUR_SRGB_TO_LINEAR;
+            storeTransform = COLOUR_LINEAR_TO_SRGB;
+        } else if (!strcmp(argv[i], "-load-colour") && i + 1 < argc) {
+            if (!ParseColourTransform(argv[++i], loadTransform))
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-store-colour") && i + 1 < argc) {
+            if (!ParseColourTransform(argv[++i], storeTransform))
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-convert") && i + 1 < argc) {
+            if (!ParseColourTransform(argv[++i], loadTransform))
+                usage(argv[0]);
+            convertOnly = true;
+        } else if (!strcmp(argv[i], "-stats")) {
+            computeStatistics = true;
+        } else if (!strcmp(argv[i], "-histogram") && i + 1 < argc) {
+            histogramFile = argv[++i];
+            computeStatistics = true;
+        } else if (!strcmp(argv[i], "-edges")) {
+            detectEdges = true;
+        } else if (!strcmp(argv[i], "-edge-thresholds") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%f,%f", &edgeLowThreshold, &edgeHighThreshold) != 2)
+                usage(argv[0]);
+            detectEdges = true;
+        } else if (!strcmp(argv[i], "-median") && i + 1 < argc) {
+            medianRadius = atoi(argv[++i]);
+            if (medianRadius < 1 || medianRadius > MAX_MEDIAN_RADIUS)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-bilateral") && i + 1 < argc) {
+            bilateralRadius = atoi(argv[++i]);
+            if (bilateralRadius < 1 || bilateralRadius > MAX_BILATERAL_RADIUS)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-bilateral-sigma") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%f,%f", &bilateralSigmaSpatial, &bilateralSigmaRange) != 2)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-morph") && i + 2 < argc) {
+            if (!ParseMorphOp(argv[++i], morphOp))
+                usage(argv[0]);
+            morphSize = atoi(argv[++i]);
+            if (morphSize < 1)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-volume") && i + 1 < argc) {
+            volumeSigma = (float)atof(argv[++i]);
+            if (volumeSigma <= 0)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-slab") && i + 1 < argc) {
+            volumeSlabDepth = atoi(argv[++i]);
+            if (volumeSlabDepth < 1)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-pool-cap") && i + 1 < argc) {
+            // device memory kept for reuse, 0 frees everything on release
+            int megabytes = atoi(argv[++i]);
+            if (megabytes < 0)
+                usage(argv[0]);
+            SetMemoryPoolCapacity((size_t)megabytes * 1024 * 1024);
+        } else if (!strcmp(argv[i], "-png-level") && i + 1 < argc) {
+            pngOptions.level = atoi(argv[++i]);
+            if (pngOptions.level < 0 || pngOptions.level > 9)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-png-filter") && i + 1 < argc) {
+            if (!ParsePngFilterStrategy(argv[++i], pngOptions.filter))
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-png-threads") && i + 1 < argc) {
+            // 0 for one per core
+            pngOptions.threads = atoi(argv[++i]);
+            if (pngOptions.threads < 0)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-png-report")) {
+            pngReport = true;
+        } else if (!strcmp(argv[i], "-huge-pages")) {
+            SetStagingHugePages(true);
+        } else if (!strcmp(argv[i], "-device") && i + 1 < argc) {
+            // platform:device, gpu, cpu, accelerator or part of a name
+            deviceSelector = argv[++i];
+        } else if (!strcmp(argv[i], "-list-devices")) {
+            listDevices = true;
+        } else if (!strcmp(argv[i], "-kernel-dir") && i + 1 < argc) {
+            // kernels read from here rather than the copies built in
+            SetKernelSourceDirectory(argv[++i]);
+        } else if (!strcmp(argv[i], "-result-cache") && i + 1 < argc) {
+            resultCacheDir = argv[++i];
+        } else if (!strcmp(argv[i], "-result-cache-cap") && i + 1 < argc) {
+            int megabytes = atoi(argv[++i]);
+            if (megabytes < 1)
+                usage(argv[0]);
+            resultCacheCapacity = (size_t)megabytes * 1024 * 1024;
+        } else if (!strcmp(argv[i], "-atlas") && i + 1 < argc) {
+            atlasList = argv[++i];
+        } else if (!strcmp(argv[i], "-daemon") && i + 1 < argc) {
+            daemonSocket = argv[++i];
+        } else if (!strcmp(argv[i], "-load-test") && i + 2 < argc) {
+            loadTestSocket = argv[++i];
+            loadTestJobs = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                loadTestClients = atoi(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                loadTestJobsPerClient = atoi(argv[++i]);
+            if (loadTestClients < 1 || loadTestJobsPerClient < 1)
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-stream") && i + 1 < argc) {
+            if (!ParseStreamFormat(argv[++i], streamFormat))
+                usage(argv[0]);
+            // raw frames carry no header, so the size has to come from us
+            if (streamFormat == STREAM_RAW_RGBA &&
+                (i + 1 >= argc || sscanf(argv[++i], "%dx%d", &width, &height) != 2))
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "-incremental") && i + 1 < argc) {
+            incrementalTile = atoi(argv[++i]);
+            if (incrementalTile < 1)
+                usage(argv[0]);
+        } else {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            usage(argv[0]);
+        }
+    }
+    // streaming only drives the per pixel filters
+    if (streamFormat != STREAM_NONE &&
+        (pyramidLevels > 0 || numResampleSizes > 0 || morphSize > 0 ||
+         computeStatistics || detectEdges)) {
+        std::cerr << "-stream cannot be combined with -pyramid, -resize, -morph,"
+        << " -stats or -edges" << std::endl;
+        usage(argv[0]);
+    }
+    // tiles are hashed in RGBA, and a tile's neighbours must cover the
+    // filter's reach
+    if (incrementalTile > 0 &&
+        (streamFormat != STREAM_RAW_RGBA || medianRadius > 0 ||
+         incrementalTile < bilateralRadius)) {
+        std::cerr << "-incremental needs -stream rgba, no -median and tiles"
+        << " no smaller than the -bilateral radius" << std::endl;
+        usage(argv[0]);
+    }
+    // regions only drive the per pixel filters over a single image
+    if (numRegions > 0 &&
+        (streamFormat != STREAM_NONE || pyramidLevels > 0 || numResampleSizes > 0 ||
+         morphSize > 0 || volumeSigma > 0 || atlasList || daemonSocket ||
+         medianRadius > 0 || computeStatistics || detectEdges)) {
+        std::cerr << "-roi cannot be combined with -stream, -pyramid, -resize, -morph,"
+        << " -volume, -atlas, -daemon, -median, -stats or -edges" << std::endl;
+        usage(argv[0]);
+    }
+}
+
 // main() for simple buffer and sub-buffer example
 //
 int main(int argc, char** argv)
 {
     
+    parseArguments(argc, argv);
+    SetPngEncodeOptions(pngOptions);
+    
+    if (listDevices) {
+        PrintDeviceCapabilities();
+        exit(EXIT_SUCCESS);
+    }
+    
+    // the load test is only a client, it needs no OpenCL of its own
+    if (loadTestSocket) {
+        bool passed = RunLoadTest(loadTestSocket, loadTestJobs,
+                                  loadTestClients, loadTestJobsPerClient);
+        exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    // before anything is printed, stdout belongs to the frames from here on
+    if (streamFormat != STREAM_NONE &&
+        !OpenFrameStream(frameStream, streamFormat, width, height)) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Colour conversions swap in the colour.cl variants, which take the
+    // same first five arguments as gaussian_filter
+    bool colourKernel = convertOnly ||
+        loadTransform != COLOUR_NONE || storeTransform != COLOUR_NONE;
+    const char *kernelName = "gaussian_filter";
+    if (convertOnly)
+        kernelName = "colour_convert";
+    else if (colourKernel)
+        kernelName = "gaussian_filter_colour";
+    
+    const char *kernelFile = colourKernel ? "colour.cl" : "gaussian_filter.cl";
+    if (medianRadius > 0 || bilateralRadius > 0) {
+        if (colourKernel || (medianRadius > 0 && bilateralRadius > 0)) {
+            std::cerr << "Pick one of -median, -bilateral and the colour transforms" << std::endl;
+            cleanKill(EXIT_FAILURE);
+        }
+        kernelFile = "edge_preserving.cl";
+        kernelName = medianRadius > 0 ? MedianKernelName(medianRadius) : "bilateral_filter";
+    }
+    
+    // a result already made from the same bytes with the same filter is
+    // copied out, without a device, a decode or an encode
+    bool cacheResult = resultCacheDir && !daemonSocket && !atlasList && volumeSigma <= 0 &&
+        pyramidLevels == 0 && numResampleSizes == 0 && morphSize == 0 &&
+        streamFormat == STREAM_NONE && numRegions == 0 &&
+        !computeStatistics && !detectEdges && !pngReport;
+    ResultKey resultKey;
+    if (resultCacheDir && !OpenResultCache(resultCacheDir, resultCacheCapacity))
+        exit(EXIT_FAILURE);
+    if (cacheResult) {
+        std::string filter = ResultFilterName(kernelName, loadTransform, storeTransform,
+                                              medianRadius, bilateralRadius,
+                                              bilateralSigmaSpatial, bilateralSigmaRange);
+        cacheResult = MakeResultKey(inputFile, filter, kernelFile, outputFile, resultKey);
+        if (cacheResult && FetchResult(resultKey, outputFile)) {
+            std::cout << outputFile << " came from the result cache" << std::endl;
+            cleanKill(EXIT_SUCCESS);
+        }
+    }
+    
     std::cout << "Simple Image Processing Example" << std::endl;
     
     
-    // First, select an OpenCL platform to run on.
-    errNum = clGetPlatformIDs(0, NULL, &numPlatforms);
-    checkErr(
-             (errNum != CL_SUCCESS) ?
-             errNum : (numPlatforms <= 0 ? -1 : CL_SUCCESS),
-             "clGetPlatformIDs");
-    platformIDs = (cl_platform_id *)alloca(sizeof(cl_platform_id) * numPlatforms);
-    std::cout << "Number of platforms: \t" << numPlatforms << std::endl;
-    errNum = clGetPlatformIDs(numPlatforms, platformIDs, NULL);
-    checkErr(
-             (errNum != CL_SUCCESS) ?
-             errNum : (numPlatforms <= 0 ? -1 : CL_SUCCESS),
-             "clGetPlatformIDs");
-    std::ifstream srcFile("gaussian_filter.cl");
-    
-    checkErr(srcFile.is_open() ? CL_SUCCESS : -1, "reading simple.cl");
-    
-    std::string srcProg(
-                        std::istreambuf_iterator<char>(srcFile),
-                        (std::istreambuf_iterator<char>()));
-    const char * src = srcProg.c_str();
-    size_t length = srcProg.length();
-    deviceIDs = NULL;
+    // First, pick the platform and device to run on
+    DeviceCapabilities device;
+    if (!SelectDevice(deviceSelector, device))
+        exit(EXIT_FAILURE);
+    numDevices = 1;
+    deviceIDs = (cl_device_id *)alloca(sizeof(cl_device_id));
+    deviceIDs[0] = device.device;
     DisplayPlatformInfo(
-                        platformIDs[PLATFORM_INDEX],
+                        device.platform,
                         CL_PLATFORM_VENDOR,
                         "CL_PLATFORM_VENDOR");
-    errNum = clGetDeviceIDs(
-                            platformIDs[PLATFORM_INDEX],
-                            CL_DEVICE_TYPE_ALL,
-                            0,
-                            NULL,
-                            &numDevices);
-    if (errNum != CL_SUCCESS && errNum != CL_DEVICE_NOT_FOUND){
-        checkErr(errNum, "clGetDeviceIDs");
-    }
-    
-    deviceIDs = (cl_device_id *)alloca(sizeof(cl_device_id) * numDevices);
-    errNum = clGetDeviceIDs(
-                            platformIDs[PLATFORM_INDEX],
-                            CL_DEVICE_TYPE_ALL,
-                            numDevices,
-                            &deviceIDs[0],
-                            NULL);
-    checkErr(errNum, "clGetDeviceIDs");
     
     cl_context_properties contextProperties[] =
     {
         CL_CONTEXT_PLATFORM,
-        (cl_context_properties)platformIDs[PLATFORM_INDEX],
+        (cl_context_properties)device.platform,
         0
     };
     
@@ -120,38 +414,6 @@ int main(int argc, char** argv)
                               &errNum);
     
     checkErr(errNum, "clCreateContext");
-    // Create program from source
-    program = clCreateProgramWithSource(
-                                        context,
-                                        1,
-                                        &src,
-                                        &length,
-                                        &errNum);
-    checkErr(errNum, "clCreateProgramWithSource");
-    
-    // Build program
-    errNum = clBuildProgram(
-                            program,
-                            numDevices,
-                            deviceIDs,
-                            "-I.",
-                            NULL,
-                            NULL);
-
-    if (errNum != CL_SUCCESS){
-        // Determine the reason for the error
-        char buildLog[16384];
-        clGetProgramBuildInfo(
-                              program,
-                              deviceIDs[0],
-                              CL_PROGRAM_BUILD_LOG,
-                              sizeof(buildLog),
-                              buildLog,
-                              NULL);
-        std::cerr << "Error in OpenCL C source: " << std::endl;
-        std::cerr << buildLog;
-        checkErr(errNum, "clBuildProgram");
-    }
     
     // Create a command commands
 	//
@@ -160,39 +422,128 @@ int main(int argc, char** argv)
         cleanKill(EXIT_FAILURE);
     }
     
-    cl_kernel kernel = clCreateKernel(program, "gaussian_filter", &errNum);
-    checkErr(errNum, "clCreateKernel(gaussian_filter)");
-
-    if(!doesGPUSupportImageObjects){
-        cleanKill(EXIT_FAILURE);
+    if (daemonSocket){
+        // context, queue and (lazily) programs live as long as the daemon
+        bool served = RunDaemon(context, numDevices, deviceIDs, commands, daemonSocket);
+        cleanKill(served ? EXIT_SUCCESS : EXIT_FAILURE);
     }
     
-    inputImage = LoadImage(context, (char*)"rgba.png", width, height);
-        
-    cl_image_format format; 
-    format.image_channel_order = CL_RGBA; 
-    format.image_channel_data_type = CL_UNORM_INT8;
-    
-    outputImage = clCreateImage2D(context, 
-                             CL_MEM_WRITE_ONLY, 
-                             &format, 
-                             width, 
-                             height,
-                             0, 
-                             NULL, 
-                             &errNum);
+    if (atlasList){
+        program = BuildProgramFromFile(context, numDevices, deviceIDs, "gaussian_filter.cl");
+        bool blurred = RunAtlasBatch(context, deviceIDs[0], commands, program, atlasList);
+        cleanKill(blurred ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
     
-    if(there_was_an_error(errNum)){
-        std::cout << "Output Image Buffer creation error!" << std::endl;
-        cleanKill(EXIT_FAILURE);
-    }    
+    if (volumeSigma > 0){
+        program = BuildProgramFromFile(context, numDevices, deviceIDs, "volume.cl");
+        bool filtered = RunVolumeGaussian(context, deviceIDs[0], commands, program,
+                                          inputFile, outputFile,
+                                          volumeSigma, volumeSlabDepth);
+        cleanKill(filtered ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    if (pyramidLevels > 0){
+        program = BuildProgramFromFile(context, numDevices, deviceIDs, "pyramid.cl");
+        bool built = BuildImagePyramid(context, commands, program,
+                                       inputFile, outputFile,
+                                       pyramidLevels, pyramidSelection);
+        cleanKill(built ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
     
-	if (!inputImage || !outputImage ){
-        std::cout << "Failed to allocate device memory!" << std::endl;
+    if (numResampleSizes > 0){
+        program = BuildProgramFromFile(context, numDevices, deviceIDs, "resample.cl");
+        bool resampled = ResampleImage(context, commands, program,
+                                       inputFile, outputFile,
+                                       resampleSizes, numResampleSizes,
+                                       resampleFilter);
+        cleanKill(resampled ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    if (morphSize > 0){
+        program = BuildProgramFromFile(context, numDevices, deviceIDs, "morphology.cl");
+        bool morphed = RunMorphology(context, commands, program,
+                                     inputFile, outputFile, morphOp, morphSize);
+        cleanKill(morphed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    if(!doesGPUSupportImageObjects){
         cleanKill(EXIT_FAILURE);
-	}
+    }
     
-    char *buffer = new char [width * height * 4];
+    // a stream keeps its own set of images for the frames in flight
+    bool streaming = streamFormat != STREAM_NONE;
+    
+    // Start building every program this run needs, they build while the
+    // input is decoded and uploaded and are only waited on when first used
+    ProgramBuild *filterBuild = BeginProgramBuild(context, numDevices, deviceIDs, kernelFile);
+    ProgramBuild *streamBuild = NULL;
+    ProgramBuild *statisticsBuild = NULL;
+    ProgramBuild *edgeBuild = NULL;
+    if (streaming && incrementalTile == 0)
+        streamBuild = BeginProgramBuild(context, numDevices, deviceIDs, "stream.cl");
+    if (computeStatistics)
+        statisticsBuild = BeginProgramBuild(context, numDevices, deviceIDs, "statistics.cl");
+    if (detectEdges)
+        edgeBuild = BeginProgramBuild(context, numDevices, deviceIDs, "edge_detect.cl");
+    
+    // regions are read back over the original pixels, in FreeImage's order
+    bool rgbaOutput = !detectEdges && numRegions == 0 && SavesRGBA(outputFile);
+    StagingBuffer original;
+    if (streaming) {
+        width = frameStream.width;
+        height = frameStream.height;
+    } else {
+        if (numRegions > 0) {
+            original.reset(LoadImageData(inputFile, width, height));
+            if (!original)
+                cleanKill(EXIT_FAILURE);
+            numRegions = ClipRegions(regions, numRegions, width, height);
+            if (numRegions == 0) {
+                std::cerr << "No -roi region lies inside " << inputFile << std::endl;
+                cleanKill(EXIT_FAILURE);
+            }
+            // the filter reads this far past each region's edge
+            int halo = bilateralRadius > 0 ? bilateralRadius : 1;
+            inputImage = UploadRegions(context, commands, original, width, height,
+                                       regions, numRegions, halo);
+        } else {
+            inputImage = LoadImageStreamed(context, commands, inputFile, 0, 0, width, height);
+        }
+        
+        // a PNG result is read back in the byte order the encoder wants, the
+        // image swaps the channels on the way out
+        cl_image_format format; 
+        format.image_channel_order = ChannelOrderFor(rgbaOutput); 
+        format.image_channel_data_type = CL_UNORM_INT8;
+        
+        // read/write so follow on kernels (statistics) can use it in place
+        outputImage = PoolCreateImage2D(context, 
+                                 CL_MEM_READ_WRITE, 
+                                 &format, 
+                                 width, 
+                                 height,
+                                 0, 
+                                 NULL, 
+                                 &errNum);
+        
+        if(there_was_an_error(errNum)){
+            std::cout << "Output Image Buffer creation error!" << std::endl;
+            cleanKill(EXIT_FAILURE);
+        }    
+        
+        if (!inputImage || !outputImage ){
+            std::cout << "Failed to allocate device memory!" << std::endl;
+            cleanKill(EXIT_FAILURE);
+        }
+    }
+    
+    // regions come back into the original instead
+    StagingBuffer buffer;
+    if (numRegions == 0) {
+        buffer.reset(AcquireStaging((size_t)width * height * 4));
+        if (!buffer)
+            cleanKill(EXIT_FAILURE);
+    }
     size_t origin[3] = { 0, 0, 0 };
     size_t region[3] = { width, height, 1};
 
@@ -207,12 +558,38 @@ int main(int argc, char** argv)
         cleanKill(EXIT_FAILURE);
     }
     
-    // Set the kernel arguments
-    errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputImage);
-    errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &outputImage);
+    program = FinishProgramBuild(filterBuild);
+    kernel = clCreateKernel(program, kernelName, &errNum);
+    checkErr(errNum, kernelName);
+    
+    // Set the kernel arguments, a stream sets the images per frame
+    errNum = CL_SUCCESS;
+    if (!streaming) {
+        errNum |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputImage);
+        errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &outputImage);
+    }
     errNum |= clSetKernelArg(kernel, 2, sizeof(cl_sampler), &sampler);
     errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &width);
     errNum |= clSetKernelArg(kernel, 4, sizeof(cl_int), &height);
+    if (colourKernel) {
+        srgbLUT = CreateSrgbLUT(context);
+        if (!srgbLUT)
+            cleanKill(EXIT_FAILURE);
+        errNum |= SetColourKernelArgs(kernel, 5, srgbLUT, loadTransform, storeTransform);
+    }
+    
+    size_t globalWorkSize[2] = { (size_t)width, (size_t)height };
+    if (medianRadius > 0 &&
+        !PrepareMedianFilter(context, deviceIDs[0], kernel, medianRadius,
+                             width, height, filterResources[0], globalWorkSize)) {
+        cleanKill(EXIT_FAILURE);
+    }
+    if (bilateralRadius > 0 &&
+        !PrepareBilateralFilter(context, kernel, bilateralRadius,
+                                bilateralSigmaSpatial, bilateralSigmaRange,
+                                filterResources[0], filterResources[1])) {
+        cleanKill(EXIT_FAILURE);
+    }
     if (errNum != CL_SUCCESS)
     {
         std::cerr << "Error setting kernel arguments." << std::endl;
@@ -220,6 +597,21 @@ int main(int argc, char** argv)
         cleanKill(EXIT_FAILURE);
     }
     
+    if (streaming && incrementalTile > 0) {
+        // the filter's reach past a tile, as for -roi
+        int halo = bilateralRadius > 0 ? bilateralRadius : 1;
+        bool streamed = RunIncrementalStream(context, commands, kernel, halo,
+                                             incrementalTile, frameStream);
+        cleanKill(streamed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (streaming) {
+        cl_program streamProgram = FinishProgramBuild(streamBuild);
+        bool streamed = RunFrameStream(context, commands, streamProgram,
+                                       kernel, globalWorkSize, frameStream);
+        clReleaseProgram(streamProgram);
+        cleanKill(streamed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
     //errNum = clGetKernelWorkGroupInfo(kernel, deviceIDs, CL_KERNEL_WORK_GROUP_SIZE, sizeof(unsigned short)* height*width*4, &local, NULL);
     
 //	if (errNum != CL_SUCCESS)
@@ -237,14 +629,8 @@ int main(int argc, char** argv)
     std::cout << "Max work group size is " << CL_DEVICE_MAX_WORK_GROUP_SIZE << std::endl;
     std::cout << "Max work item size is " << CL_DEVICE_MAX_WORK_ITEM_SIZES << std::endl;
     
-    size_t localWorkSize[2];
-    size_t globalWorkSize[2];
-    
-    localWorkSize[0] = 1;
-    localWorkSize[1] = localWorkSize[0];
-    globalWorkSize[0] = width*height;
-    globalWorkSize[1] = globalWorkSize[0];
-    
+    // one work item per output pixel (or per median strip), leaving the
+    // work-group size to the implementation
     //CL_INVALID_WORK_GROUP_SIZE if local_work_size is specified and number of work-items specified by global_work_size is not evenly divisable by size of work-group given by local_work_size
     
     
@@ -254,9 +640,31 @@ int main(int argc, char** argv)
 //    size_t globalWorkSize[1] = {sizeof(unsigned short)* height * width};
 //	size_t localWorkSize[1] = {64};
     
+    if (numRegions > 0) {
+        if (!FilterRegions(commands, kernel, outputImage, original, width, height,
+                           regions, numRegions))
+            cleanKill(EXIT_FAILURE);
+        // most of the image never went to the device, so a PNG's red and blue
+        // are swapped here, once, for the encoder and its options
+        bool rgba = SavesRGBA(outputFile);
+        if (rgba && FI_RGBA_RED != 0) {
+            for (size_t i = 0; i < (size_t)width * height * 4; i += 4)
+                std::swap(original[i], original[i + 2]);
+        }
+        if (!(rgba ? SaveRGBAImage : SaveImage)(outputFile, original, width, height)) {
+            std::cerr << "Failed to write " << outputFile << std::endl;
+            cleanKill(EXIT_FAILURE);
+        }
+        if (pngReport)
+            PrintPngEncodeReport(outputFile, original, width, height, rgba);
+        std::cout << "Program completed successfully" << std::endl;
+        original.reset();
+        cleanKill(EXIT_SUCCESS);
+    }
+    
     // Queue the kernel up for execution
     errNum = clEnqueueNDRangeKernel(commands, kernel, 2, NULL,
-                                    globalWorkSize, localWorkSize,
+                                    globalWorkSize, NULL,
                                     0, NULL, NULL);
     
     if (errNum != CL_SUCCESS){
@@ -265,17 +673,65 @@ int main(int argc, char** argv)
         cleanKill(EXIT_FAILURE);
     }
     
-    // Wait for the command commands to get serviced before reading back results
-	//
-	clFinish(commands);
-    
-    // Read back computed data
-    errNum = clEnqueueReadImage(commands, outputImage,
-                                     CL_TRUE, origin, region, 0, 0, buffer, 0, NULL, NULL);
+    if (computeStatistics) {
+        // runs on the filtered image while it is still on the device, only
+        // the histogram is read back
+        cl_program statisticsProgram = FinishProgramBuild(statisticsBuild);
+        ImageStatistics stats;
+        if (!ComputeImageStatistics(context, commands, deviceIDs[0],
+                                    statisticsProgram, outputImage, sampler,
+                                    width, height, stats)) {
+            cleanKill(EXIT_FAILURE);
+        }
+        std::cout << "Output image statistics:" << std::endl;
+        PrintImageStatistics(stats);
+        if (histogramFile && !SaveHistogram(histogramFile, stats))
+            std::cerr << "Failed to write " << histogramFile << std::endl;
+        clReleaseProgram(statisticsProgram);
+    }
     
-    SaveImage((char*)"outRGBA.png", (char*)buffer, width, height);
+    if (detectEdges) {
+        // the blurred image stays on the device, only the edge map comes back
+        cl_program edgeProgram = FinishProgramBuild(edgeBuild);
+        StagingBuffer edgeMap((size_t)width * height);
+        if (!edgeMap)
+            cleanKill(EXIT_FAILURE);
+        bool detected = DetectEdges(context, commands, edgeProgram, outputImage, sampler,
+                                    width, height, edgeLowThreshold, edgeHighThreshold,
+                                    (unsigned char *)edgeMap.get());
+        clReleaseProgram(edgeProgram);
+        if (!detected)
+            cleanKill(EXIT_FAILURE);
+        if (!SaveGreyImage(outputFile, (unsigned char *)edgeMap.get(), width, height)) {
+            std::cerr << "Failed to write " << outputFile << std::endl;
+            cleanKill(EXIT_FAILURE);
+        }
+    } else {
+        // Wait for the command commands to get serviced before reading back results
+        //
+        clFinish(commands);
+        
+        // Read back computed data
+        errNum = clEnqueueReadImage(commands, outputImage,
+                                    CL_TRUE, origin, region, 0, 0, buffer, 0, NULL, NULL);
+        
+        bool saved;
+        if (rgbaOutput)
+            saved = SaveRGBAImage(outputFile, buffer, width, height);
+        else
+            saved = SaveImage(outputFile, buffer, width, height);
+        if (!saved) {
+            std::cerr << "Failed to write " << outputFile << std::endl;
+            cleanKill(EXIT_FAILURE);
+        }
+        if (cacheResult)
+            StoreResult(resultKey, outputFile);
+        if (pngReport)
+            PrintPngEncodeReport(outputFile, buffer, width, height, rgbaOutput);
+    }
 
     std::cout << "Program completed successfully" << std::endl;        
-    return 0;     
+    buffer.reset();
+    cleanKill(EXIT_SUCCESS);
 }
             
\ No newline at end of file
@@ -0,0 +1,186 @@
+//
+//  staging.cpp
+//  Simple
+//
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "staging.h"
+
+struct StagingBlock {
+    char *memory;
+    size_t capacity;
+    bool inUse;
+    bool hugePages;
+    unsigned long lastUse;      // release order, for trimming the idle list
+};
+
+// A handful of blocks per image size at most, a linear scan beats a map
+// and, unlike one, needs no allocation on release
+static std::vector<StagingBlock> blocks;
+static bool useHugePages = false;
+static size_t idleLimit = DEFAULT_STAGING_IDLE_LIMIT;
+static size_t idleBytes = 0;
+static unsigned long releaseCount = 0;
+static StagingStatistics stagingStats = { 0, 0, 0, 0, 0, 0, 0 };
+
+static size_t roundUp(size_t bytes, size_t multiple){
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+static bool mapBlock(size_t bytes, StagingBlock &block){
+    block.hugePages = false;
+    block.memory = NULL;
+    if (useHugePages && bytes >= STAGING_HUGE_PAGE_SIZE) {
+        block.capacity = roundUp(bytes, STAGING_HUGE_PAGE_SIZE);
+#ifdef MAP_HUGETLB
+        void *huge = mmap(NULL, block.capacity, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (huge != MAP_FAILED) {
+            block.memory = (char *)huge;
+            block.hugePages = true;
+            return true;
+        }
+#endif
+        // no reserved huge pages, ask for transparent ones instead
+        void *memory = mmap(NULL, block.capacity, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return false;
+        block.memory = (char *)memory;
+#ifdef MADV_HUGEPAGE
+        block.hugePages = madvise(memory, block.capacity, MADV_HUGEPAGE) == 0;
+#endif
+        return true;
+    }
+    block.capacity = roundUp(bytes, (size_t)sysconf(_SC_PAGESIZE));
+    void *memory = mmap(NULL, block.capacity, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return false;
+    block.memory = (char *)memory;
+    return true;
+}
+
+static void unmapBlock(size_t index){
+    StagingBlock &block = blocks[index];
+    munmap(block.memory, block.capacity);
+    stagingStats.reservedBytes -= block.capacity;
+    if (!block.inUse)
+        idleBytes -= block.capacity;
+    blocks.erase(blocks.begin() + index);
+}
+
+// Unmaps the longest idle blocks until what is left fits under the limit
+static void trimIdle(){
+    while (idleBytes > idleLimit) {
+        size_t oldest = blocks.size();
+        for (size_t i = 0; i < blocks.size(); i++)
+            if (!blocks[i].inUse &&
+                (oldest == blocks.size() || blocks[i].lastUse < blocks[oldest].lastUse))
+                oldest = i;
+        unmapBlock(oldest);
+    }
+}
+
+char *AcquireStaging(size_t bytes){
+    if (bytes == 0)
+        bytes = 1;
+    stagingStats.requests++;
+
+    // the smallest idle block that fits, as long as it does not waste more
+    // than the request itself; anything under a page wastes most of its
+    // block anyway, so those may take any one-page block
+    size_t best = blocks.size();
+    size_t wasteLimit = std::max(bytes, (size_t)sysconf(_SC_PAGESIZE));
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const StagingBlock &block = blocks[i];
+        if (block.inUse || block.capacity < bytes || block.capacity / 2 > wasteLimit)
+            continue;
+        if (best == blocks.size() || block.capacity < blocks[best].capacity)
+            best = i;
+    }
+
+    if (best == blocks.size()) {
+        StagingBlock block;
+        if (!mapBlock(bytes, block)) {
+            // idle blocks of the wrong size may be what is in the way
+            DrainStagingArena();
+            if (!mapBlock(bytes, block)) {
+                std::cout << "Could not map " << bytes << " bytes of staging memory" << std::endl;
+                return NULL;
+            }
+        }
+        block.inUse = false;
+        block.lastUse = 0;
+        blocks.push_back(block);
+        best = blocks.size() - 1;
+        stagingStats.systemAllocations++;
+        stagingStats.reservedBytes += block.capacity;
+        idleBytes += block.capacity;
+        if (block.hugePages)
+            stagingStats.hugePageBlocks++;
+    } else {
+        stagingStats.reuses++;
+    }
+
+    StagingBlock &block = blocks[best];
+    block.inUse = true;
+    idleBytes -= block.capacity;
+    stagingStats.inUseBytes += block.capacity;
+    if (stagingStats.inUseBytes > stagingStats.peakBytes)
+        stagingStats.peakBytes = stagingStats.inUseBytes;
+    return block.memory;
+}
+
+void ReleaseStaging(void *memory){
+    if (!memory)
+        return;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        StagingBlock &block = blocks[i];
+        if (block.memory != memory)
+            continue;
+        block.inUse = false;
+        block.lastUse = ++releaseCount;
+        stagingStats.inUseBytes -= block.capacity;
+        idleBytes += block.capacity;
+        // never worth keeping, and no reason to push others out for it
+        if (block.capacity > idleLimit)
+            unmapBlock(i);
+        trimIdle();
+        return;
+    }
+    std::cout << "Released a block that is not staging memory" << std::endl;
+}
+
+void SetStagingHugePages(bool enable){
+    useHugePages = enable;
+}
+
+void SetStagingIdleLimit(size_t bytes){
+    idleLimit = bytes;
+    trimIdle();
+}
+
+void GetStagingStatistics(StagingStatistics &stats){
+    stats = stagingStats;
+}
+
+void PrintStagingStatistics(){
+    if (stagingStats.requests == 0)
+        return;
+    std::cout << "Staging: " << stagingStats.requests << " requests, "
+    << stagingStats.reuses << " reused, " << stagingStats.systemAllocations
+    << " mapped (" << stagingStats.hugePageBlocks << " on huge pages), "
+    << stagingStats.reservedBytes << " bytes reserved, peak "
+    << stagingStats.peakBytes << " in use" << std::endl;
+}
+
+void DrainStagingArena(){
+    for (size_t i = blocks.size(); i-- > 0;)
+        if (!blocks[i].inUse)
+            unmapBlock(i);
+}
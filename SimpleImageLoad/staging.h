@@ -0,0 +1,67 @@
+//
+//  staging.h
+//  Simple
+//
+
+#ifndef Simple_staging_h
+#define Simple_staging_h
+
+#include <cstddef>
+
+// Blocks at least this big are backed by huge pages when they are enabled
+#define STAGING_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+// Idle blocks beyond this are given back to the system on release
+#define DEFAULT_STAGING_IDLE_LIMIT ((size_t)256 * 1024 * 1024)
+
+struct StagingStatistics {
+    unsigned long requests;
+    unsigned long reuses;
+    unsigned long systemAllocations;    // mmap calls, the misses
+    unsigned long hugePageBlocks;
+    size_t reservedBytes;               // mapped, in use plus idle
+    size_t inUseBytes;
+    size_t peakBytes;
+};
+
+// Host staging memory for pixels on their way to and from the device.
+// Blocks are page aligned (so CL_MEM_USE_HOST_PTR can map them without a
+// copy) and are kept on release: once a batch has seen every image size
+// it needs, later images of those sizes are staged without touching the
+// system allocator.
+char *AcquireStaging(size_t bytes);
+void ReleaseStaging(void *block);
+
+// MAP_HUGETLB for blocks of a huge page or more, transparent huge pages
+// when no huge pages are reserved, plain pages when neither is available
+void SetStagingHugePages(bool enable);
+void SetStagingIdleLimit(size_t bytes);
+void GetStagingStatistics(StagingStatistics &stats);
+void PrintStagingStatistics();
+// Unmaps every idle block
+void DrainStagingArena();
+
+// Owns one staging block for the life of a scope
+class StagingBuffer {
+public:
+    StagingBuffer() : block(NULL) {}
+    explicit StagingBuffer(size_t bytes) : block(AcquireStaging(bytes)) {}
+    explicit StagingBuffer(char *acquired) : block(acquired) {}
+    ~StagingBuffer() { reset(); }
+
+    char *get() const { return block; }
+    operator char *() const { return block; }
+    // Hands the block over to the caller, who then releases it
+    char *release() { char *b = block; block = NULL; return b; }
+    void reset(char *acquired = NULL) {
+        if (block)
+            ReleaseStaging(block);
+        block = acquired;
+    }
+
+private:
+    char *block;
+    StagingBuffer(const StagingBuffer &);
+    StagingBuffer &operator=(const StagingBuffer &);
+};
+
+#endif
@@ -0,0 +1,135 @@
+//
+//  statistics.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <fstream>
+#include "statistics.h"
+#include "memorypool.h"
+
+#define GROUPS_PER_COMPUTE_UNIT 4
+
+// Exact for 8-bit data, so min/max and the moments come straight from the
+// histogram rather than from a second pass over the image
+static void statisticsFromHistogram(ImageStatistics &stats){
+    for (int c = 0; c < 4; c++) {
+        double count = 0.0, sum = 0.0, sumSquares = 0.0;
+        stats.min[c] = -1;
+        stats.max[c] = -1;
+        for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+            cl_uint n = stats.histogram[c][bin];
+            if (!n)
+                continue;
+            if (stats.min[c] < 0)
+                stats.min[c] = bin;
+            stats.max[c] = bin;
+            count += n;
+            sum += (double)n * bin;
+            sumSquares += (double)n * bin * bin;
+        }
+        stats.mean[c] = count > 0.0 ? sum / count : 0.0;
+        stats.variance[c] = count > 0.0 ?
+            sumSquares / count - stats.mean[c] * stats.mean[c] : 0.0;
+    }
+}
+
+bool ComputeImageStatistics(cl_context context,
+                            cl_command_queue commands,
+                            cl_device_id device,
+                            cl_program program,
+                            cl_mem image,
+                            cl_sampler sampler,
+                            int width, int height,
+                            ImageStatistics &stats)
+{
+    cl_int errNum;
+    cl_kernel kernel = clCreateKernel(program, "histogram_rgba", &errNum);
+    checkErr(errNum, "clCreateKernel(histogram_rgba)");
+    
+    memset(stats.histogram, 0, sizeof(stats.histogram));
+    cl_mem histogram = PoolCreateBuffer(context,
+                                      CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                      sizeof(stats.histogram),
+                                      stats.histogram,
+                                      &errNum);
+    if (there_was_an_error(errNum)) {
+        std::cout << "Histogram buffer creation error!" << std::endl;
+        clReleaseKernel(kernel);
+        return false;
+    }
+    
+    errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &image);
+    errNum |= clSetKernelArg(kernel, 1, sizeof(cl_sampler), &sampler);
+    errNum |= clSetKernelArg(kernel, 2, sizeof(cl_int), &width);
+    errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &height);
+    errNum |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &histogram);
+    checkErr(errNum, "clSetKernelArg(histogram_rgba)");
+    
+    // a handful of groups per compute unit, each striding over the image,
+    // keeps the number of global merges small
+    size_t localWorkSize;
+    cl_uint computeUnits;
+    clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                             sizeof(size_t), &localWorkSize, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS,
+                    sizeof(cl_uint), &computeUnits, NULL);
+    if (localWorkSize > 256)
+        localWorkSize = 256;
+    size_t globalWorkSize = localWorkSize * computeUnits * GROUPS_PER_COMPUTE_UNIT;
+    
+    errNum = clEnqueueNDRangeKernel(commands, kernel, 1, NULL,
+                                    &globalWorkSize, &localWorkSize,
+                                    0, NULL, NULL);
+    checkErr(errNum, "clEnqueueNDRangeKernel(histogram_rgba)");
+    
+    // only the 4 x 256 bins come back to the host
+    errNum = clEnqueueReadBuffer(commands, histogram, CL_TRUE, 0,
+                                 sizeof(stats.histogram), stats.histogram,
+                                 0, NULL, NULL);
+    checkErr(errNum, "clEnqueueReadBuffer(histogram)");
+    
+    statisticsFromHistogram(stats);
+    
+    PoolReleaseMemObject(histogram);
+    clReleaseKernel(kernel);
+    return true;
+}
+
+static const char *channelName(int channel){
+    if (channel == FI_RGBA_RED)
+        return "R";
+    if (channel == FI_RGBA_GREEN)
+        return "G";
+    if (channel == FI_RGBA_BLUE)
+        return "B";
+    return "A";
+}
+
+void PrintImageStatistics(const ImageStatistics &stats){
+    for (int c = 0; c < 4; c++) {
+        std::cout << "\t" << channelName(c)
+        << ":\tmin " << stats.min[c]
+        << "\tmax " << stats.max[c]
+        << "\tmean " << stats.mean[c]
+        << "\tvariance " << stats.variance[c] << std::endl;
+    }
+}
+
+// one line per bin, one column per channel
+bool SaveHistogram(const char *fileName, const ImageStatistics &stats){
+    std::ofstream out(fileName);
+    if (!out.is_open())
+        return false;
+    out << "bin";
+    for (int c = 0; c < 4; c++)
+        out << "," << channelName(c);
+    out << std::endl;
+    for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+        out << bin;
+        for (int c = 0; c < 4; c++)
+            out << "," << stats.histogram[c][bin];
+        out << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+//
+//  statistics.h
+//  Simple
+//
+
+#ifndef Simple_statistics_h
+#define Simple_statistics_h
+
+#include "openCLUtilities.h"
+
+#define HISTOGRAM_BINS 256
+
+// Channels are in the order they sit in the image, which for FreeImage
+// loads on little endian hosts is B, G, R, A
+struct ImageStatistics {
+    cl_uint histogram[4][HISTOGRAM_BINS];
+    int min[4];
+    int max[4];
+    double mean[4];
+    double variance[4];
+};
+
+bool ComputeImageStatistics(cl_context context,
+                            cl_command_queue commands,
+                            cl_device_id device,
+                            cl_program program,
+                            cl_mem image,
+                            cl_sampler sampler,
+                            int width, int height,
+                            ImageStatistics &stats);
+void PrintImageStatistics(const ImageStatistics &stats);
+bool SaveHistogram(const char *fileName, const ImageStatistics &stats);
+
+#endif
@@ -0,0 +1,475 @@
+//
+//  stream.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "stream.h"
+#include "memorypool.h"
+#include "staging.h"
+
+// frames in flight: one being uploaded/filtered while the host writes out
+// the previous one and reads the next
+#define STREAM_SLOTS 2
+
+bool ParseStreamFormat(const char *name, StreamFormat &format){
+    if (!strcmp(name, "rgba"))
+        format = STREAM_RAW_RGBA;
+    else if (!strcmp(name, "y4m"))
+        format = STREAM_Y4M;
+    else
+        return false;
+    return true;
+}
+
+static bool readLine(FILE *in, std::string &line){
+    line.clear();
+    int c;
+    while ((c = fgetc(in)) != EOF && c != '\n')
+        line += (char)c;
+    return c == '\n';
+}
+
+static bool parseY4MHeader(FrameStream &stream){
+    if (!readLine(stream.in, stream.header) ||
+        stream.header.compare(0, 10, "YUV4MPEG2 ") != 0) {
+        std::cerr << "Input is not a YUV4MPEG2 stream" << std::endl;
+        return false;
+    }
+
+    std::istringstream tokens(stream.header.substr(10));
+    std::string token;
+    std::string colourSpace = "420jpeg";
+    while (tokens >> token) {
+        if (token[0] == 'W')
+            stream.width = atoi(token.c_str() + 1);
+        else if (token[0] == 'H')
+            stream.height = atoi(token.c_str() + 1);
+        else if (token[0] == 'C')
+            colourSpace = token.substr(1);
+    }
+
+    // the 4:2:0 variants only differ in chroma siting
+    if (colourSpace == "420jpeg" || colourSpace == "420paldv" ||
+        colourSpace == "420mpeg2" || colourSpace == "420") {
+        stream.chromaShift = 1;
+    } else if (colourSpace == "444") {
+        stream.chromaShift = 0;
+    } else {
+        std::cerr << "Unsupported Y4M colour space C" << colourSpace << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool OpenFrameStream(FrameStream &stream, StreamFormat format, int width, int height){
+    stream.format = format;
+    stream.width = width;
+    stream.height = height;
+    stream.chromaShift = 0;
+    stream.in = stdin;
+
+    // frames get the real stdout to themselves, progress messages go to stderr
+    int frameFd = dup(STDOUT_FILENO);
+    if (frameFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+        !(stream.out = fdopen(frameFd, "wb"))) {
+        std::cerr << "Failed to redirect stdout for streaming" << std::endl;
+        return false;
+    }
+    // a reader going away should end the stream, not kill us mid write
+    signal(SIGPIPE, SIG_IGN);
+
+    if (format == STREAM_Y4M && !parseY4MHeader(stream))
+        return false;
+    if (stream.width <= 0 || stream.height <= 0) {
+        std::cerr << "Invalid stream frame size " << stream.width << "x" << stream.height << std::endl;
+        return false;
+    }
+
+    if (format == STREAM_Y4M) {
+        size_t chromaWidth = (stream.width + stream.chromaShift) >> stream.chromaShift;
+        size_t chromaHeight = (stream.height + stream.chromaShift) >> stream.chromaShift;
+        stream.frameBytes = (size_t)stream.width * stream.height + 2 * chromaWidth * chromaHeight;
+        fprintf(stream.out, "%s\n", stream.header.c_str());
+    } else {
+        stream.frameBytes = (size_t)stream.width * stream.height * 4;
+    }
+    return true;
+}
+
+// false at the end of the stream
+static bool readFrame(FrameStream &stream, char *buffer){
+    if (stream.format == STREAM_Y4M) {
+        std::string frameHeader;
+        if (!readLine(stream.in, frameHeader))
+            return false;
+        if (frameHeader.compare(0, 5, "FRAME") != 0) {
+            std::cerr << "Lost sync with the Y4M stream" << std::endl;
+            return false;
+        }
+    }
+    size_t got = fread(buffer, 1, stream.frameBytes, stream.in);
+    if (got != 0 && got != stream.frameBytes)
+        std::cerr << "Dropping truncated frame at the end of the stream" << std::endl;
+    return got == stream.frameBytes;
+}
+
+static bool writeFrame(FrameStream &stream, const char *buffer){
+    if (stream.format == STREAM_Y4M && fputs("FRAME\n", stream.out) == EOF)
+        return false;
+    return fwrite(buffer, 1, stream.frameBytes, stream.out) == stream.frameBytes;
+}
+
+struct StreamSlot {
+    cl_mem inputImage;
+    cl_mem outputImage;
+    cl_mem inputPlanes;     // Y4M only
+    cl_mem outputPlanes;
+    char *inputBuffer;
+    char *outputBuffer;
+    cl_event done;          // the download of the frame in flight, 0 if none
+};
+
+static double seconds(){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+bool RunFrameStream(cl_context context,
+                    cl_command_queue commands,
+                    cl_program streamProgram,
+                    cl_kernel filter,
+                    const size_t *globalWorkSize,
+                    FrameStream &stream)
+{
+    cl_int errNum;
+    bool y4m = stream.format == STREAM_Y4M;
+    cl_int width = stream.width;
+    cl_int height = stream.height;
+    cl_int chromaShift = stream.chromaShift;
+    // the filters expect FreeImage's channel order, see SetColourKernelArgs
+    cl_int swapRB = (FI_RGBA_RED == 2);
+
+    // uploads and downloads get queues of their own so the copy of one frame
+    // can overlap the filtering of its neighbour
+    cl_device_id device;
+    clGetCommandQueueInfo(commands, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+    cl_command_queue uploads = clCreateCommandQueue(context, device, 0, &errNum);
+    checkErr(errNum, "clCreateCommandQueue(uploads)");
+    cl_command_queue downloads = clCreateCommandQueue(context, device, 0, &errNum);
+    checkErr(errNum, "clCreateCommandQueue(downloads)");
+
+    cl_kernel unpack = 0, pack = 0;
+    if (y4m) {
+        unpack = clCreateKernel(streamProgram, "yuv_to_rgba", &errNum);
+        checkErr(errNum, "yuv_to_rgba");
+        pack = clCreateKernel(streamProgram, "rgba_to_yuv", &errNum);
+        checkErr(errNum, "rgba_to_yuv");
+    }
+
+    // raw frames are RGBA in memory, see ChannelOrderFor
+    cl_image_format format;
+    format.image_channel_order = y4m ? CL_RGBA : ChannelOrderFor(true);
+    format.image_channel_data_type = CL_UNORM_INT8;
+
+    StreamSlot slots[STREAM_SLOTS];
+    for (int s = 0; s < STREAM_SLOTS; s++) {
+        StreamSlot &slot = slots[s];
+        slot.inputImage = PoolCreateImage2D(context, CL_MEM_READ_WRITE, &format,
+                                          width, height, 0, NULL, &errNum);
+        checkErr(errNum, "PoolCreateImage2D(stream input)");
+        slot.outputImage = PoolCreateImage2D(context, CL_MEM_READ_WRITE, &format,
+                                           width, height, 0, NULL, &errNum);
+        checkErr(errNum, "PoolCreateImage2D(stream output)");
+        slot.inputPlanes = slot.outputPlanes = 0;
+        if (y4m) {
+            slot.inputPlanes = PoolCreateBuffer(context, CL_MEM_READ_ONLY,
+                                              stream.frameBytes, NULL, &errNum);
+            checkErr(errNum, "PoolCreateBuffer(stream input)");
+            slot.outputPlanes = PoolCreateBuffer(context, CL_MEM_WRITE_ONLY,
+                                               stream.frameBytes, NULL, &errNum);
+            checkErr(errNum, "PoolCreateBuffer(stream output)");
+        }
+        slot.inputBuffer = AcquireStaging(stream.frameBytes);
+        slot.outputBuffer = AcquireStaging(stream.frameBytes);
+        slot.done = 0;
+    }
+    // without somewhere to stage a frame nothing is streamed, the slots
+    // are still released below
+    bool staged = true;
+    for (int i = 0; i < STREAM_SLOTS; i++)
+        staged = staged && slots[i].inputBuffer && slots[i].outputBuffer;
+
+    size_t origin[3] = { 0, 0, 0 };
+    size_t region[3] = { (size_t)width, (size_t)height, 1 };
+    size_t pixelWorkSize[2] = { (size_t)width, (size_t)height };
+    size_t chromaWorkSize[2] = { (size_t)((width + chromaShift) >> chromaShift),
+                                 (size_t)((height + chromaShift) >> chromaShift) };
+
+    long frames = 0;
+    double start = 0;
+    bool ok = staged;
+    int s = 0;
+    while (ok && readFrame(stream, slots[s].inputBuffer)) {
+        StreamSlot &slot = slots[s];
+        if (frames == 0)
+            start = seconds();
+
+        // upload -> (unpack) -> filter -> (pack) -> download, chained by
+        // events across the three queues
+        cl_event uploaded, filtered;
+        if (y4m) {
+            errNum = clEnqueueWriteBuffer(uploads, slot.inputPlanes, CL_FALSE, 0,
+                                          stream.frameBytes, slot.inputBuffer,
+                                          0, NULL, &uploaded);
+        } else {
+            errNum = clEnqueueWriteImage(uploads, slot.inputImage, CL_FALSE,
+                                         origin, region, 0, 0, slot.inputBuffer,
+                                         0, NULL, &uploaded);
+        }
+        checkErr(errNum, "stream upload");
+
+        if (y4m) {
+            errNum = clSetKernelArg(unpack, 0, sizeof(cl_mem), &slot.inputPlanes);
+            errNum |= clSetKernelArg(unpack, 1, sizeof(cl_mem), &slot.inputImage);
+            errNum |= clSetKernelArg(unpack, 2, sizeof(cl_int), &width);
+            errNum |= clSetKernelArg(unpack, 3, sizeof(cl_int), &height);
+            errNum |= clSetKernelArg(unpack, 4, sizeof(cl_int), &chromaShift);
+            errNum |= clSetKernelArg(unpack, 5, sizeof(cl_int), &swapRB);
+            checkErr(errNum, "clSetKernelArg(yuv_to_rgba)");
+            errNum = clEnqueueNDRangeKernel(commands, unpack, 2, NULL, pixelWorkSize,
+                                            NULL, 1, &uploaded, NULL);
+            checkErr(errNum, "clEnqueueNDRangeKernel(yuv_to_rgba)");
+        }
+
+        errNum = clSetKernelArg(filter, 0, sizeof(cl_mem), &slot.inputImage);
+        errNum |= clSetKernelArg(filter, 1, sizeof(cl_mem), &slot.outputImage);
+        checkErr(errNum, "clSetKernelArg(filter)");
+        // with y4m the unpack is ahead of it in the same in-order queue
+        errNum = clEnqueueNDRangeKernel(commands, filter, 2, NULL, globalWorkSize, NULL,
+                                        y4m ? 0 : 1, y4m ? NULL : &uploaded,
+                                        y4m ? NULL : &filtered);
+        checkErr(errNum, "clEnqueueNDRangeKernel(filter)");
+
+        if (y4m) {
+            errNum = clSetKernelArg(pack, 0, sizeof(cl_mem), &slot.outputImage);
+            errNum |= clSetKernelArg(pack, 1, sizeof(cl_mem), &slot.outputPlanes);
+            errNum |= clSetKernelArg(pack, 2, sizeof(cl_int), &width);
+            errNum |= clSetKernelArg(pack, 3, sizeof(cl_int), &height);
+            errNum |= clSetKernelArg(pack, 4, sizeof(cl_int), &chromaShift);
+            errNum |= clSetKernelArg(pack, 5, sizeof(cl_int), &swapRB);
+            checkErr(errNum, "clSetKernelArg(rgba_to_yuv)");
+            errNum = clEnqueueNDRangeKernel(commands, pack, 2, NULL, chromaWorkSize,
+                                            NULL, 0, NULL, &filtered);
+            checkErr(errNum, "clEnqueueNDRangeKernel(rgba_to_yuv)");
+            errNum = clEnqueueReadBuffer(downloads, slot.outputPlanes, CL_FALSE, 0,
+                                         stream.frameBytes, slot.outputBuffer,
+                                         1, &filtered, &slot.done);
+        } else {
+            errNum = clEnqueueReadImage(downloads, slot.outputImage, CL_FALSE,
+                                        origin, region, 0, 0, slot.outputBuffer,
+                                        1, &filtered, &slot.done);
+        }
+        checkErr(errNum, "stream download");
+        clReleaseEvent(uploaded);
+        clReleaseEvent(filtered);
+        clFlush(uploads);
+        clFlush(commands);
+        clFlush(downloads);
+        frames++;
+
+        // while the device works on this frame, hand the previous one on
+        s = (s + 1) % STREAM_SLOTS;
+        if (slots[s].done) {
+            clWaitForEvents(1, &slots[s].done);
+            clReleaseEvent(slots[s].done);
+            slots[s].done = 0;
+            ok = writeFrame(stream, slots[s].outputBuffer);
+        }
+    }
+
+    // drain whatever is still in flight, oldest first
+    for (int i = 0; i < STREAM_SLOTS; i++, s = (s + 1) % STREAM_SLOTS) {
+        if (!slots[s].done)
+            continue;
+        clWaitForEvents(1, &slots[s].done);
+        clReleaseEvent(slots[s].done);
+        slots[s].done = 0;
+        ok = ok && writeFrame(stream, slots[s].outputBuffer);
+    }
+    ok = (fflush(stream.out) == 0) && ok;
+    if (!ok && staged)
+        std::cerr << "Failed to write to the output stream" << std::endl;
+
+    double elapsed = frames ? seconds() - start : 0;
+    std::cerr << "Streamed " << frames << " frames of " << width << "x" << height
+    << " in " << elapsed << " s";
+    if (elapsed > 0)
+        std::cerr << " (" << frames / elapsed << " fps)";
+    std::cerr << std::endl;
+
+    for (int i = 0; i < STREAM_SLOTS; i++) {
+        PoolReleaseMemObject(slots[i].inputImage);
+        PoolReleaseMemObject(slots[i].outputImage);
+        if (y4m) {
+            PoolReleaseMemObject(slots[i].inputPlanes);
+            PoolReleaseMemObject(slots[i].outputPlanes);
+        }
+        ReleaseStaging(slots[i].inputBuffer);
+        ReleaseStaging(slots[i].outputBuffer);
+    }
+    if (y4m) {
+        clReleaseKernel(unpack);
+        clReleaseKernel(pack);
+    }
+    clReleaseCommandQueue(uploads);
+    clReleaseCommandQueue(downloads);
+    return ok;
+}
+
+// FNV-1a over one tile of a frame, rows pitch bytes apart
+static cl_ulong hashTile(const unsigned char *tile, size_t rowBytes, int rows, size_t pitch){
+    cl_ulong hash = 14695981039346656037ULL;
+    for (int y = 0; y < rows; y++, tile += pitch)
+        for (size_t x = 0; x < rowBytes; x++)
+            hash = (hash ^ tile[x]) * 1099511628211ULL;
+    return hash;
+}
+
+bool RunIncrementalStream(cl_context context,
+                          cl_command_queue commands,
+                          cl_kernel filter,
+                          int halo,
+                          int tileSize,
+                          FrameStream &stream)
+{
+    cl_int errNum;
+    int width = stream.width;
+    int height = stream.height;
+    size_t pitch = (size_t)width * 4;
+    int tilesAcross = (width + tileSize - 1) / tileSize;
+    int tilesDown = (height + tileSize - 1) / tileSize;
+    int tiles = tilesAcross * tilesDown;
+
+    // raw frames are RGBA in memory, see ChannelOrderFor
+    cl_image_format format;
+    format.image_channel_order = ChannelOrderFor(true);
+    format.image_channel_data_type = CL_UNORM_INT8;
+    cl_mem inputImage = PoolCreateImage2D(context, CL_MEM_READ_ONLY, &format,
+                                          width, height, 0, NULL, &errNum);
+    checkErr(errNum, "PoolCreateImage2D(stream input)");
+    cl_mem outputImage = PoolCreateImage2D(context, CL_MEM_READ_WRITE, &format,
+                                           width, height, 0, NULL, &errNum);
+    checkErr(errNum, "PoolCreateImage2D(stream output)");
+    errNum = clSetKernelArg(filter, 0, sizeof(cl_mem), &inputImage);
+    errNum |= clSetKernelArg(filter, 1, sizeof(cl_mem), &outputImage);
+    checkErr(errNum, "clSetKernelArg(filter)");
+
+    // the output persists too, tiles that are not refiltered keep theirs
+    char *inputBuffer = AcquireStaging(stream.frameBytes);
+    char *outputBuffer = AcquireStaging(stream.frameBytes);
+    bool staged = inputBuffer && outputBuffer;
+    std::vector<cl_ulong> hashes(tiles);
+    std::vector<char> changed(tiles), affected(tiles);
+
+    long frames = 0;
+    double start = 0;
+    double skipped = 0;
+    bool ok = staged;
+    while (ok && readFrame(stream, inputBuffer)) {
+        if (frames == 0)
+            start = seconds();
+
+        int numChanged = 0;
+        for (int ty = 0; ty < tilesDown; ty++) {
+            for (int tx = 0; tx < tilesAcross; tx++) {
+                int t = ty * tilesAcross + tx;
+                int x = tx * tileSize, y = ty * tileSize;
+                int w = std::min(tileSize, width - x), h = std::min(tileSize, height - y);
+                size_t offset = y * pitch + (size_t)x * 4;
+                cl_ulong hash = hashTile((unsigned char *)inputBuffer + offset,
+                                         (size_t)w * 4, h, pitch);
+                changed[t] = frames == 0 || hash != hashes[t];
+                hashes[t] = hash;
+                if (!changed[t])
+                    continue;
+                numChanged++;
+                size_t origin[3] = { (size_t)x, (size_t)y, 0 };
+                size_t region[3] = { (size_t)w, (size_t)h, 1 };
+                errNum = clEnqueueWriteImage(commands, inputImage, CL_FALSE, origin, region,
+                                             pitch, 0, inputBuffer + offset, 0, NULL, NULL);
+                checkErr(errNum, "stream tile upload");
+            }
+        }
+
+        // a changed tile reaches into its neighbours' output through the halo
+        for (int ty = 0; ty < tilesDown; ty++) {
+            for (int tx = 0; tx < tilesAcross; tx++) {
+                bool dirty = false;
+                int reach = halo > 0 ? 1 : 0;
+                for (int ny = std::max(0, ty - reach); ny <= std::min(tilesDown - 1, ty + reach); ny++)
+                    for (int nx = std::max(0, tx - reach); nx <= std::min(tilesAcross - 1, tx + reach); nx++)
+                        dirty = dirty || changed[ny * tilesAcross + nx];
+                affected[ty * tilesAcross + tx] = dirty;
+            }
+        }
+
+        // one launch and one read back per run of affected tiles in a row
+        size_t filteredPixels = 0;
+        for (int ty = 0; ty < tilesDown; ty++) {
+            for (int tx = 0; tx < tilesAcross; tx++) {
+                if (!affected[ty * tilesAcross + tx])
+                    continue;
+                int first = tx;
+                while (tx + 1 < tilesAcross && affected[ty * tilesAcross + tx + 1])
+                    tx++;
+                int x = first * tileSize, y = ty * tileSize;
+                size_t origin[3] = { (size_t)x, (size_t)y, 0 };
+                size_t region[3] = { (size_t)std::min((tx + 1) * tileSize, width) - x,
+                                     (size_t)std::min(tileSize, height - y), 1 };
+                errNum = clEnqueueNDRangeKernel(commands, filter, 2, origin, region,
+                                                NULL, 0, NULL, NULL);
+                checkErr(errNum, "clEnqueueNDRangeKernel(filter)");
+                errNum = clEnqueueReadImage(commands, outputImage, CL_FALSE, origin, region,
+                                            pitch, 0, outputBuffer + y * pitch + (size_t)x * 4,
+                                            0, NULL, NULL);
+                checkErr(errNum, "stream tile download");
+                filteredPixels += region[0] * region[1];
+            }
+        }
+        errNum = clFinish(commands);
+        checkErr(errNum, "clFinish(stream)");
+
+        double skip = 1.0 - (double)filteredPixels / ((double)width * height);
+        skipped += skip;
+        fprintf(stderr, "Frame %ld: %d of %d tiles changed, %.1f%% of the filter work skipped\n",
+                frames, numChanged, tiles, 100.0 * skip);
+        ok = writeFrame(stream, outputBuffer);
+        frames++;
+    }
+    ok = (fflush(stream.out) == 0) && ok;
+    if (!ok && staged)
+        std::cerr << "Failed to write to the output stream" << std::endl;
+
+    double elapsed = frames ? seconds() - start : 0;
+    std::cerr << "Streamed " << frames << " frames of " << width << "x" << height
+    << " in " << elapsed << " s";
+    if (elapsed > 0)
+        std::cerr << " (" << frames / elapsed << " fps)";
+    if (frames)
+        std::cerr << ", " << 100.0 * skipped / frames << "% of the filter work skipped";
+    std::cerr << std::endl;
+
+    PoolReleaseMemObject(inputImage);
+    PoolReleaseMemObject(outputImage);
+    ReleaseStaging(inputBuffer);
+    ReleaseStaging(outputBuffer);
+    return ok;
+}
@@ -0,0 +1,56 @@
+//
+//  stream.h
+//  Simple
+//
+
+#ifndef Simple_stream_h
+#define Simple_stream_h
+
+#include <cstdio>
+#include <string>
+#include "openCLUtilities.h"
+
+enum StreamFormat {
+    STREAM_NONE,
+    STREAM_RAW_RGBA,    // bare width x height x 4 byte frames
+    STREAM_Y4M          // YUV4MPEG2, 4:2:0 or 4:4:4
+};
+
+struct FrameStream {
+    StreamFormat format;
+    int width;
+    int height;
+    int chromaShift;        // 1 for 4:2:0 planes, 0 for 4:4:4
+    size_t frameBytes;      // payload of one frame, without its FRAME line
+    std::string header;     // Y4M stream header, echoed on the output
+    FILE *in;
+    FILE *out;
+};
+
+bool ParseStreamFormat(const char *name, StreamFormat &format);
+// Takes over stdin and stdout for frames: anything else the program prints
+// to stdout goes to stderr from here on. Reads the Y4M header, raw streams
+// use the width and height given.
+bool OpenFrameStream(FrameStream &stream, StreamFormat format, int width, int height);
+// Runs filter over every frame of the stream. The filter must already have
+// all its arguments set except the source and destination images (0 and 1),
+// and globalWorkSize is the range it is launched over.
+bool RunFrameStream(cl_context context,
+                    cl_command_queue commands,
+                    cl_program streamProgram,
+                    cl_kernel filter,
+                    const size_t *globalWorkSize,
+                    FrameStream &stream);
+// RunFrameStream for raw streams that change little from frame to frame:
+// each frame is hashed in tileSize x tileSize tiles and only the tiles that
+// changed are uploaded to one persistent image. filter is relaunched over
+// those tiles and their neighbours (halo, the filter's reach, must be no
+// more than tileSize) and only those are read back over the last output.
+bool RunIncrementalStream(cl_context context,
+                          cl_command_queue commands,
+                          cl_kernel filter,
+                          int halo,
+                          int tileSize,
+                          FrameStream &stream);
+
+#endif
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+#  run_tests.sh
+#  Simple
+#
+#  Builds the host side tests against the sources they cover and runs
+#  them, writing their files to a scratch directory. Needs a C++ compiler,
+#  FreeImage and zlib; no OpenCL device is used. Run by hand:
+#
+#      sh tests/run_tests.sh [scratch directory]
+
+here=`dirname "$0"`
+sources="$here/.."
+scratch=${1:-"${TMPDIR:-/tmp}/simple_tests.$$"}
+CXX=${CXX:-c++}
+
+case `uname` in
+    Darwin) opencl="-framework OpenCL" ;;
+    *) opencl="-lOpenCL" ;;
+esac
+
+mkdir -p "$scratch" || exit 1
+status=0
+for test in "$here"/*_test.cpp; do
+    name=`basename "$test" .cpp`
+    if ! $CXX -I"$sources" -o "$scratch/$name" "$test" \
+        "$sources/openCLUtilities.cpp" "$sources/pngencode.cpp" \
+        "$sources/staging.cpp" "$sources/memorypool.cpp" \
+        "$sources/kernelsources.cpp" \
+        -lfreeimage -lz -lpthread $opencl; then
+        echo "run_tests.sh: $name did not build" >&2
+        status=1
+        continue
+    fi
+    "$scratch/$name" "$scratch" || status=1
+done
+exit $status
@@ -0,0 +1,144 @@
+//
+//  saveorder_test.cpp
+//  Simple
+//
+//  Checks the files written from pixels read back in R,G,B,A order (a
+//  ChannelOrderFor(true) image) with SaveRGBAImage. PNGs must match the
+//  size and CRC-32 the encoder gave for the same pixels in FreeImage's
+//  order while it still swizzled them itself, and decode back to those
+//  pixels; other formats must match SaveImage's file for FreeImage's order.
+//  Built and run by run_tests.sh.
+//
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <zlib.h>
+#include "openCLUtilities.h"
+#include "pngencode.h"
+#include "staging.h"
+
+// What the encoder wrote for the pixels below at level 6 before it stopped
+// swizzling, one per filter strategy
+struct ReferencePng {
+    PngFilterStrategy filter;
+    size_t size;
+    uLong crc;
+};
+
+static const ReferencePng referencePngs[] = {
+    { PNG_FILTERS_NONE, 280550, 0x1ef750b7UL },
+    { PNG_FILTERS_SUB, 137263, 0x5faa4c8dUL },
+    { PNG_FILTERS_UP, 137323, 0xd1ffedc6UL },
+    { PNG_FILTERS_AVERAGE, 136780, 0x0b7f5e44UL },
+    { PNG_FILTERS_PAETH, 143033, 0x0fbe8734UL },
+    { PNG_FILTERS_ADAPTIVE, 136165, 0x5e8b6ad5UL },
+};
+
+static int failures = 0;
+
+static std::vector<char> readFile(const std::string &fileName){
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+}
+
+static void expect(bool condition, const std::string &what){
+    if (!condition) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+static void expectSameFiles(const std::string &expected, const std::string &actual){
+    std::vector<char> a = readFile(expected), b = readFile(actual);
+    expect(!a.empty() && a == b, actual + " differs from " + expected);
+}
+
+// Decodes fileName and compares it with pixels, which are in FreeImage's order
+static void expectPixels(const std::string &fileName, const std::vector<char> &pixels,
+                         int width, int height){
+    int loadedWidth, loadedHeight;
+    char *loaded = LoadImageData((char *)fileName.c_str(), loadedWidth, loadedHeight);
+    bool same = loaded && loadedWidth == width && loadedHeight == height &&
+                std::equal(pixels.begin(), pixels.end(), loaded);
+    expect(same, fileName + " does not decode to the pixels saved");
+    ReleaseStaging(loaded);
+}
+
+int main(int argc, char **argv){
+    std::string directory = argc > 1 ? argv[1] : ".";
+    // odd sizes, so no row lines up with anything by accident, and tall
+    // enough for two encoder chunks
+    const int width = 301, height = 233;
+
+    // what LoadImageData hands over, gradients with a little noise so the
+    // filters make a difference, and what the device gives back for it from
+    // a ChannelOrderFor(true) image
+    std::vector<char> freeImagePixels((size_t)width * height * 4);
+    std::vector<char> rgbaPixels(freeImagePixels.size());
+    unsigned seed = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 4; c++) {
+                seed = seed * 1103515245 + 12345;
+                freeImagePixels[((size_t)y * width + x) * 4 + c] =
+                    (char)(x * (c + 1) + y * (3 - c) + (seed >> 29));
+            }
+        }
+    }
+    for (size_t i = 0; i < freeImagePixels.size(); i += 4) {
+        rgbaPixels[i] = freeImagePixels[i + FI_RGBA_RED];
+        rgbaPixels[i + 1] = freeImagePixels[i + FI_RGBA_GREEN];
+        rgbaPixels[i + 2] = freeImagePixels[i + FI_RGBA_BLUE];
+        rgbaPixels[i + 3] = freeImagePixels[i + FI_RGBA_ALPHA];
+    }
+
+    // PNG, at every filter strategy and with the rows split across threads
+    for (size_t r = 0; r < sizeof(referencePngs) / sizeof(referencePngs[0]); r++) {
+        const ReferencePng &reference = referencePngs[r];
+        PngEncodeOptions options = { 6, reference.filter,
+                                     reference.filter == PNG_FILTERS_ADAPTIVE ? 3 : 1 };
+        SetPngEncodeOptions(options);
+        std::string actual = directory + "/saveorder_" +
+                             PngFilterStrategyName(reference.filter) + ".png";
+
+        expect(SaveRGBAImage((char *)actual.c_str(), &rgbaPixels[0], width, height),
+               "SaveRGBAImage " + actual);
+        std::vector<char> png = readFile(actual);
+        uLong crc = png.empty() ? 0 : crc32(0L, (const Bytef *)&png[0], (uInt)png.size());
+        expect(png.size() == reference.size && crc == reference.crc,
+               actual + " differs from the encoder's output before the change");
+        expectPixels(actual, freeImagePixels, width, height);
+    }
+
+    // FreeImage ordered pixels still make a PNG with the right colours
+    std::string roi = directory + "/saveorder_roi.png";
+    expect(SaveImage((char *)roi.c_str(), &freeImagePixels[0], width, height),
+           "SaveImage " + roi);
+    expectPixels(roi, freeImagePixels, width, height);
+
+    // formats FreeImage writes, which take its own order
+    const char *extensions[] = { "bmp", "tga", "tif" };
+    for (int e = 0; e < 3; e++) {
+        std::string expected = directory + "/saveorder_expected." + extensions[e];
+        std::string actual = directory + "/saveorder." + extensions[e];
+        expect(!SavesRGBA(actual.c_str()), actual + " should be saved in FreeImage's order");
+        expect(SaveImage((char *)expected.c_str(), &freeImagePixels[0], width, height),
+               "SaveImage " + expected);
+        expect(SaveRGBAImage((char *)actual.c_str(), &rgbaPixels[0], width, height),
+               "SaveRGBAImage " + actual);
+        expectSameFiles(expected, actual);
+    }
+
+    if (failures) {
+        std::cerr << failures << " save order checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Save order checks passed" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+//
+//  volume.cpp
+//  Simple
+//
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include "volume.h"
+#include "memorypool.h"
+
+// Float samples of one page, converted to greyscale first if need be
+static FIBITMAP *pageToFloat(FIBITMAP *page){
+    if (FreeImage_GetImageType(page) == FIT_BITMAP && FreeImage_GetBPP(page) != 8) {
+        FIBITMAP *grey = FreeImage_ConvertToGreyscale(page);
+        FIBITMAP *samples = FreeImage_ConvertToFloat(grey);
+        FreeImage_Unload(grey);
+        return samples;
+    }
+    return FreeImage_ConvertToFloat(page);
+}
+
+bool LoadVolume(char *fileName, Volume &volume){
+    volume.voxels = NULL;
+    FREE_IMAGE_FORMAT format = FreeImage_GetFileType(fileName, 0);
+    FIMULTIBITMAP *stack = FreeImage_OpenMultiBitmap(format, fileName, FALSE, TRUE, TRUE);
+    if (!stack) {
+        printf("Error loading volume %s\n", fileName);
+        return false;
+    }
+
+    volume.depth = FreeImage_GetPageCount(stack);
+    for (int z = 0; z < volume.depth; z++) {
+        FIBITMAP *page = FreeImage_LockPage(stack, z);
+        if (!page)
+            break;
+        if (z == 0) {
+            volume.width = FreeImage_GetWidth(page);
+            volume.height = FreeImage_GetHeight(page);
+            volume.bitsPerSample = FreeImage_GetImageType(page) == FIT_UINT16 ? 16 : 8;
+            volume.voxels = new float[(size_t)volume.width * volume.height * volume.depth];
+        }
+        FIBITMAP *samples = NULL;
+        if ((int)FreeImage_GetWidth(page) == volume.width &&
+            (int)FreeImage_GetHeight(page) == volume.height)
+            samples = pageToFloat(page);
+        FreeImage_UnlockPage(stack, page, FALSE);
+        if (!samples) {
+            printf("Page %d of %s is a different size or type\n", z, fileName);
+            break;
+        }
+        float *plane = volume.voxels + (size_t)z * volume.width * volume.height;
+        for (int y = 0; y < volume.height; y++)
+            memcpy(plane + (size_t)y * volume.width, FreeImage_GetScanLine(samples, y),
+                   volume.width * sizeof(float));
+        FreeImage_Unload(samples);
+        if (z == volume.depth - 1) {
+            FreeImage_CloseMultiBitmap(stack);
+            return true;
+        }
+    }
+    FreeImage_CloseMultiBitmap(stack);
+    delete [] volume.voxels;
+    volume.voxels = NULL;
+    return false;
+}
+
+bool SaveVolume(char *fileName, const Volume &volume){
+    FIMULTIBITMAP *stack = FreeImage_OpenMultiBitmap(FIF_TIFF, fileName, TRUE, FALSE);
+    if (!stack) {
+        printf("Error creating volume %s\n", fileName);
+        return false;
+    }
+    bool wide = volume.bitsPerSample == 16;
+    float scale = wide ? 65535.0f : 255.0f;
+    for (int z = 0; z < volume.depth; z++) {
+        // 8-bit pages get FreeImage's default greyscale palette
+        FIBITMAP *page = wide ? FreeImage_AllocateT(FIT_UINT16, volume.width, volume.height)
+                              : FreeImage_Allocate(volume.width, volume.height, 8);
+        const float *plane = volume.voxels + (size_t)z * volume.width * volume.height;
+        for (int y = 0; y < volume.height; y++) {
+            BYTE *row = FreeImage_GetScanLine(page, y);
+            for (int x = 0; x < volume.width; x++) {
+                float v = plane[(size_t)y * volume.width + x] * scale + 0.5f;
+                v = std::min(std::max(v, 0.0f), scale);
+                if (wide)
+                    ((unsigned short *)row)[x] = (unsigned short)v;
+                else
+                    row[x] = (BYTE)v;
+            }
+        }
+        FreeImage_AppendPage(stack, page);
+        FreeImage_Unload(page);
+    }
+    return FreeImage_CloseMultiBitmap(stack);
+}
+
+static void setPassArgs(cl_kernel kernel, cl_mem src, cl_mem dst,
+                        int width, int height, int depth, int axis,
+                        cl_mem weights, int radius)
+{
+    cl_int errNum;
+    errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src);
+    errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &dst);
+    errNum |= clSetKernelArg(kernel, 2, sizeof(cl_int), &width);
+    errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &height);
+    errNum |= clSetKernelArg(kernel, 4, sizeof(cl_int), &depth);
+    errNum |= clSetKernelArg(kernel, 5, sizeof(cl_int), &axis);
+    errNum |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &weights);
+    errNum |= clSetKernelArg(kernel, 7, sizeof(cl_int), &radius);
+    checkErr(errNum, "clSetKernelArg(gaussian_volume_pass)");
+}
+
+bool GaussianFilterVolume(cl_context context,
+                          cl_device_id device,
+                          cl_command_queue commands,
+                          cl_program program,
+                          Volume &volume,
+                          float sigma,
+                          int slabDepth)
+{
+    cl_int errNum;
+    int radius = (int)ceil(3.0f * sigma);
+    if (sigma <= 0 || radius > MAX_VOLUME_RADIUS) {
+        std::cout << "Volume sigma must be in (0, " << MAX_VOLUME_RADIUS / 3 << "]" << std::endl;
+        return false;
+    }
+    float weights[2 * MAX_VOLUME_RADIUS + 1];
+    float total = 0;
+    for (int i = -radius; i <= radius; i++)
+        total += weights[i + radius] = (float)exp(-(i * i) / (2.0 * sigma * sigma));
+    for (int i = 0; i <= 2 * radius; i++)
+        weights[i] /= total;
+
+    // two slab sized buffers ping-pong through the passes; keep them inside
+    // a quarter of device memory each so other users still fit
+    size_t planeBytes = (size_t)volume.width * volume.height * sizeof(float);
+    if (slabDepth <= 0) {
+        cl_ulong maxAlloc, globalMem;
+        clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, NULL);
+        clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, NULL);
+        cl_ulong budget = std::min(maxAlloc, globalMem / 4);
+        slabDepth = (int)(budget / planeBytes) - 2 * radius;
+        if (slabDepth < 1) {
+            std::cout << "A " << volume.width << "x" << volume.height
+            << " plane and its halo do not fit in device memory" << std::endl;
+            return false;
+        }
+    }
+    slabDepth = std::min(slabDepth, volume.depth);
+    int bufferPlanes = std::min(volume.depth, slabDepth + 2 * radius);
+    int slabs = (volume.depth + slabDepth - 1) / slabDepth;
+    std::cout << "Volume " << volume.width << "x" << volume.height << "x" << volume.depth
+    << ", sigma " << sigma << " (radius " << radius << "), " << slabs
+    << " slab(s) of up to " << slabDepth << " planes" << std::endl;
+
+    cl_kernel kernel = clCreateKernel(program, "gaussian_volume_pass", &errNum);
+    checkErr(errNum, "gaussian_volume_pass");
+    cl_mem weightBuffer = PoolCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                         sizeof(float) * (2 * radius + 1), weights, &errNum);
+    checkErr(errNum, "PoolCreateBuffer(weights)");
+    cl_mem slab[2];
+    for (int i = 0; i < 2; i++) {
+        slab[i] = PoolCreateBuffer(context, CL_MEM_READ_WRITE,
+                                 planeBytes * bufferPlanes, NULL, &errNum);
+        if (there_was_an_error(errNum)) {
+            std::cout << "Volume slab creation error!" << std::endl;
+            if (i == 1)
+                PoolReleaseMemObject(slab[0]);
+            PoolReleaseMemObject(weightBuffer);
+            clReleaseKernel(kernel);
+            return false;
+        }
+    }
+
+    // filtered planes go to a separate copy: the next slab's halo still has
+    // to come from the unfiltered volume
+    float *filtered = new float[(size_t)volume.width * volume.height * volume.depth];
+    for (int z0 = 0; z0 < volume.depth; z0 += slabDepth) {
+        int z1 = std::min(volume.depth, z0 + slabDepth);
+        int first = std::max(0, z0 - radius);
+        int last = std::min(volume.depth, z1 + radius);
+        int planes = last - first;
+
+        errNum = clEnqueueWriteBuffer(commands, slab[0], CL_FALSE, 0, planeBytes * planes,
+                                      volume.voxels + (size_t)first * volume.width * volume.height,
+                                      0, NULL, NULL);
+        checkErr(errNum, "clEnqueueWriteBuffer(slab)");
+
+        // x and y run over the halo planes too, the z pass reads them
+        size_t globalWorkSize[3] = { (size_t)volume.width, (size_t)volume.height, (size_t)planes };
+        for (int axis = 0; axis < 3; axis++) {
+            setPassArgs(kernel, slab[axis & 1], slab[(axis + 1) & 1],
+                        volume.width, volume.height, planes, axis, weightBuffer, radius);
+            errNum = clEnqueueNDRangeKernel(commands, kernel, 3, NULL, globalWorkSize,
+                                            NULL, 0, NULL, NULL);
+            checkErr(errNum, "clEnqueueNDRangeKernel(gaussian_volume_pass)");
+        }
+
+        // three passes leave the result in slab[1]
+        errNum = clEnqueueReadBuffer(commands, slab[1], CL_FALSE,
+                                     planeBytes * (z0 - first), planeBytes * (z1 - z0),
+                                     filtered + (size_t)z0 * volume.width * volume.height,
+                                     0, NULL, NULL);
+        checkErr(errNum, "clEnqueueReadBuffer(slab)");
+    }
+    errNum = clFinish(commands);
+
+    delete [] volume.voxels;
+    volume.voxels = filtered;
+    PoolReleaseMemObject(slab[0]);
+    PoolReleaseMemObject(slab[1]);
+    PoolReleaseMemObject(weightBuffer);
+    clReleaseKernel(kernel);
+    return !there_was_an_error(errNum);
+}
+
+bool RunVolumeGaussian(cl_context context,
+                       cl_device_id device,
+                       cl_command_queue commands,
+                       cl_program program,
+                       char *inputFile,
+                       char *outputFile,
+                       float sigma,
+                       int slabDepth)
+{
+    Volume volume;
+    if (!LoadVolume(inputFile, volume))
+        return false;
+    bool ok = GaussianFilterVolume(context, device, commands, program,
+                                   volume, sigma, slabDepth) &&
+              SaveVolume(outputFile, volume);
+    delete [] volume.voxels;
+    return ok;
+}
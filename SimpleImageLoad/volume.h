@@ -0,0 +1,48 @@
+//
+//  volume.h
+//  Simple
+//
+
+#ifndef Simple_volume_h
+#define Simple_volume_h
+
+#include "openCLUtilities.h"
+
+// The weights have to fit in __constant memory
+#define MAX_VOLUME_RADIUS 64
+
+// A page stack as float samples in [0, 1], x fastest then y then z
+struct Volume {
+    int width;
+    int height;
+    int depth;
+    int bitsPerSample;      // of the source pages, 8 or 16, used on save
+    float *voxels;
+};
+
+// Every page of a multipage TIFF (or any single image) as one z slice;
+// colour pages are converted to greyscale
+bool LoadVolume(char *fileName, Volume &volume);
+bool SaveVolume(char *fileName, const Volume &volume);
+
+// Gaussian with the given sigma (in voxels) along x, y and z. Volumes too
+// big for the device go through in z slabs of slabDepth planes plus a halo
+// of the filter radius on each side; 0 picks the deepest slab that fits.
+bool GaussianFilterVolume(cl_context context,
+                          cl_device_id device,
+                          cl_command_queue commands,
+                          cl_program program,
+                          Volume &volume,
+                          float sigma,
+                          int slabDepth);
+
+bool RunVolumeGaussian(cl_context context,
+                       cl_device_id device,
+                       cl_command_queue commands,
+                       cl_program program,
+                       char *inputFile,
+                       char *outputFile,
+                       float sigma,
+                       int slabDepth);
+
+#endif